@@ -0,0 +1,112 @@
+#include "ogl_mesh_buffer.h"
+#include "glad/glad.h"
+#include <string.h>
+
+static const GLbitfield ogl_mapped_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+void ogl_mesh_buffer_init(ogl_mesh_buffer* buffer, int vertex_format, int vertex_stride, int vertex_capacity, int index_capacity) {
+    memset(buffer, 0, sizeof *buffer);
+    buffer->vertex_format = vertex_format;
+    buffer->layout = ptm_get_vertex_layout(vertex_format, vertex_stride);
+    buffer->vertex_capacity = vertex_capacity;
+    buffer->index_capacity = index_capacity;
+
+    // Coherent, so writes are visible to the GPU without flushing. The
+    // mapping stays for the buffer's lifetime (and is only written to).
+    GLsizeiptr vertices_size = (GLsizeiptr)vertex_capacity * buffer->layout.stride;
+    GLsizeiptr indices_size = (GLsizeiptr)index_capacity * sizeof(PTM_INDEX);
+    glCreateBuffers(1, &buffer->vertex_buffer);
+    glNamedBufferStorage(buffer->vertex_buffer, vertices_size > 0 ? vertices_size : 1, NULL, ogl_mapped_flags);
+    buffer->vertices = (unsigned char*)glMapNamedBufferRange(buffer->vertex_buffer, 0, vertices_size > 0 ? vertices_size : 1, ogl_mapped_flags);
+
+    glCreateBuffers(1, &buffer->index_buffer);
+    glNamedBufferStorage(buffer->index_buffer, indices_size > 0 ? indices_size : 1, NULL, ogl_mapped_flags);
+    buffer->indices = (unsigned char*)glMapNamedBufferRange(buffer->index_buffer, 0, indices_size > 0 ? indices_size : 1, ogl_mapped_flags);
+
+    int half_texcoords = (vertex_format & PTM_VERTEX_HALF_TEXCOORDS) != 0;
+    int oct_normals = (vertex_format & PTM_VERTEX_OCT_NORMALS) != 0;
+    glCreateVertexArrays(1, &buffer->vao);
+
+    glEnableVertexArrayAttrib(buffer->vao, 0);
+    glVertexArrayAttribBinding(buffer->vao, 0, 0);
+    glVertexArrayAttribFormat(buffer->vao, 0, 3, GL_FLOAT, GL_FALSE, buffer->layout.position_offset);
+
+    glEnableVertexArrayAttrib(buffer->vao, 1);
+    glVertexArrayAttribBinding(buffer->vao, 1, 0);
+    glVertexArrayAttribFormat(buffer->vao, 1, 2, half_texcoords ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, buffer->layout.texcoord_offset);
+
+    // Octahedral normals and tangents come out of the vao as their 2
+    // encoded coordinates (and the tangent's sign): decode in the shader
+    glEnableVertexArrayAttrib(buffer->vao, 2);
+    glVertexArrayAttribBinding(buffer->vao, 2, 0);
+    glVertexArrayAttribFormat(buffer->vao, 2, oct_normals ? 2 : 3, oct_normals ? GL_SHORT : GL_FLOAT, GL_TRUE, buffer->layout.normal_offset);
+
+    glEnableVertexArrayAttrib(buffer->vao, 3);
+    glVertexArrayAttribBinding(buffer->vao, 3, 0);
+    glVertexArrayAttribFormat(buffer->vao, 3, oct_normals ? 3 : 4, oct_normals ? GL_BYTE : GL_FLOAT, GL_TRUE, buffer->layout.tangent_offset);
+
+    glVertexArrayVertexBuffer(buffer->vao, 0, buffer->vertex_buffer, 0, buffer->layout.stride);
+    glVertexArrayElementBuffer(buffer->vao, buffer->index_buffer);
+}
+
+void ogl_count_map_meshes(ptm_map* map, int* vertex_count, int* index_count) {
+    *vertex_count = 0;
+    *index_count = 0;
+
+    // Deferred maps build the meshes they don't have yet
+    for (ptm_mesh* mesh = ptm_entity_get_meshes(map, &map->world); mesh != NULL; mesh = mesh->next) {
+        *vertex_count += mesh->vertex_count;
+        *index_count += mesh->index_count;
+    }
+
+    for (ptm_entity_class* c = map->entity_classes; c != NULL; c = c->next) {
+        for (ptm_entity* entity = c->entities; entity != NULL; entity = entity->next) {
+            for (ptm_mesh* mesh = ptm_entity_get_meshes(map, entity); mesh != NULL; mesh = mesh->next) {
+                *vertex_count += mesh->vertex_count;
+                *index_count += mesh->index_count;
+            }
+        }
+    }
+}
+
+int ogl_mesh_buffer_upload(ogl_mesh_buffer* buffer, const ptm_mesh* mesh, ogl_mesh_draw* draw) {
+    if (buffer->vertex_count + mesh->vertex_count > buffer->vertex_capacity || buffer->index_count + mesh->index_count > buffer->index_capacity) {
+        return 0;
+    }
+
+    // Meshes already interleaved the same way (from the load options, or
+    // a binary cache) are copied as they are, the rest are written in place
+    unsigned char* vertices = buffer->vertices + (size_t)buffer->vertex_count * buffer->layout.stride;
+
+    if (mesh->vertices != NULL && mesh->vertex_format == buffer->vertex_format && mesh->vertex_stride == buffer->layout.stride) {
+        memcpy(vertices, mesh->vertices, (size_t)mesh->vertex_count * buffer->layout.stride);
+    }
+    else {
+        ptm_write_vertices(mesh, buffer->vertex_format, buffer->layout.stride, vertices);
+    }
+
+    // Indices stay relative to the mesh: draws add the base vertex
+    memcpy(buffer->indices + (size_t)buffer->index_count * sizeof(PTM_INDEX), mesh->indices, (size_t)mesh->index_count * sizeof(PTM_INDEX));
+
+    draw->base_vertex = buffer->vertex_count;
+    draw->first_index = buffer->index_count;
+    draw->index_count = mesh->index_count;
+    buffer->vertex_count += mesh->vertex_count;
+    buffer->index_count += mesh->index_count;
+    return 1;
+}
+
+void ogl_mesh_buffer_draw(const ogl_mesh_buffer* buffer, const ogl_mesh_draw* draw) {
+    GLenum index_type = sizeof(PTM_INDEX) == 1 ? GL_UNSIGNED_BYTE : sizeof(PTM_INDEX) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    glBindVertexArray(buffer->vao);
+    glDrawElementsBaseVertex(GL_TRIANGLES, draw->index_count, index_type, (const void*)((size_t)draw->first_index * sizeof(PTM_INDEX)), draw->base_vertex);
+}
+
+void ogl_mesh_buffer_free(ogl_mesh_buffer* buffer) {
+    glUnmapNamedBuffer(buffer->vertex_buffer);
+    glUnmapNamedBuffer(buffer->index_buffer);
+    glDeleteBuffers(1, &buffer->vertex_buffer);
+    glDeleteBuffers(1, &buffer->index_buffer);
+    glDeleteVertexArrays(1, &buffer->vao);
+    memset(buffer, 0, sizeof *buffer);
+}
@@ -0,0 +1,47 @@
+#ifndef OGL_MESH_BUFFER_H
+#define OGL_MESH_BUFFER_H
+
+#include "pt_map.h"
+
+// Compile ogl_mesh_buffer.c into the program that has the pt_map 
+// implementation, with the same PTM_ defines (on the command line, say):
+// the layout of meshes and the size of indices depend on PTM_REAL and
+// PTM_INDEX, so it can't be built on its own.
+
+// One vertex and one index buffer for many meshes, persistently mapped
+// (GL_ARB_buffer_storage, core since 4.4): meshes are written straight
+// into them, instead of into a copy that glBufferData copies again.
+typedef struct ogl_mesh_buffer {
+    unsigned int vao;
+    unsigned int vertex_buffer;
+    unsigned int index_buffer;
+    unsigned char* vertices;
+    unsigned char* indices;
+    int vertex_format;
+    ptm_vertex_layout layout;
+    int vertex_capacity;
+    int vertex_count;
+    int index_capacity;
+    int index_count;
+} ogl_mesh_buffer;
+
+// Where a mesh ended up in the buffers, to draw it
+typedef struct ogl_mesh_draw {
+    int base_vertex;
+    int first_index;
+    int index_count;
+} ogl_mesh_draw;
+
+// Attributes 0 to 3 of the vao are the position, texture coordinates,
+// normal and tangent, in the layout of vertex_format (PTM_VERTEX_ flags)
+void ogl_mesh_buffer_init(ogl_mesh_buffer* buffer, int vertex_format, int vertex_stride, int vertex_capacity, int index_capacity);
+
+// Counts every mesh of the map, building them first if it's deferred
+void ogl_count_map_meshes(ptm_map* map, int* vertex_count, int* index_count);
+
+// Returns 0 (and writes nothing) if the mesh doesn't fit anymore
+int ogl_mesh_buffer_upload(ogl_mesh_buffer* buffer, const ptm_mesh* mesh, ogl_mesh_draw* draw);
+void ogl_mesh_buffer_draw(const ogl_mesh_buffer* buffer, const ogl_mesh_draw* draw);
+void ogl_mesh_buffer_free(ogl_mesh_buffer* buffer);
+
+#endif // OGL_MESH_BUFFER_H
@@ -14,13 +14,6 @@ typedef struct ptc_plane {
   PTC_REAL c;
 } ptc_plane;
 
-typedef struct ptc_vertex {
-  PTC_REAL position[3];
-  float distance;
-  int is_clipped;
-  int occurs;
-} ptc_vertex;
-
 typedef struct ptc_edge {
   int vertices[2];
   int faces[2];
@@ -28,17 +21,46 @@ typedef struct ptc_edge {
 } ptc_edge;
 
 typedef struct ptc_face {
-  int* edges;
+  int edge_start;    // the face's edges are face_edges[edge_start + i] in the mesh
   int edge_count;
+  int edge_capacity;
   PTC_REAL normal[3];
   void* userdata;
   int is_clipped;
 } ptc_face;
 
+// Gives a mesh its memory from somewhere other than PTC_MALLOC, like an
+// arena. reallocate works like realloc (block may be NULL), but is also
+// told the old size of the block. release may be NULL.
+typedef struct ptc_allocator {
+  void* (*reallocate)(void* userdata, void* block, int old_bytes, int new_bytes);
+  void (*release)(void* userdata, void* block);
+  void* userdata;
+} ptc_allocator;
+
+// How much clipping a mesh has done. Only counted when PTC_STATS is 
+// defined (otherwise it stays zeroed): ptc_mesh_reset keeps it, so it
+// adds up over every mesh clipped with the same ptc_mesh.
+typedef struct ptc_stats {
+  int planes_clipped;   // measured against the vertices by ptc_clip
+  int planes_skipped;   // by ptc_clip_planes, without measuring anything
+  int vertices_created; // by clipping, not ptc_init_bounds
+  int edges_created;
+  int faces_created;
+} ptc_stats;
+
 typedef struct ptc_mesh {
-  ptc_vertex* vertices;
+  // Vertices are stored as separate arrays, so ptc_clip can measure
+  // several at once: vertex i is at (vertex_x[i], vertex_y[i], vertex_z[i]),
+  // and is clipped if bit (i % 32) of vertex_clipped[i / 32] is set.
+  PTC_REAL* vertex_x;
+  PTC_REAL* vertex_y;
+  PTC_REAL* vertex_z;
+  float* vertex_distances;  // from the last clipping plane
+  int* vertex_occurs;       // scratch space for ptc_clip, ptc_compact and ptc_get_vertices
+  unsigned int* vertex_clipped;
   int vertex_count;
-  int vertex_capacity;
+  int vertex_capacity;      // always a multiple of 32
 
   ptc_edge* edges;
   int edge_count;
@@ -47,17 +69,43 @@ typedef struct ptc_mesh {
   ptc_face* faces;
   int face_count;
   int face_capacity;
+
+  // Every face's edge list, in one pool: each face owns a range of it
+  int* face_edges;
+  int face_edge_count;
+  int face_edge_capacity;
+
+  // Optional: left zeroed, memory comes from PTC_MALLOC/REALLOC/FREE
+  ptc_allocator allocator;
+
+  ptc_stats stats;
 } ptc_mesh;
 
 void ptc_init_bounds(ptc_mesh* mesh, PTC_REAL min[3], PTC_REAL max[3]);
+void ptc_mesh_reset(ptc_mesh* mesh); // empty the mesh, keeping its memory for the next one
 void ptc_free(ptc_mesh* mesh);
 void ptc_clip(ptc_mesh* mesh, ptc_plane* plane, void* userdata);
+
+// Clip by every plane, like calling ptc_clip for each (userdata may be 
+// NULL), but cheaper: planes that can't cut the mesh are skipped, and it
+// stops as soon as nothing is left. On a box fresh from ptc_init_bounds,
+// axis-aligned planes just move its sides. Returns 0 if nothing is left.
+int ptc_clip_planes(ptc_mesh* mesh, ptc_plane* planes, int plane_count, void** userdata);
+
+// Remove everything that has been clipped away, keeping the order of 
+// what's left. ptc_clip also does this itself once most of the mesh 
+// is dead, so vertex, edge and face indices can change on every clip.
+void ptc_compact(ptc_mesh* mesh);
+
+// Write out a face's vertices as a loop in the given winding around its
+// normal, with the first vertex repeated at the end. Returns how many
+// that is (edge_count + 1): pass NULL vertices to just ask.
 int ptc_get_vertices(ptc_mesh* mesh, int face, int* vertices, ptc_winding winding);
 
 #endif // PT_CLIP_H
 
-#define PT_CLIP_IMPLEMENTATION
-#ifdef PT_CLIP_IMPLEMENTATION
+#if defined(PT_CLIP_IMPLEMENTATION) && !defined(PT_CLIP_IMPLEMENTATION_INCLUDED)
+#define PT_CLIP_IMPLEMENTATION_INCLUDED
 
 #ifndef PTC_ASSERT
   #include <assert.h>
@@ -71,6 +119,39 @@ int ptc_get_vertices(ptc_mesh* mesh, int face, int* vertices, ptc_winding windin
   #define PTC_FREE(block) free(block)
 #endif
 
+#ifndef PTC_EPSILON
+  #define PTC_EPSILON 0.01f
+#endif
+
+// Hooks to time ptc_clip, ptc_clip_planes and ptc_compact with your own
+// profiler: zone is a string literal ("clip", "clip planes", "compact")
+#ifndef PTC_PROFILE_BEGIN
+  #define PTC_PROFILE_BEGIN(zone)
+  #define PTC_PROFILE_END(zone)
+#endif
+
+#ifdef PTC_STATS
+  #define PTC__COUNT(counter, amount) ((counter) += (amount))
+#else
+  #define PTC__COUNT(counter, amount) ((void)0)
+#endif
+
+// The distance of each vertex from a clipping plane is measured 8 or 4 at
+// once with AVX, SSE or NEON, when the compiler targets them. Define 
+// PTC_NO_SIMD to always use the plain loop.
+#ifndef PTC_NO_SIMD
+  #if defined(__AVX__)
+    #include <immintrin.h>
+    #define PTC__AVX
+  #elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define PTC__SSE
+  #elif defined(__ARM_NEON) || defined(_M_ARM64)
+    #include <arm_neon.h>
+    #define PTC__NEON
+  #endif
+#endif
+
 #ifndef PTC_SQRTF
   #include <math.h>
   #if PTC_REAL == double
@@ -97,6 +178,9 @@ static PTC_REAL ptc__dot_product(PTC_REAL* a, PTC_REAL* b) {
 }
 
 static void ptc__cross_product(PTC_REAL* result, PTC_REAL* a, PTC_REAL* b) {
+  result[0] = a[1] * b[2] - a[2] * b[1];
+  result[1] = a[2] * b[0] - a[0] * b[2];
+  result[2] = a[0] * b[1] - a[1] * b[0];
 }
 
 static void ptc__lerp(PTC_REAL* result, PTC_REAL* from, PTC_REAL* to, float t) {
@@ -110,14 +194,189 @@ static PTC_REAL ptc__plane_distance(ptc_plane* plane, PTC_REAL* position) {
   return ptc__dot_product(plane->normal, position) - plane->c;
 }
 
+static void ptc__get_position(ptc_mesh* mesh, int vertex, PTC_REAL* position) {
+  position[0] = mesh->vertex_x[vertex];
+  position[1] = mesh->vertex_y[vertex];
+  position[2] = mesh->vertex_z[vertex];
+}
+
+static int ptc__is_vertex_clipped(ptc_mesh* mesh, int vertex) {
+  return (mesh->vertex_clipped[vertex >> 5] >> (vertex & 31)) & 1;
+}
+
+static void ptc__clip_vertex(ptc_mesh* mesh, int vertex) {
+  mesh->vertex_clipped[vertex >> 5] |= 1u << (vertex & 31);
+}
+
+static int ptc__count_bits(unsigned int bits) {
+#if defined(__GNUC__)
+  return __builtin_popcount(bits);
+#else
+  int count = 0;
+
+  for (; bits != 0; bits &= bits - 1) {
+    count++;
+  }
+
+  return count;
+#endif
+}
+
+static PTC_REAL ptc__abs(PTC_REAL value) {
+  return value < 0 ? -value : value;
+}
+
+static int ptc__is_axis_aligned(ptc_plane* plane) {
+  return (plane->normal[0] != 0) + (plane->normal[1] != 0) + (plane->normal[2] != 0) == 1;
+}
+
+static int ptc__get_bounds(ptc_mesh* mesh, PTC_REAL* min, PTC_REAL* max) {
+  int count = 0;
+
+  for (int i = 0; i < mesh->vertex_count; i++) {
+    if (ptc__is_vertex_clipped(mesh, i)) {
+      continue;
+    }
+
+    PTC_REAL position[3];
+    ptc__get_position(mesh, i, position);
+
+    for (int j = 0; j < 3; j++) {
+      if (count == 0 || position[j] < min[j]) min[j] = position[j];
+      if (count == 0 || position[j] > max[j]) max[j] = position[j];
+    }
+
+    count++;
+  }
+
+  return count;
+}
+
+static int ptc__is_box(ptc_mesh* mesh, PTC_REAL* min, PTC_REAL* max) {
+  // A box like ptc_init_bounds makes: 6 faces that no plane made 
+  // (so they have no userdata), and 8 vertices at its corners.
+  if (mesh->vertex_count != 8 || mesh->face_count != 6 || ptc__get_bounds(mesh, min, max) != 8) {
+    return 0;
+  }
+
+  for (int i = 0; i < mesh->face_count; i++) {
+    if (mesh->faces[i].userdata != NULL || mesh->faces[i].is_clipped) {
+      return 0;
+    }
+  }
+
+  int corners = 0;
+
+  for (int i = 0; i < mesh->vertex_count; i++) {
+    PTC_REAL position[3];
+    ptc__get_position(mesh, i, position);
+    int corner = 0;
+
+    for (int j = 0; j < 3; j++) {
+      if (position[j] == max[j]) corner |= 1 << j;
+      else if (position[j] != min[j]) return 0;
+    }
+
+    corners |= 1 << corner;
+  }
+
+  return corners == 0xFF;
+}
+
+static void ptc__clip_everything(ptc_mesh* mesh) {
+  for (int i = 0; i < mesh->vertex_count; i++) {
+    ptc__clip_vertex(mesh, i);
+  }
+  for (int i = 0; i < mesh->edge_count; i++) {
+    mesh->edges[i].is_clipped = 1;
+  }
+  for (int i = 0; i < mesh->face_count; i++) {
+    mesh->faces[i].is_clipped = 1;
+  }
+}
+
+static void* ptc__reallocate(ptc_mesh* mesh, void* block, int old_bytes, int new_bytes) {
+  if (mesh->allocator.reallocate != NULL) {
+    return mesh->allocator.reallocate(mesh->allocator.userdata, block, old_bytes, new_bytes);
+  }
+  return block != NULL ? PTC_REALLOC(block, new_bytes) : PTC_MALLOC(new_bytes);
+}
+
+static void ptc__release(ptc_mesh* mesh, void* block) {
+  if (mesh->allocator.reallocate != NULL) {
+    if (mesh->allocator.release != NULL && block != NULL) {
+      mesh->allocator.release(mesh->allocator.userdata, block);
+    }
+    return;
+  }
+  PTC_FREE(block);
+}
+
+static void ptc__grow_face_edges(ptc_mesh* mesh, int count) {
+  // The pool is full: rather than growing it as is, move every face's
+  // range into a new one. Ranges left behind by faces that moved (or
+  // were clipped away) are dropped, so the pool only grows with need.
+  int needed = count;
+
+  for (int i = 0; i < mesh->face_count; i++) {
+    needed += mesh->faces[i].edge_count > 0 ? mesh->faces[i].edge_capacity : 0;
+  }
+
+  int capacity = mesh->face_edge_capacity;
+
+  while (capacity < needed * 2) {
+    capacity = (capacity == 0) ? 64 : capacity * 2;
+  }
+
+  int* face_edges = (int*)ptc__reallocate(mesh, NULL, 0, (int)sizeof(int) * capacity);
+  int face_edge_count = 0;
+
+  for (int i = 0; i < mesh->face_count; i++) {
+    ptc_face* f = &mesh->faces[i];
+
+    if (f->edge_count <= 0) {
+      f->edge_start = 0;
+      f->edge_capacity = 0;
+      continue;
+    }
+
+    ptc__copy_memory(&face_edges[face_edge_count], &mesh->face_edges[f->edge_start], sizeof(int) * f->edge_count);
+    f->edge_start = face_edge_count;
+    face_edge_count += f->edge_capacity;
+  }
+
+  ptc__release(mesh, mesh->face_edges);
+  mesh->face_edges = face_edges;
+  mesh->face_edge_count = face_edge_count;
+  mesh->face_edge_capacity = capacity;
+}
+
+static void ptc__reserve_face_edges(ptc_mesh* mesh, int face, int capacity) {
+  if (mesh->face_edge_capacity < mesh->face_edge_count + capacity) {
+    ptc__grow_face_edges(mesh, capacity);
+  }
+
+  // Faces only ever move to the end of the pool, with their edges
+  ptc_face* f = &mesh->faces[face];
+  int start = mesh->face_edge_count;
+  ptc__copy_memory(&mesh->face_edges[start], &mesh->face_edges[f->edge_start], sizeof(int) * f->edge_count);
+  mesh->face_edge_count += capacity;
+  f->edge_start = start;
+  f->edge_capacity = capacity;
+}
+
 static void ptc__add_face_edge(ptc_mesh* mesh, int face, int edge) {
   if (face == -1) return;
 
-  // Add the edge to the face's internal list
+  // Add the edge to the face's range, moving it if it's full
   ptc_face* f = &mesh->faces[face];
+
+  if (f->edge_count == f->edge_capacity) {
+    ptc__reserve_face_edges(mesh, face, f->edge_capacity < 4 ? 8 : f->edge_capacity * 2);
+  }
+
+  mesh->face_edges[f->edge_start + f->edge_count] = edge;
   f->edge_count++;
-  f->edges = (int*)PTC_REALLOC(f->edges, sizeof(ptc_edge) * f->edge_count);
-  f->edges[f->edge_count - 1] = edge;
 
   // Add the face to the edge's internal list
   ptc_edge* e = &mesh->edges[edge];
@@ -129,6 +388,7 @@ static void ptc__add_face_edge(ptc_mesh* mesh, int face, int edge) {
 static void ptc__remove_face_edge(ptc_mesh* mesh, int face, int edge) {
   if (face == -1) return;
   ptc_face* f = &mesh->faces[face];
+  int* edges = &mesh->face_edges[f->edge_start];
 
   // If we want to remove the final edge, we can simply
   // decrease our count. Otherwise, we swap the final
@@ -136,55 +396,79 @@ static void ptc__remove_face_edge(ptc_mesh* mesh, int face, int edge) {
   // (note: this makes the edge list unstable, which happens to be okay)
   int last = f->edge_count - 1;
 
-  if (f->edges[last] != edge) {
+  if (edges[last] != edge) {
     for (int i = 0; i < f->edge_count; i++) {
-      if (f->edges[i] == edge) {
-        f->edges[i] = f->edges[last];
+      if (edges[i] == edge) {
+        edges[i] = edges[last];
         break;
       }
     }
   }
 
+  // The range keeps its capacity, for edges added later
   f->edge_count--;
 
   // Remove the face if all it's edges have been removed
   if (f->edge_count <= 0) {
     f->is_clipped = 1;
   }
-  else {
-    f->edges = (int*)PTC_REALLOC(f->edges, sizeof(ptc_edge) * f->edge_count);
-  }
+}
+
+static void ptc__reserve_vertices(ptc_mesh* mesh, int capacity) {
+  int old_capacity = mesh->vertex_capacity;
+  capacity = (capacity + 31) & ~31;
+
+  #define PTC__GROW_VERTICES(array, type, count) \
+    mesh->array = (type*)ptc__reallocate(mesh, mesh->array, (int)sizeof(type) * (old_capacity / count), (int)sizeof(type) * (capacity / count))
+
+  PTC__GROW_VERTICES(vertex_x, PTC_REAL, 1);
+  PTC__GROW_VERTICES(vertex_y, PTC_REAL, 1);
+  PTC__GROW_VERTICES(vertex_z, PTC_REAL, 1);
+  PTC__GROW_VERTICES(vertex_distances, float, 1);
+  PTC__GROW_VERTICES(vertex_occurs, int, 1);
+  PTC__GROW_VERTICES(vertex_clipped, unsigned int, 32);
+  #undef PTC__GROW_VERTICES
+
+  mesh->vertex_capacity = capacity;
 }
 
 static int ptc__add_vertex(ptc_mesh* mesh, PTC_REAL* position) {
-  mesh->vertex_count++;
-  int capacity = mesh->vertex_capacity;
-  int count = mesh->vertex_count;
+  int vertex = mesh->vertex_count++;
 
-  if (capacity < count + 1) {
-    mesh->vertex_capacity = (capacity == 0) ? 10 : capacity * 2;
-    mesh->vertices = (ptc_vertex*)PTC_REALLOC(mesh->vertices, sizeof(ptc_vertex)*capacity);
+  if (mesh->vertex_capacity < mesh->vertex_count) {
+    ptc__reserve_vertices(mesh, mesh->vertex_capacity == 0 ? 32 : mesh->vertex_capacity * 2);
   }
 
-  ptc_vertex* vertex = &mesh->vertices[count - 1];
-  ptc__zero_memory(vertex, sizeof vertex);
-  ptc__copy_memory(vertex->position, position, sizeof vertex->position);
+  // A fresh word of the bitset may hold anything
+  if ((vertex & 31) == 0) {
+    mesh->vertex_clipped[vertex >> 5] = 0;
+  }
 
-  return count - 1;
+  mesh->vertex_x[vertex] = position[0];
+  mesh->vertex_y[vertex] = position[1];
+  mesh->vertex_z[vertex] = position[2];
+  mesh->vertex_distances[vertex] = 0;
+  mesh->vertex_occurs[vertex] = 0;
+  mesh->vertex_clipped[vertex >> 5] &= ~(1u << (vertex & 31));
+
+  return vertex;
 }
 
 static int ptc__add_edge(ptc_mesh* mesh, int v0, int v1) {
   mesh->edge_count++;
+  PTC__COUNT(mesh->stats.edges_created, 1);
   int capacity = mesh->edge_capacity;
   int count = mesh->edge_count;
 
-  if (capacity < count + 1) {
-    mesh->edge_capacity = (capacity == 0) ? 10 : capacity * 2;
-    mesh->edges = (ptc_edge*)PTC_REALLOC(mesh->edges, sizeof(ptc_edge)*capacity);
+  if (capacity < count) {
+    int old_bytes = (int)sizeof(ptc_edge) * mesh->edge_capacity;
+    capacity = (capacity == 0) ? 10 : capacity * 2;
+    mesh->edge_capacity = capacity;
+    mesh->edges = (ptc_edge*)ptc__reallocate(mesh, mesh->edges, old_bytes, (int)sizeof(ptc_edge) * capacity);
   }
 
   ptc_edge* edge = &mesh->edges[count - 1];
-  ptc__zero_memory(edge, sizeof edge);
+  ptc__zero_memory(edge, sizeof *edge);
   edge->faces[0] = -1;
   edge->faces[1] = -1;
   edge->vertices[0] = v0;
@@ -195,40 +479,46 @@ static int ptc__add_edge(ptc_mesh* mesh, int v0, int v1) {
 
 static int ptc__add_face(ptc_mesh* mesh, PTC_REAL normal[3], void* userdata) {
   mesh->face_count++;
+  PTC__COUNT(mesh->stats.faces_created, 1);
   int capacity = mesh->face_capacity;
   int count = mesh->face_count;
 
-  if (capacity < count + 1) {
-    mesh->face_capacity = (capacity == 0) ? 10 : capacity * 2;
-    mesh->faces = (ptc_face*)PTC_REALLOC(mesh->faces, sizeof(ptc_face)*capacity);
+  if (capacity < count) {
+    int old_bytes = (int)sizeof(ptc_face) * mesh->face_capacity;
+    capacity = (capacity == 0) ? 10 : capacity * 2;
+    mesh->face_capacity = capacity;
+    mesh->faces = (ptc_face*)ptc__reallocate(mesh, mesh->faces, old_bytes, (int)sizeof(ptc_face) * capacity);
   }
 
   ptc_face* face = &mesh->faces[count - 1];
   ptc__zero_memory(face, sizeof *face);
   ptc__copy_memory(face->normal, normal, sizeof(PTC_REAL) * 3);
   face->userdata = userdata;
+  ptc__reserve_face_edges(mesh, count - 1, 8);
 
   return count - 1;
 }
 
-static void ptc__init_face(ptc_face* face, int e0, int e1, int e2, int e3, PTC_REAL n0, PTC_REAL n1, PTC_REAL n2) {
+static void ptc__init_face(ptc_mesh* mesh, ptc_face* face, int e0, int e1, int e2, int e3, PTC_REAL n0, PTC_REAL n1, PTC_REAL n2) {
   ptc__zero_memory(face, sizeof *face);
+  face->edge_start = mesh->face_edge_count;
   face->edge_count = 4;
-  face->edges = (int*)PTC_MALLOC(4 * sizeof(int));
-  face->edges[0] = e0;
-  face->edges[1] = e1;
-  face->edges[2] = e2;
-  face->edges[3] = e3;
+  face->edge_capacity = 8;
+  mesh->face_edge_count += 8;
+
+  int* edges = &mesh->face_edges[face->edge_start];
+  edges[0] = e0;
+  edges[1] = e1;
+  edges[2] = e2;
+  edges[3] = e3;
   face->normal[0] = n0;
   face->normal[1] = n1;
   face->normal[2] = n2;
 }
 
-static void ptc__init_vertex(ptc_vertex* vertex, PTC_REAL x, PTC_REAL y, PTC_REAL z) {
-  ptc__zero_memory(vertex, sizeof *vertex);
-  vertex->position[0] = x;
-  vertex->position[1] = y;
-  vertex->position[2] = z;
+static void ptc__init_vertex(ptc_mesh* mesh, PTC_REAL x, PTC_REAL y, PTC_REAL z) {
+  PTC_REAL position[3] = {x, y, z};
+  ptc__add_vertex(mesh, position);
 }
 
 static void ptc__init_edge(ptc_edge* edge, int v0, int v1, int f0, int f1) {
@@ -239,17 +529,42 @@ static void ptc__init_edge(ptc_edge* edge, int v0, int v1, int f0, int f1) {
   edge->faces[1] = f1;
 }
 
+static void ptc__reserve(ptc_mesh* mesh, int vertices, int edges, int faces, int face_edges) {
+  if (mesh->vertex_capacity < vertices) {
+    ptc__reserve_vertices(mesh, vertices);
+  }
+  if (mesh->edge_capacity < edges) {
+    int old_bytes = (int)sizeof(ptc_edge) * mesh->edge_capacity;
+    mesh->edge_capacity = edges;
+    mesh->edges = (ptc_edge*)ptc__reallocate(mesh, mesh->edges, old_bytes, (int)sizeof(ptc_edge) * edges);
+  }
+  if (mesh->face_capacity < faces) {
+    int old_bytes = (int)sizeof(ptc_face) * mesh->face_capacity;
+    mesh->face_capacity = faces;
+    mesh->faces = (ptc_face*)ptc__reallocate(mesh, mesh->faces, old_bytes, (int)sizeof(ptc_face) * faces);
+  }
+  if (mesh->face_edge_capacity < face_edges) {
+    int old_bytes = (int)sizeof(int) * mesh->face_edge_capacity;
+    mesh->face_edge_capacity = face_edges;
+    mesh->face_edges = (int*)ptc__reallocate(mesh, mesh->face_edges, old_bytes, (int)sizeof(int) * face_edges);
+  }
+}
+
 void ptc_init_bounds(ptc_mesh* mesh, PTC_REAL min[3], PTC_REAL max[3]) {
-  mesh->vertex_count = 8;
-  ptc_vertex* v = mesh->vertices;
-  ptc__init_vertex(&v[0], min[0], min[1], min[2]); // front bottom left
-  ptc__init_vertex(&v[1], min[0], max[1], min[2]); // front top left
-  ptc__init_vertex(&v[2], max[0], max[1], min[2]); // front top right
-  ptc__init_vertex(&v[3], max[0], min[1], min[2]); // front bottom 
-  ptc__init_vertex(&v[4], min[0], min[1], max[2]); // back bottom left
-  ptc__init_vertex(&v[5], min[0], max[1], max[2]); // back top left
-  ptc__init_vertex(&v[6], max[0], max[1], max[2]); // back top right
-  ptc__init_vertex(&v[7], max[0], min[1], max[2]); // back bottom right
+  // The box needs 8 vertices, 12 edges and 6 faces (with 48 face edges). 
+  // Reserve room to spare, so clipping a typical brush doesn't have to 
+  // grow anything after this.
+  ptc_mesh_reset(mesh);
+  ptc__reserve(mesh, 32, 48, 16, 128);
+
+  ptc__init_vertex(mesh, min[0], min[1], min[2]); // front bottom left
+  ptc__init_vertex(mesh, min[0], max[1], min[2]); // front top left
+  ptc__init_vertex(mesh, max[0], max[1], min[2]); // front top right
+  ptc__init_vertex(mesh, max[0], min[1], min[2]); // front bottom 
+  ptc__init_vertex(mesh, min[0], min[1], max[2]); // back bottom left
+  ptc__init_vertex(mesh, min[0], max[1], max[2]); // back top left
+  ptc__init_vertex(mesh, max[0], max[1], max[2]); // back top right
+  ptc__init_vertex(mesh, max[0], min[1], max[2]); // back bottom right
 
   mesh->edge_count = 12;
   ptc_edge* e = mesh->edges;
@@ -268,57 +583,178 @@ void ptc_init_bounds(ptc_mesh* mesh, PTC_REAL min[3], PTC_REAL max[3]) {
 
   mesh->face_count = 6;
   ptc_face* f = mesh->faces;
-  ptc__init_face(&f[0], 0, 1, 2, 3, 0, 0,-1);   // front
-  ptc__init_face(&f[1], 4, 5, 6, 7, 0, 0, 1);   // back
-  ptc__init_face(&f[2], 2, 6, 8, 9, -1, 0, 0);   // left
-  ptc__init_face(&f[3], 3, 7, 10, 11, 1, 0, 0); // right
-  ptc__init_face(&f[4], 1, 5, 9, 11, 0, 1, 0);  // top
-  ptc__init_face(&f[5], 0, 4, 8, 10, 0,-1, 0);  // bottom
+  ptc__init_face(mesh, &f[0], 0, 1, 2, 3, 0, 0,-1);   // front
+  ptc__init_face(mesh, &f[1], 4, 5, 6, 7, 0, 0, 1);   // back
+  ptc__init_face(mesh, &f[2], 2, 6, 8, 9, -1, 0, 0);   // left
+  ptc__init_face(mesh, &f[3], 3, 7, 10, 11, 1, 0, 0); // right
+  ptc__init_face(mesh, &f[4], 1, 5, 9, 11, 0, 1, 0);  // top
+  ptc__init_face(mesh, &f[5], 0, 4, 8, 10, 0,-1, 0);  // bottom
+}
+
+void ptc_mesh_reset(ptc_mesh* mesh) {
+  mesh->vertex_count = 0;
+  mesh->edge_count = 0;
+  mesh->face_count = 0;
+  mesh->face_edge_count = 0;
 }
 
 void ptc_free(ptc_mesh* mesh) {
-  for (int i = 0; i < mesh->face_count; i++) {
-    PTC_FREE(mesh->faces[i].edges);
-  }
-  PTC_FREE(mesh->faces);
-  PTC_FREE(mesh->edges);
-  PTC_FREE(mesh->vertices);
+  ptc__release(mesh, mesh->face_edges);
+  ptc__release(mesh, mesh->faces);
+  ptc__release(mesh, mesh->edges);
+  ptc__release(mesh, mesh->vertex_clipped);
+  ptc__release(mesh, mesh->vertex_occurs);
+  ptc__release(mesh, mesh->vertex_distances);
+  ptc__release(mesh, mesh->vertex_z);
+  ptc__release(mesh, mesh->vertex_y);
+  ptc__release(mesh, mesh->vertex_x);
+
+  // Only the allocator is kept, so the mesh can be used again
+  ptc_allocator allocator = mesh->allocator;
+  ptc__zero_memory(mesh, sizeof *mesh);
+  mesh->allocator = allocator;
 }
 
-void ptc_clip(ptc_mesh* mesh, ptc_plane* plane, void* userdata) {
-  const PTC_REAL EPSILON = 0.01f;
+#if defined(PTC__AVX)
+  #define PTC__LANES 8
+#elif defined(PTC__SSE) || defined(PTC__NEON)
+  #define PTC__LANES 4
+#endif
+
+#if defined(PTC__LANES)
+// Finds the distances of PTC__LANES vertices from the plane, starting at
+// "first". Returns a bit for each one that is outside it.
+static unsigned int ptc__measure_vertices(ptc_mesh* mesh, ptc_plane* plane, int first) {
+  const PTC_REAL EPSILON = PTC_EPSILON;
+
+#if defined(PTC__AVX)
+  __m256 distance = _mm256_mul_ps(_mm256_loadu_ps(&mesh->vertex_x[first]), _mm256_set1_ps(plane->normal[0]));
+  distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_loadu_ps(&mesh->vertex_y[first]), _mm256_set1_ps(plane->normal[1])));
+  distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_loadu_ps(&mesh->vertex_z[first]), _mm256_set1_ps(plane->normal[2])));
+  distance = _mm256_sub_ps(distance, _mm256_set1_ps(plane->c));
+
+  // Snap the distance to 0 if it's really small.
+  __m256 is_near = _mm256_and_ps(_mm256_cmp_ps(distance, _mm256_set1_ps(-EPSILON), _CMP_GE_OQ), _mm256_cmp_ps(distance, _mm256_set1_ps(EPSILON), _CMP_LT_OQ));
+  distance = _mm256_andnot_ps(is_near, distance);
+  _mm256_storeu_ps(&mesh->vertex_distances[first], distance);
+
+  return (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(distance, _mm256_set1_ps(EPSILON), _CMP_GE_OQ));
+#elif defined(PTC__SSE)
+  __m128 distance = _mm_mul_ps(_mm_loadu_ps(&mesh->vertex_x[first]), _mm_set1_ps(plane->normal[0]));
+  distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(&mesh->vertex_y[first]), _mm_set1_ps(plane->normal[1])));
+  distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(&mesh->vertex_z[first]), _mm_set1_ps(plane->normal[2])));
+  distance = _mm_sub_ps(distance, _mm_set1_ps(plane->c));
+
+  // Snap the distance to 0 if it's really small.
+  __m128 is_near = _mm_and_ps(_mm_cmpge_ps(distance, _mm_set1_ps(-EPSILON)), _mm_cmplt_ps(distance, _mm_set1_ps(EPSILON)));
+  distance = _mm_andnot_ps(is_near, distance);
+  _mm_storeu_ps(&mesh->vertex_distances[first], distance);
+
+  return (unsigned int)_mm_movemask_ps(_mm_cmpge_ps(distance, _mm_set1_ps(EPSILON)));
+#else
+  float32x4_t distance = vmulq_n_f32(vld1q_f32(&mesh->vertex_x[first]), plane->normal[0]);
+  distance = vaddq_f32(distance, vmulq_n_f32(vld1q_f32(&mesh->vertex_y[first]), plane->normal[1]));
+  distance = vaddq_f32(distance, vmulq_n_f32(vld1q_f32(&mesh->vertex_z[first]), plane->normal[2]));
+  distance = vsubq_f32(distance, vdupq_n_f32(plane->c));
+
+  // Snap the distance to 0 if it's really small.
+  uint32x4_t is_near = vandq_u32(vcgeq_f32(distance, vdupq_n_f32(-EPSILON)), vcltq_f32(distance, vdupq_n_f32(EPSILON)));
+  distance = vreinterpretq_f32_u32(vbicq_u32(vreinterpretq_u32_f32(distance), is_near));
+  vst1q_f32(&mesh->vertex_distances[first], distance);
+
+  // One bit from each lane, like movemask
+  static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+  uint32x4_t is_outside = vandq_u32(vcgeq_f32(distance, vdupq_n_f32(EPSILON)), vld1q_u32(lane_bits));
+  uint32x2_t sum = vpadd_u32(vget_low_u32(is_outside), vget_high_u32(is_outside));
+  return vget_lane_u32(vpadd_u32(sum, sum), 0);
+#endif
+}
+#endif
+
+// Finds the distance of every visible vertex from the plane, and clips
+// the ones outside it. Returns how many were clipped. 
+static int ptc__clip_vertices(ptc_mesh* mesh, ptc_plane* plane, int* count_visible) {
+  const PTC_REAL EPSILON = PTC_EPSILON;
 
   int count_clipped = 0;
-  int count_total = 0;
+  int count_unclipped = 0;
+  int i = 0;
+
+#if defined(PTC__LANES)
+  // A word of the bitset at a time (or what's left of one): vertices that
+  // were already clipped get measured too, but nothing reads their distance.
+  for (; i + PTC__LANES <= mesh->vertex_count; i += 32) {
+    int count = mesh->vertex_count - i < 32 ? (mesh->vertex_count - i) / PTC__LANES * PTC__LANES : 32;
+    unsigned int mask = count == 32 ? ~0u : (1u << count) - 1;
+    unsigned int is_outside = 0;
+
+    for (int j = 0; j < count; j += PTC__LANES) {
+      is_outside |= ptc__measure_vertices(mesh, plane, i + j) << j;
+    }
 
-  // Step one: Calculate the distance of each vertex from the clipping plane.
-  // If the vertex falls on the positive side of the clipping plane, we "clip" it
-  // by making it invisible.
-  for (int i = 0; i < mesh->vertex_count; i++) {
-    ptc_vertex* vertex = &mesh->vertices[i];
+    unsigned int was_clipped = mesh->vertex_clipped[i >> 5] & mask;
+    mesh->vertex_clipped[i >> 5] |= is_outside;
+    count_clipped += ptc__count_bits(is_outside & ~was_clipped);
+    count_unclipped += count - ptc__count_bits(was_clipped);
+
+    if (count < 32) {
+      i += count;
+      break;
+    }
+  }
+#endif
 
-    if (vertex->is_clipped) { 
+  for (; i < mesh->vertex_count; i++) {
+    if (ptc__is_vertex_clipped(mesh, i)) { 
       continue; 
     }
 
-    count_total++;
-    vertex->distance = ptc__plane_distance(plane, vertex->position);
+    PTC_REAL position[3];
+    ptc__get_position(mesh, i, position);
+    float distance = ptc__plane_distance(plane, position);
+    count_unclipped++;
 
-    if (vertex->distance >= EPSILON) {
+    if (distance >= EPSILON) {
       count_clipped++;
-      vertex->is_clipped = 1;
+      ptc__clip_vertex(mesh, i);
     }
-    else if (vertex->distance >= -EPSILON) {
+    else if (distance >= -EPSILON) {
       // Snap the distance to 0 if it's really small.
-      vertex->distance = 0;
+      distance = 0;
     }
+
+    mesh->vertex_distances[i] = distance;
   }
 
+  *count_visible = count_unclipped;
+  return count_clipped;
+}
+
+void ptc_clip(ptc_mesh* mesh, ptc_plane* plane, void* userdata) {
+  PTC_PROFILE_BEGIN("clip");
+  PTC__COUNT(mesh->stats.planes_clipped, 1);
+
+  // Step one: Calculate the distance of each vertex from the clipping plane.
+  // If the vertex falls on the positive side of the clipping plane, we "clip" it
+  // by making it invisible.
+  int count_total = 0;
+  int count_clipped = ptc__clip_vertices(mesh, plane, &count_total);
+
+  int count_remaining = count_total - count_clipped;
   int is_nothing_clipped = count_clipped == 0;
   int is_everything_clipped = count_clipped == count_total;
 
   // A couple easy edge cases that can save us some work
-  if (is_nothing_clipped || is_everything_clipped) {
+  if (is_nothing_clipped) {
+    PTC_PROFILE_END("clip");
+    return;
+  }
+
+  // The plane removed the whole mesh: nothing survives,
+  // so every remaining edge and face is gone too.
+  if (is_everything_clipped) {
+    ptc__clip_everything(mesh);
+    PTC_PROFILE_END("clip");
     return;
   }
 
@@ -330,19 +766,31 @@ void ptc_clip(ptc_mesh* mesh, ptc_plane* plane, void* userdata) {
       continue;
     }
 
-    ptc_vertex* v0 = &mesh->vertices[edge->vertices[0]];
-    ptc_vertex* v1 = &mesh->vertices[edge->vertices[1]];
+    int v0 = edge->vertices[0];
+    int v1 = edge->vertices[1];
+    int is_v0_clipped = ptc__is_vertex_clipped(mesh, v0);
+    int is_v1_clipped = ptc__is_vertex_clipped(mesh, v1);
 
-    if (v0->is_clipped && v1->is_clipped) {
+    if (is_v0_clipped && is_v1_clipped) {
       // The edge lost both of it's vertices: it is completely clipped.
       edge->is_clipped = 1;
       ptc__remove_face_edge(mesh, edge->faces[0], edge_idx);
       ptc__remove_face_edge(mesh, edge->faces[1], edge_idx);
     }
-    else if (!v0->is_clipped && !v1->is_clipped) {
+    else if (!is_v0_clipped && !is_v1_clipped) {
       // The edge is fully visible: no need to do anything.
       continue;
     }
+    else if (mesh->vertex_distances[is_v0_clipped ? v1 : v0] == 0) {
+      // The vertex that's left is on the plane already: splitting the
+      // edge there would only leave a copy of it. The edge is gone, and
+      // the vertex ends the open side of its faces instead. (A face
+      // that's nearly on the plane can lose all its edges this way,
+      // instead of being split into more than one piece.)
+      edge->is_clipped = 1;
+      ptc__remove_face_edge(mesh, edge->faces[0], edge_idx);
+      ptc__remove_face_edge(mesh, edge->faces[1], edge_idx);
+    }
     else {
       // The edge lost one of its two vertices: it is half-split.
       // Calculate the midpoint at which the edge is split.
@@ -353,20 +801,27 @@ void ptc_clip(ptc_mesh* mesh, ptc_plane* plane, void* userdata) {
       //                   |--[d1]----|
       //        |-------[d0-d1]-------|
       // 
-      float d0 = v0->distance;
-      float d1 = v1->distance;
+      float d0 = mesh->vertex_distances[v0];
+      float d1 = mesh->vertex_distances[v1];
       float t =  d0 / (d0 - d1);
+      PTC_REAL p0[3];
+      PTC_REAL p1[3];
       PTC_REAL midpoint[3];
-      ptc__lerp(midpoint, v0->position, v1->position, t);
+      ptc__get_position(mesh, v0, p0);
+      ptc__get_position(mesh, v1, p1);
+      ptc__lerp(midpoint, p0, p1, t);
+      int clipped_side = is_v0_clipped ? 0 : 1;
 
       // Create a new visible vertex at the midpoint.
       // New edges to connect the new vertices are created later,
       // during face processing.
       int new_vertex = ptc__add_vertex(mesh, midpoint);
+      PTC__COUNT(mesh->stats.vertices_created, 1);
+      count_remaining++;
 
       // Replace whichever vertex was clipped in this edge
       // with the new one.
-      edge->vertices[v0->is_clipped ? 0 : 1] = new_vertex;
+      edge->vertices[clipped_side] = new_vertex;
     }
   }
 
@@ -374,7 +829,6 @@ void ptc_clip(ptc_mesh* mesh, ptc_plane* plane, void* userdata) {
   // created vertices into the existing faces. 
   // We also create a new face to close the created hole.
   int new_face_idx = ptc__add_face(mesh, plane->normal, userdata);
-  ptc_face* new_face = &mesh->faces[new_face_idx];
 
   for (int face_idx = 0; face_idx < mesh->face_count; face_idx++) {
     ptc_face* face = &mesh->faces[face_idx];
@@ -383,20 +837,43 @@ void ptc_clip(ptc_mesh* mesh, ptc_plane* plane, void* userdata) {
       continue;
     }
 
+    // All that's left of the face is an edge on the plane: it has no
+    // area, so the new face takes the edge over. If that was the last
+    // face on the other side of it too, the edge goes with them.
+    if (face->edge_count == 1 && face_idx != new_face_idx) {
+      int edge_idx = mesh->face_edges[face->edge_start];
+      ptc_edge* edge = &mesh->edges[edge_idx];
+      int side = edge->faces[0] == face_idx ? 0 : 1;
+      ptc__remove_face_edge(mesh, face_idx, edge_idx);
+      edge->faces[side] = -1;
+
+      if (edge->faces[1 - side] == new_face_idx) {
+        ptc__remove_face_edge(mesh, new_face_idx, edge_idx);
+        edge->is_clipped = 1;
+      }
+      else {
+        ptc__add_face_edge(mesh, new_face_idx, edge_idx);
+      }
+
+      continue;
+    }
+
     // Determine if the face is missing an edge.
     // This problem is solved by counting how many times each vertex occurs in an edge.
     // In a closed loop, each vertex occurs exactly twice (once in each edge it connects to).
     // In an open loop, there will be some vertices that only occur once.
+    int* face_edges = &mesh->face_edges[face->edge_start];
+
     for (int i = 0; i < face->edge_count; i++) {
-      ptc_edge* edge = &mesh->edges[face->edges[i]];
-      mesh->vertices[edge->vertices[0]].occurs = 0;
-      mesh->vertices[edge->vertices[1]].occurs = 0;
+      ptc_edge* edge = &mesh->edges[face_edges[i]];
+      mesh->vertex_occurs[edge->vertices[0]] = 0;
+      mesh->vertex_occurs[edge->vertices[1]] = 0;
     }
 
     for (int i = 0; i < face->edge_count; i++) {
-      ptc_edge* edge = &mesh->edges[face->edges[i]];
-      mesh->vertices[edge->vertices[0]].occurs++;
-      mesh->vertices[edge->vertices[1]].occurs++;
+      ptc_edge* edge = &mesh->edges[face_edges[i]];
+      mesh->vertex_occurs[edge->vertices[0]]++;
+      mesh->vertex_occurs[edge->vertices[1]]++;
     }
 
     // A vertex that only occurs once is an "endpoint".
@@ -404,11 +881,11 @@ void ptc_clip(ptc_mesh* mesh, ptc_plane* plane, void* userdata) {
     int endpoints[2] = {-1, -1};
 
     for (int i = 0; i < face->edge_count; i++) {
-      ptc_edge* edge = &mesh->edges[face->edges[i]];
+      ptc_edge* edge = &mesh->edges[face_edges[i]];
 
       int endpoint = -1;
-      if (mesh->vertices[edge->vertices[0]].occurs == 1) endpoint = edge->vertices[0];
-      if (mesh->vertices[edge->vertices[1]].occurs == 1) endpoint = edge->vertices[1];
+      if (mesh->vertex_occurs[edge->vertices[0]] == 1) endpoint = edge->vertices[0];
+      if (mesh->vertex_occurs[edge->vertices[1]] == 1) endpoint = edge->vertices[1];
 
       // We can ignore this edge if it does not contain an endpoint
       if (endpoint == -1) {
@@ -440,63 +917,269 @@ void ptc_clip(ptc_mesh* mesh, ptc_plane* plane, void* userdata) {
       ptc__add_face_edge(mesh, new_face_idx, edge);
     }
   }
+
+  // Dead geometry is never touched again, but every later clip would
+  // still walk over it: drop it once it's most of the mesh.
+  if (mesh->vertex_count > count_remaining * 2) {
+    ptc_compact(mesh);
+  }
+
+  PTC_PROFILE_END("clip");
+}
+
+static int ptc__clip_planes(ptc_mesh* mesh, ptc_plane* planes, int plane_count, void** userdata) {
+  const PTC_REAL EPSILON = PTC_EPSILON;
+  PTC_REAL min[3];
+  PTC_REAL max[3];
+  int is_box = ptc__is_box(mesh, min, max);
+
+  if (!is_box && ptc__get_bounds(mesh, min, max) == 0) {
+    return 0;
+  }
+
+  if (is_box) {
+    // Axis-aligned planes only move the sides of a box: work out where
+    // each side ends up, and build the box there instead of clipping.
+    // A plane moves a side only if ptc_clip would have clipped anything.
+    void* sides[3][2] = {{NULL, NULL}, {NULL, NULL}, {NULL, NULL}};
+
+    for (int i = 0; i < plane_count; i++) {
+      ptc_plane* plane = &planes[i];
+
+      if (!ptc__is_axis_aligned(plane)) {
+        continue;
+      }
+
+      int axis = plane->normal[0] != 0 ? 0 : plane->normal[1] != 0 ? 1 : 2;
+      PTC_REAL bound = plane->c / plane->normal[axis];
+      void* side = userdata != NULL ? userdata[i] : NULL;
+      PTC__COUNT(mesh->stats.planes_skipped, 1);
+
+      if (plane->normal[axis] > 0 && max[axis] - bound >= EPSILON) {
+        max[axis] = bound;
+        sides[axis][1] = side;
+      }
+      else if (plane->normal[axis] < 0 && bound - min[axis] >= EPSILON) {
+        min[axis] = bound;
+        sides[axis][0] = side;
+      }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+      if (max[axis] - min[axis] < EPSILON) {
+        ptc__clip_everything(mesh);
+        return 0;
+      }
+    }
+
+    // Faces in the order ptc_init_bounds makes them
+    ptc_init_bounds(mesh, min, max);
+    mesh->faces[0].userdata = sides[2][0];
+    mesh->faces[1].userdata = sides[2][1];
+    mesh->faces[2].userdata = sides[0][0];
+    mesh->faces[3].userdata = sides[0][1];
+    mesh->faces[4].userdata = sides[1][1];
+    mesh->faces[5].userdata = sides[1][0];
+  }
+
+  // Otherwise axis-aligned planes still go first: they shrink the 
+  // bounds fastest, so more of the other planes can be skipped.
+  for (int pass = is_box ? 1 : 0; pass < 2; pass++) {
+    for (int i = 0; i < plane_count; i++) {
+      ptc_plane* plane = &planes[i];
+
+      if (ptc__is_axis_aligned(plane) != (pass == 0)) {
+        continue;
+      }
+
+      // The farthest and nearest the bounds get to the plane: 
+      // every vertex is between them.
+      PTC_REAL center[3];
+      PTC_REAL radius = 0;
+
+      for (int j = 0; j < 3; j++) {
+        center[j] = (min[j] + max[j]) * 0.5f;
+        radius += ptc__abs(plane->normal[j]) * (max[j] - min[j]) * 0.5f;
+      }
+
+      PTC_REAL distance = ptc__plane_distance(plane, center);
+
+      // Nothing is far enough in front of the plane to be clipped
+      if (distance + radius < EPSILON) {
+        PTC__COUNT(mesh->stats.planes_skipped, 1);
+        continue;
+      }
+
+      ptc_clip(mesh, plane, userdata != NULL ? userdata[i] : NULL);
+
+      // Everything was in front of the plane: no need for the rest
+      if (distance - radius >= EPSILON || ptc__get_bounds(mesh, min, max) == 0) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+int ptc_clip_planes(ptc_mesh* mesh, ptc_plane* planes, int plane_count, void** userdata) {
+  PTC_PROFILE_BEGIN("clip planes");
+  int result = ptc__clip_planes(mesh, planes, plane_count, userdata);
+  PTC_PROFILE_END("clip planes");
+  return result;
+}
+
+void ptc_compact(ptc_mesh* mesh) {
+  PTC_PROFILE_BEGIN("compact");
+  // Remapping needs a new index for every edge and face: borrow the 
+  // space past the end of the face edge pool for them. Vertices keep
+  // theirs in the (otherwise temporary) vertex_occurs.
+  int map_count = mesh->edge_count + mesh->face_count;
+
+  if (mesh->face_edge_capacity < mesh->face_edge_count + map_count) {
+    ptc__grow_face_edges(mesh, map_count);
+  }
+
+  int* edge_map = &mesh->face_edges[mesh->face_edge_count];
+  int* face_map = &edge_map[mesh->edge_count];
+  int vertex_count = 0;
+  int edge_count = 0;
+  int face_count = 0;
+
+  // Step one: give everything that survives its new index
+  for (int i = 0; i < mesh->vertex_count; i++) {
+    mesh->vertex_occurs[i] = ptc__is_vertex_clipped(mesh, i) ? -1 : vertex_count++;
+  }
+  for (int i = 0; i < mesh->edge_count; i++) {
+    edge_map[i] = mesh->edges[i].is_clipped ? -1 : edge_count++;
+  }
+  for (int i = 0; i < mesh->face_count; i++) {
+    face_map[i] = mesh->faces[i].is_clipped ? -1 : face_count++;
+  }
+
+  // Step two: point the survivors at each other's new indices
+  for (int i = 0; i < mesh->edge_count; i++) {
+    ptc_edge* edge = &mesh->edges[i];
+
+    if (edge->is_clipped) {
+      continue;
+    }
+
+    for (int j = 0; j < 2; j++) {
+      edge->vertices[j] = mesh->vertex_occurs[edge->vertices[j]];
+      edge->faces[j] = edge->faces[j] == -1 ? -1 : face_map[edge->faces[j]];
+      PTC_ASSERT(edge->vertices[j] != -1);
+    }
+  }
+
+  for (int i = 0; i < mesh->face_count; i++) {
+    ptc_face* face = &mesh->faces[i];
+
+    if (face->is_clipped) {
+      continue;
+    }
+
+    int* face_edges = &mesh->face_edges[face->edge_start];
+
+    for (int j = 0; j < face->edge_count; j++) {
+      face_edges[j] = edge_map[face_edges[j]];
+      PTC_ASSERT(face_edges[j] != -1);
+    }
+  }
+
+  // Step three: move them down into place. Nothing moves up,
+  // so this never overwrites something that still has to move.
+  for (int i = 0; i < mesh->vertex_count; i++) {
+    int vertex = mesh->vertex_occurs[i];
+
+    if (vertex != -1) {
+      mesh->vertex_x[vertex] = mesh->vertex_x[i];
+      mesh->vertex_y[vertex] = mesh->vertex_y[i];
+      mesh->vertex_z[vertex] = mesh->vertex_z[i];
+      mesh->vertex_distances[vertex] = mesh->vertex_distances[i];
+    }
+  }
+
+  // Everything left is visible
+  for (int i = 0; i < (vertex_count + 31) / 32; i++) {
+    mesh->vertex_clipped[i] = 0;
+  }
+  for (int i = 0; i < mesh->edge_count; i++) {
+    if (edge_map[i] != -1) {
+      mesh->edges[edge_map[i]] = mesh->edges[i];
+    }
+  }
+  for (int i = 0; i < mesh->face_count; i++) {
+    if (face_map[i] != -1) {
+      mesh->faces[face_map[i]] = mesh->faces[i];
+    }
+  }
+
+  mesh->vertex_count = vertex_count;
+  mesh->edge_count = edge_count;
+  mesh->face_count = face_count;
+  PTC_PROFILE_END("compact");
 }
 
 int ptc_get_vertices(ptc_mesh* mesh, int face, int* vertices, ptc_winding target_winding) {
   ptc_face* f = &mesh->faces[face];
+  int* face_edges = &mesh->face_edges[f->edge_start];
 
   if (vertices != NULL) {
-    vertices[0] = mesh->edges[f->edges[0]].vertices[0];
-    vertices[1] = mesh->edges[f->edges[0]].vertices[1];
+    // In a closed loop every vertex is in exactly two of the face's edges,
+    // so the xor of their indices leads from either one to the other. 
+    // That makes following the loop linear, with no memory of its own.
+    for (int i = 0; i < f->edge_count; i++) {
+      ptc_edge* e = &mesh->edges[face_edges[i]];
+      mesh->vertex_occurs[e->vertices[0]] = 0;
+      mesh->vertex_occurs[e->vertices[1]] = 0;
+    }
 
-    // Populate the remaining vertices such that they form a loop
-    for (int i = 1; i < f->edge_count; i++) {
-      for (int j = 0; j < f->edge_count; j++) {
-        ptc_edge* e = &mesh->edges[f->edges[j]];
-        if (e->vertices[0] == vertices[i] && e->vertices[1] != vertices[i - 1]) {
-          vertices[i + 1] = e->vertices[1];
-          break;
-        }
-        else if (e->vertices[1] == vertices[i] && e->vertices[0] != vertices[i - 1]) {
-          vertices[i + 1] = e->vertices[0];
-          break;
-        }
-      }
+    for (int i = 0; i < f->edge_count; i++) {
+      ptc_edge* e = &mesh->edges[face_edges[i]];
+      mesh->vertex_occurs[e->vertices[0]] ^= face_edges[i];
+      mesh->vertex_occurs[e->vertices[1]] ^= face_edges[i];
     }
 
-    if (target_winding != PTC_WINDING_ANY) {
-      // Calculate current winding order
-      PTC_REAL normal_accumulator[3] = {0};
+    int edge = face_edges[0];
+    vertices[0] = mesh->edges[edge].vertices[0];
+    vertices[1] = mesh->edges[edge].vertices[1];
 
-      for (int i = 0; i <= f->edge_count - 1; i++) {
-        PTC_REAL normal[3] = {0};
-        PTC_REAL* p0 = mesh->vertices[vertices[i + 0]].position;
-        PTC_REAL* p1 = mesh->vertices[vertices[i + 1]].position;
-        ptc__cross_product(normal, p0, p1);
+    // Twice the area of the polygon, along its normal (measured from 
+    // its first vertex, so far away polygons don't lose precision)
+    PTC_REAL origin[3];
+    PTC_REAL area[3] = {0, 0, 0};
+    PTC_REAL previous[3] = {0, 0, 0};
+    ptc__get_position(mesh, vertices[0], origin);
 
-        normal_accumulator[0] += normal[0];
-        normal_accumulator[1] += normal[1];
-        normal_accumulator[2] += normal[2];
-      }
+    for (int i = 1; i < f->edge_count; i++) {
+      edge ^= mesh->vertex_occurs[vertices[i]];
+      ptc_edge* e = &mesh->edges[edge];
+      vertices[i + 1] = e->vertices[0] == vertices[i] ? e->vertices[1] : e->vertices[0];
+
+      PTC_REAL current[3] = {
+        mesh->vertex_x[vertices[i]] - origin[0],
+        mesh->vertex_y[vertices[i]] - origin[1],
+        mesh->vertex_z[vertices[i]] - origin[2],
+      };
+      PTC_REAL normal[3];
+      ptc__cross_product(normal, previous, current);
+      area[0] += normal[0];
+      area[1] += normal[1];
+      area[2] += normal[2];
+      ptc__copy_memory(previous, current, sizeof previous);
+    }
 
-      // normalize the accumulator
-      PTC_REAL length_sqr = ptc__dot_product(normal_accumulator, normal_accumulator);
-      PTC_REAL length = PTC_SQRTR(length_sqr);
-      normal_accumulator[0] /= length;
-      normal_accumulator[1] /= length;
-      normal_accumulator[2] /= length;
-
-      PTC_REAL dot = ptc__dot_product(f->normal, normal_accumulator);
-      // todo: verify or swap this is correct
-      ptc_winding current_winding = dot > 0 ? PTC_WINDING_CCW : PTC_WINDING_CW;
-
-      if (target_winding != current_winding) {
-        // reverse vertices
-        for (int i = 0; i < (f->edge_count + 1) / 2; i++) {
-          int temp = vertices[i];
-          vertices[i] = vertices[f->edge_count - i];
-          vertices[f->edge_count - i] = temp;
-        }
+    PTC_ASSERT(vertices[f->edge_count] == vertices[0]);
+
+    // Counter-clockwise loops turn the right way around their normal
+    ptc_winding current_winding = ptc__dot_product(f->normal, area) > 0 ? PTC_WINDING_CCW : PTC_WINDING_CW;
+
+    if (target_winding != PTC_WINDING_ANY && target_winding != current_winding) {
+      for (int i = 0; i < (f->edge_count + 1) / 2; i++) {
+        int temp = vertices[i];
+        vertices[i] = vertices[f->edge_count - i];
+        vertices[f->edge_count - i] = temp;
       }
     }
   }
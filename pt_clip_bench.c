@@ -0,0 +1,487 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define PTC_STATS
+#define PT_CLIP_IMPLEMENTATION
+#include "pt_clip.h"
+
+// Clips generated convex brushes out of a world box with ptc_clip_planes,
+// the way pt_map meshes them, and times it. Every checked hull is also
+// compared against a brute-force reference (every triple of planes
+// intersected, keeping the points inside all of them), so a faster
+// clipper can't quietly get a different answer.
+
+#define WORLD_EXTENT 1024.0f
+
+// How far (in world units) a hull may be from the reference. The clipper
+// skips planes that cut less than PTC_EPSILON, and works in floats.
+#define TOLERANCE 0.05
+
+typedef struct bench_case {
+  const char* name;
+  int brush_count;
+  int plane_count;
+  ptc_plane* planes; // brush_count * plane_count of them
+} bench_case;
+
+typedef struct bench_result {
+  double clips_per_second;
+  double planes_per_second;
+  double allocs_per_clip;
+  double fresh_allocs_per_clip;
+  double planes_clipped;
+  double planes_skipped;
+  int checked;
+  int failed;
+} bench_result;
+
+typedef struct reference_hull {
+  double* vertices;
+  int vertex_count;
+  int vertex_capacity;
+} reference_hull;
+
+static double now_seconds(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+#endif
+}
+
+// === ALLOCATION COUNTING ===
+
+static int allocation_count = 0;
+
+static void* counting_reallocate(void* userdata, void* block, int old_bytes, int new_bytes) {
+  (void)userdata;
+  (void)old_bytes;
+  allocation_count++;
+  return realloc(block, new_bytes);
+}
+
+static void counting_release(void* userdata, void* block) {
+  (void)userdata;
+  free(block);
+}
+
+static ptc_mesh create_mesh(void) {
+  ptc_mesh mesh;
+  memset(&mesh, 0, sizeof mesh);
+  mesh.allocator.reallocate = counting_reallocate;
+  mesh.allocator.release = counting_release;
+  return mesh;
+}
+
+// === BRUSH GENERATION ===
+
+// xorshift, so every run (and every platform) clips the same brushes
+static unsigned int random_state = 1;
+
+static double random_unit(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return (double)(random_state >> 8) / (double)(1 << 24);
+}
+
+static double random_range(double min, double max) {
+  return min + (max - min) * random_unit();
+}
+
+static void random_direction(double* direction) {
+  double length = 0.0;
+
+  // Rejection sampling keeps the directions uniform on the sphere
+  do {
+    direction[0] = random_range(-1.0, 1.0);
+    direction[1] = random_range(-1.0, 1.0);
+    direction[2] = random_range(-1.0, 1.0);
+    length = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+  } while (length > 1.0 || length < 1e-6);
+
+  length = sqrt(length);
+  direction[0] /= length;
+  direction[1] /= length;
+  direction[2] /= length;
+}
+
+static void set_plane(ptc_plane* plane, const double* normal, const double* center, double distance) {
+  double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+  for (int i = 0; i < 3; i++) {
+    plane->normal[i] = (PTC_REAL)(normal[i] / length);
+  }
+
+  plane->c = (PTC_REAL)(distance + (plane->normal[0] * center[0] + plane->normal[1] * center[1] + plane->normal[2] * center[2]));
+}
+
+// Planes tangent to a sphere, in random directions: an ordinary brush
+static void create_random_brush(ptc_plane* planes, int plane_count) {
+  double center[3] = { random_range(-256, 256), random_range(-256, 256), random_range(-256, 256) };
+  double radius = random_range(16, 128);
+
+  for (int i = 0; i < plane_count; i++) {
+    double normal[3];
+    random_direction(normal);
+    set_plane(&planes[i], normal, center, radius);
+  }
+}
+
+// Evenly spread around a sphere (a fibonacci lattice): every plane
+// ends up a face, so the hull has as many faces as the brush has planes
+static void create_round_brush(ptc_plane* planes, int plane_count) {
+  double center[3] = { random_range(-256, 256), random_range(-256, 256), random_range(-256, 256) };
+  double radius = random_range(64, 256);
+  double twist = random_range(0.0, 6.283185307179586);
+
+  for (int i = 0; i < plane_count; i++) {
+    double z = 1.0 - (2.0 * i + 1.0) / plane_count;
+    double r = sqrt(1.0 - z * z);
+    double angle = twist + i * 2.399963229728653;
+    double normal[3] = { r * cos(angle), r * sin(angle), z };
+    set_plane(&planes[i], normal, center, radius);
+  }
+}
+
+// A box where every side is a stack of planes that are almost the same:
+// normals a fraction of a degree apart, and offsets around PTC_EPSILON.
+// This is where clipping is least stable.
+static void create_coplanar_brush(ptc_plane* planes, int plane_count) {
+  double center[3] = { random_range(-256, 256), random_range(-256, 256), random_range(-256, 256) };
+  double size[3] = { random_range(8, 128), random_range(8, 128), random_range(8, 128) };
+
+  for (int i = 0; i < plane_count; i++) {
+    int axis = (i / 2) % 3;
+    double sign = i % 2 == 0 ? 1.0 : -1.0;
+    double normal[3] = { random_range(-2e-3, 2e-3), random_range(-2e-3, 2e-3), random_range(-2e-3, 2e-3) };
+    normal[axis] = sign;
+
+    // The first plane of every side is exactly axis-aligned
+    if (i < 6) {
+      normal[(axis + 1) % 3] = 0.0;
+      normal[(axis + 2) % 3] = 0.0;
+    }
+
+    set_plane(&planes[i], normal, center, size[axis] + random_range(-0.02, 0.02));
+  }
+}
+
+static bench_case create_case(const char* name, int brush_count, int plane_count, void (*create_brush)(ptc_plane*, int)) {
+  bench_case result;
+  result.name = name;
+  result.brush_count = brush_count;
+  result.plane_count = plane_count;
+  result.planes = malloc(brush_count * plane_count * sizeof *result.planes);
+
+  for (int i = 0; i < brush_count; i++) {
+    create_brush(&result.planes[i * plane_count], plane_count);
+  }
+
+  return result;
+}
+
+// === REFERENCE ===
+
+static double plane_distance(const ptc_plane* plane, const double* position) {
+  return plane->normal[0] * position[0] + plane->normal[1] * position[1] + plane->normal[2] * position[2] - plane->c;
+}
+
+static int intersect_planes(const ptc_plane* a, const ptc_plane* b, const ptc_plane* c, double* position) {
+  double n[3][3];
+
+  for (int i = 0; i < 3; i++) {
+    n[0][i] = a->normal[i];
+    n[1][i] = b->normal[i];
+    n[2][i] = c->normal[i];
+  }
+
+  // Cramer's rule, with the columns of the inverse as cross products
+  double bc[3] = { n[1][1] * n[2][2] - n[1][2] * n[2][1], n[1][2] * n[2][0] - n[1][0] * n[2][2], n[1][0] * n[2][1] - n[1][1] * n[2][0] };
+  double ca[3] = { n[2][1] * n[0][2] - n[2][2] * n[0][1], n[2][2] * n[0][0] - n[2][0] * n[0][2], n[2][0] * n[0][1] - n[2][1] * n[0][0] };
+  double ab[3] = { n[0][1] * n[1][2] - n[0][2] * n[1][1], n[0][2] * n[1][0] - n[0][0] * n[1][2], n[0][0] * n[1][1] - n[0][1] * n[1][0] };
+  double determinant = n[0][0] * bc[0] + n[0][1] * bc[1] + n[0][2] * bc[2];
+
+  if (fabs(determinant) < 1e-12) {
+    return 0;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    position[i] = (a->c * bc[i] + b->c * ca[i] + c->c * ab[i]) / determinant;
+  }
+
+  return 1;
+}
+
+static void build_reference(reference_hull* reference, const ptc_plane* planes, int plane_count) {
+  reference->vertex_count = 0;
+
+  for (int i = 0; i < plane_count; i++) {
+    for (int j = i + 1; j < plane_count; j++) {
+      for (int k = j + 1; k < plane_count; k++) {
+        double position[3];
+
+        if (!intersect_planes(&planes[i], &planes[j], &planes[k], position)) {
+          continue;
+        }
+
+        int is_inside = 1;
+
+        for (int l = 0; l < plane_count && is_inside; l++) {
+          is_inside = plane_distance(&planes[l], position) <= 1e-6 * (1.0 + fabs(planes[l].c));
+        }
+
+        if (!is_inside) {
+          continue;
+        }
+
+        if (reference->vertex_count == reference->vertex_capacity) {
+          reference->vertex_capacity = reference->vertex_capacity == 0 ? 64 : reference->vertex_capacity * 2;
+          reference->vertices = realloc(reference->vertices, reference->vertex_capacity * 3 * sizeof(double));
+        }
+
+        memcpy(&reference->vertices[reference->vertex_count * 3], position, sizeof position);
+        reference->vertex_count++;
+      }
+    }
+  }
+}
+
+// The hull has to be closed (every edge between two faces, and
+// V - E + F = 2), every face on one of the planes, every vertex inside
+// all of them, and every reference vertex inside every face.
+static int check_hull(ptc_mesh* mesh, const ptc_plane* planes, int plane_count, reference_hull* reference, const char** reason) {
+  ptc_compact(mesh);
+
+  if (mesh->face_count < 4) {
+    *reason = "too few faces";
+    return 0;
+  }
+
+  // A vertex can be left over without any edges, when the edges it was
+  // in are clipped off right at it: only count the ones in use
+  int vertex_count = 0;
+  char* is_used = calloc(mesh->vertex_count, 1);
+
+  for (int i = 0; i < mesh->edge_count; i++) {
+    for (int j = 0; j < 2; j++) {
+      vertex_count += !is_used[mesh->edges[i].vertices[j]];
+      is_used[mesh->edges[i].vertices[j]] = 1;
+    }
+  }
+
+  free(is_used);
+
+  if (vertex_count - mesh->edge_count + mesh->face_count != 2) {
+    *reason = "not a closed polyhedron";
+    return 0;
+  }
+
+  for (int i = 0; i < mesh->edge_count; i++) {
+    if (mesh->edges[i].faces[0] == -1 || mesh->edges[i].faces[1] == -1) {
+      *reason = "edge without two faces";
+      return 0;
+    }
+  }
+
+  for (int i = 0; i < mesh->vertex_count; i++) {
+    double position[3] = { mesh->vertex_x[i], mesh->vertex_y[i], mesh->vertex_z[i] };
+
+    for (int j = 0; j < plane_count; j++) {
+      if (plane_distance(&planes[j], position) > TOLERANCE) {
+        *reason = "vertex outside a plane";
+        return 0;
+      }
+    }
+  }
+
+  for (int i = 0; i < mesh->face_count; i++) {
+    ptc_face* face = &mesh->faces[i];
+    const ptc_plane* plane = (const ptc_plane*)face->userdata;
+    ptc_edge* edge = &mesh->edges[mesh->face_edges[face->edge_start]];
+    int vertex = edge->vertices[0];
+    double position[3] = { mesh->vertex_x[vertex], mesh->vertex_y[vertex], mesh->vertex_z[vertex] };
+
+    if (plane == NULL || plane < planes || plane >= planes + plane_count) {
+      *reason = "face without a plane";
+      return 0;
+    }
+    if (fabs(plane_distance(plane, position)) > TOLERANCE) {
+      *reason = "face off its plane";
+      return 0;
+    }
+
+    for (int j = 0; j < reference->vertex_count; j++) {
+      if (plane_distance(plane, &reference->vertices[j * 3]) > TOLERANCE) {
+        *reason = "reference vertex outside the hull";
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+// === BENCHMARK ===
+
+static int clip_brush(ptc_mesh* mesh, ptc_plane* planes, int plane_count, void** userdata) {
+  PTC_REAL min[3] = { -WORLD_EXTENT, -WORLD_EXTENT, -WORLD_EXTENT };
+  PTC_REAL max[3] = { WORLD_EXTENT, WORLD_EXTENT, WORLD_EXTENT };
+  ptc_init_bounds(mesh, min, max);
+  return ptc_clip_planes(mesh, planes, plane_count, userdata);
+}
+
+static bench_result run_bench(bench_case* bench, int iterations, int check_count) {
+  bench_result result;
+  memset(&result, 0, sizeof result);
+  void** userdata = malloc(bench->plane_count * sizeof *userdata);
+  int clip_count = iterations * bench->brush_count;
+
+  // One mesh for every clip, like pt_map: it should stop allocating
+  // once it has grown to fit the biggest brush
+  ptc_mesh mesh = create_mesh();
+  allocation_count = 0;
+  double start = now_seconds();
+
+  for (int i = 0; i < iterations; i++) {
+    for (int j = 0; j < bench->brush_count; j++) {
+      clip_brush(&mesh, &bench->planes[j * bench->plane_count], bench->plane_count, NULL);
+    }
+  }
+
+  double seconds = now_seconds() - start;
+  result.clips_per_second = clip_count / seconds;
+  result.planes_per_second = (double)clip_count * bench->plane_count / seconds;
+  result.allocs_per_clip = (double)allocation_count / clip_count;
+  result.planes_clipped = (double)mesh.stats.planes_clipped / clip_count;
+  result.planes_skipped = (double)mesh.stats.planes_skipped / clip_count;
+  ptc_free(&mesh);
+
+  // And a new mesh for every clip, for what a brush costs from scratch
+  allocation_count = 0;
+
+  for (int i = 0; i < bench->brush_count; i++) {
+    ptc_mesh fresh = create_mesh();
+    clip_brush(&fresh, &bench->planes[i * bench->plane_count], bench->plane_count, NULL);
+    ptc_free(&fresh);
+  }
+
+  result.fresh_allocs_per_clip = (double)allocation_count / bench->brush_count;
+
+  // The reference also needs the sides of the world box
+  reference_hull reference;
+  memset(&reference, 0, sizeof reference);
+  int bounded_count = bench->plane_count + 6;
+  ptc_plane* bounded = malloc(bounded_count * sizeof *bounded);
+
+  for (int i = 0; i < 6; i++) {
+    memset(&bounded[bench->plane_count + i], 0, sizeof *bounded);
+    bounded[bench->plane_count + i].normal[i / 2] = i % 2 == 0 ? 1.0f : -1.0f;
+    bounded[bench->plane_count + i].c = WORLD_EXTENT;
+  }
+
+  mesh = create_mesh();
+  int stride = bench->brush_count > check_count && check_count > 0 ? bench->brush_count / check_count : 1;
+
+  for (int i = 0; i < bench->brush_count && result.checked < check_count; i += stride) {
+    ptc_plane* planes = &bench->planes[i * bench->plane_count];
+    const char* reason = NULL;
+    memcpy(bounded, planes, bench->plane_count * sizeof *planes);
+
+    for (int j = 0; j < bench->plane_count; j++) {
+      userdata[j] = &bounded[j];
+    }
+
+    build_reference(&reference, bounded, bounded_count);
+    result.checked++;
+
+    if (!clip_brush(&mesh, bounded, bench->plane_count, userdata)) {
+      reason = "nothing left";
+    }
+    else {
+      // Whatever is left of the world box belongs to its planes
+      for (int j = 0; j < mesh.face_count; j++) {
+        if (mesh.faces[j].userdata == NULL && !mesh.faces[j].is_clipped) {
+          for (int k = 0; k < 6; k++) {
+            if (mesh.faces[j].normal[k / 2] == bounded[bench->plane_count + k].normal[k / 2]) {
+              mesh.faces[j].userdata = &bounded[bench->plane_count + k];
+            }
+          }
+        }
+      }
+
+      check_hull(&mesh, bounded, bounded_count, &reference, &reason);
+    }
+
+    if (reason != NULL) {
+      result.failed++;
+      printf("  %s: brush %i: %s\n", bench->name, i, reason);
+    }
+  }
+
+  ptc_free(&mesh);
+  free(reference.vertices);
+  free(bounded);
+  free(userdata);
+  return result;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+    printf("USAGE: %s [iterations] [seed] [checked brushes per case]\n", argv[0]);
+    return 1;
+  }
+
+  int iterations = argc >= 2 ? atoi(argv[1]) : 20;
+  unsigned int seed = argc >= 3 ? (unsigned int)strtoul(argv[2], NULL, 10) : 1;
+  int check_count = argc >= 4 ? atoi(argv[3]) : 64;
+
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  // xorshift never leaves 0
+  random_state = seed != 0 ? seed : 1;
+
+  bench_case cases[] = {
+    create_case("random (6 planes)", 4096, 6, create_random_brush),
+    create_case("random (16 planes)", 2048, 16, create_random_brush),
+    create_case("round (64 planes)", 256, 64, create_round_brush),
+    create_case("round (128 planes)", 64, 128, create_round_brush),
+    create_case("near-coplanar (66 planes)", 256, 66, create_coplanar_brush),
+  };
+
+  int failed = 0;
+  printf("%i iterations, seed %u\n\n", iterations, seed);
+  printf("%-26s %8s %12s %12s %8s %8s %8s %8s %10s\n", "case", "brushes", "clips/s", "planes/s",
+    "allocs", "fresh", "clipped", "skipped", "checked");
+
+  for (int i = 0; i < (int)(sizeof cases / sizeof *cases); i++) {
+    bench_result result = run_bench(&cases[i], iterations, check_count);
+    printf("%-26s %8i %12.0f %12.0f %8.3f %8.1f %8.1f %8.1f %5i/%-4i\n", cases[i].name, cases[i].brush_count,
+      result.clips_per_second, result.planes_per_second, result.allocs_per_clip, result.fresh_allocs_per_clip,
+      result.planes_clipped, result.planes_skipped, result.checked - result.failed, result.checked);
+    failed += result.failed;
+    free(cases[i].planes);
+  }
+
+  if (failed > 0) {
+    printf("\n%i hulls did not match the reference\n", failed);
+    return 1;
+  }
+
+  return 0;
+}
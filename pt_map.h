@@ -1,18 +1,33 @@
 #ifndef PT_MAP_H
 #define PT_MAP_H
 
+#ifndef PTM_REAL
 #define PTM_REAL float
+#endif
+
+#ifndef PTM_INDEX
 #define PTM_INDEX unsigned short
+#endif
+
 #define PTM_HASH unsigned int
 
 typedef struct ptm_string {
   char* data;
   PTM_HASH hash;
+  int length;
 } ptm_string;
 
+// Every string in a map is interned: two strings are equal
+// exactly when their data pointers are.
+typedef struct ptm_string_pool {
+  ptm_string* slots; // open-addressed by hash, unused slots have NULL data
+  int slot_count;    // always a power of two
+  int string_count;
+} ptm_string_pool;
+
 typedef struct ptm_brush_face {
   struct ptm_brush_face* next;
-  PTM_REAL plane_normal[3];
+  PTM_REAL plane_normal[3]; // unit length, or zero if the points were in a line
   PTM_REAL plane_c;
   ptm_string texture_name;
   PTM_REAL texture_uv[2][3];
@@ -30,58 +45,357 @@ typedef struct ptm_property {
   struct ptm_property* next;
   ptm_string key;
   ptm_string value;
+  PTM_REAL numbers[3]; // the value's leading numbers, decoded the first 
+  int number_count;    // time ptm_property_float or ptm_property_vec3 
+  int is_decoded;      // is called on it
 } ptm_property;
 
+// Flags for interleaved vertex formats. Every vertex is a position (3
+// floats), texture coordinates, normal and tangent, in that order.
+// Without flags those are 2, 3 and 4 floats (48 bytes in all).
+#define PTM_VERTEX_HALF_TEXCOORDS 1 // 2 half floats instead. They're still in 
+                                    // texels: only exact to a texel up to 2048
+#define PTM_VERTEX_OCT_NORMALS 2    // normal as 2 snorm16s, tangent as 2 snorm8s 
+                                    // (both octahedral), then its sign and 0 as snorm8s
+
+typedef struct ptm_vertex_layout {
+  int stride;
+  int position_offset;
+  int texcoord_offset;
+  int normal_offset;
+  int tangent_offset;
+} ptm_vertex_layout;
+
 typedef struct ptm_mesh {
   struct ptm_mesh* next;
   PTM_REAL* vertex_positions;
   PTM_REAL* vertex_texcoords;
   PTM_REAL* vertex_normals;
   PTM_REAL* vertex_tangents;
+  void* vertices; // interleaved, NULL unless ptm_load_options.interleave_vertices is set
+  int vertex_format;
+  int vertex_stride;
   int vertex_count;
   PTM_INDEX* indices;
   int index_count;
   struct ptm_string texture_name;
+  struct ptm_cluster* cluster; // NULL unless the entity has clusters
+  PTM_REAL bounds_min[3];
+  PTM_REAL bounds_max[3];
 } ptm_mesh;
 
+// A cell of the grid that ptm_load_options.cluster_size splits the
+// world into, with the meshes of the brushes centered in it. They're
+// listed one after another in the entity's meshes, starting at meshes.
+typedef struct ptm_cluster {
+  int cell[3];
+  PTM_REAL bounds_min[3];
+  PTM_REAL bounds_max[3];
+  struct ptm_mesh* meshes;
+  int mesh_count;
+} ptm_cluster;
+
 typedef struct ptm_entity {
   struct ptm_entity* next;
   struct ptm_string class_name;
   struct ptm_property* properties;
+  struct ptm_property** property_slots; // open-addressed by key hash, for ptm_find_property
   struct ptm_brush* brushes;
   struct ptm_mesh* meshes;
+  struct ptm_cluster* clusters;
   int property_count;
+  int property_slot_count;
   int brush_count;
   int mesh_count;
+  int cluster_count;
+  int is_meshed; // 1 once meshes is built: always, unless ptm_load_options.defer_meshes is set
 } ptm_entity;
 
 typedef struct ptm_entity_class {
   struct ptm_entity_class* next;
   struct ptm_string name;
   struct ptm_entity* entities;
+  struct ptm_entity** entity_array; // the same entities, to index
   int entity_count;
 } ptm_entity_class;
 
+typedef struct ptm_arena_stats {
+  int bytes_used;      // handed out to the map, including alignment
+  int bytes_reserved;  // allocated from the system
+  int bytes_wasted;    // reserved, but never handed out
+  int block_count;
+  int high_water_mark; // most bytes reserved at once while loading, 
+                       // including temporary arenas
+} ptm_arena_stats;
+
+// What a load did, only counted when PTM_LOAD_STATS is defined (and
+// left zeroed otherwise). Arena use is in ptm_map.arena_stats.
+typedef struct ptm_load_stats {
+  long long bytes_scanned;  // parsed, counting the lines that parallel 
+                            // parts parse again to open their entity
+  long long numbers_parsed;
+  int string_lookups;       // of keys, values and texture names in a string pool
+  int string_hits;          // found already there
+  int brushes_clipped;      // not counting polygons reused by a reload
+  int planes_clipped;       // these are pt_clip's ptc_stats, summed over
+  int planes_skipped;       // every hull (PTM_LOAD_STATS defines PTC_STATS)
+  int vertices_created;
+  int edges_created;
+  int faces_created;
+} ptm_load_stats;
+
+typedef struct ptm_range {
+  int first;
+  int count;
+} ptm_range;
+
+// A copy of every face in contiguous arrays, for consumers that only 
+// need some of the data (planes for collision, say) or want to upload
+// it directly. Entity 0 is the world, then every class's entities in 
+// list order: each range indexes into the next array down.
+typedef struct ptm_flat_map {
+  PTM_REAL* plane_normals;       // 3 per face
+  PTM_REAL* plane_cs;            // 1 per face
+  ptm_string* texture_names;     // 1 per face
+  PTM_REAL* texture_uvs;         // 6 per face: the u axis, then v
+  PTM_REAL* texture_offsets;     // 2 per face
+  PTM_REAL* texture_scales;      // 2 per face
+  int face_count;
+
+  ptm_range* brush_faces;        // 1 per brush
+  int brush_count;
+
+  struct ptm_entity** entities;  // 1 per entity, for its properties
+  ptm_range* entity_brushes;     // 1 per entity
+  int entity_count;
+
+  ptm_range* class_entities;     // 1 per class, in entity_classes order
+  int class_count;
+} ptm_flat_map;
+
+// A node of ptm_collision's bounding volume hierarchy. Nodes are in 
+// depth-first order: an inner node's first child comes right after it.
+typedef struct ptm_collision_node {
+  PTM_REAL bounds_min[3];
+  PTM_REAL bounds_max[3];
+  int first; // a leaf's first brush, or an inner node's second child
+  int count; // how many brushes a leaf has, or 0 for an inner node
+} ptm_collision_node;
+
+// The world's solid brushes, ready for collision queries, in the same
+// space as the meshes. A point is inside a brush when it's behind 
+// (dot(normal, point) <= c) every one of its planes. Brushes are in 
+// the order of the hierarchy's leaves, so each leaf is a range of them.
+typedef struct ptm_collision {
+  PTM_REAL* planes;             // 4 per plane: the normal, then c
+  PTM_REAL* vertices;           // 3 per vertex: the corners of the clipped brushes
+  int plane_count;
+  int vertex_count;
+
+  ptm_range* brush_planes;      // 1 per brush
+  ptm_range* brush_vertices;    // 1 per brush
+  PTM_REAL* brush_bounds;       // 6 per brush: the min, then the max
+  int* brush_indices;           // 1 per brush: its index in the world's brushes
+  int brush_count;
+
+  ptm_collision_node* nodes;    // the root first, or none without brushes
+  int node_count;
+} ptm_collision;
+
+// Where a ray first hit a brush, from ptm_trace_ray
+typedef struct ptm_trace {
+  PTM_REAL fraction;  // how far from start to end (1 if nothing was hit)
+  PTM_REAL normal[3]; // of the plane that was hit
+  int brush;          // the collision brush it hit, or -1
+  int is_start_solid; // started inside the brush (fraction is 0, normal 0)
+} ptm_trace;
+
 typedef struct ptm_map {
   struct ptm_entity_class* entity_classes;
   int entity_class_count;
   struct ptm_entity world;
+  struct ptm_string_pool strings;
+  struct ptm_flat_map* flat; // NULL unless ptm_load_options.flatten is set
+  struct ptm_collision* collision; // NULL unless ptm_load_options.collision is set
+  struct ptm_reload_cache* reload_cache; // NULL unless ptm_load_options.reloadable is set
+  struct ptm_deferred_meshes* deferred_meshes; // NULL unless ptm_load_options.defer_meshes is set
   void* arena;
+  struct ptm_arena_stats arena_stats;
+  struct ptm_load_stats load_stats; // meshes built later add to it
 } ptm_map;
 
+typedef void ptm_job_function(void* job);
+
+typedef struct ptm_load_options {
+  // Number of threads used to parse (big sources) and generate 
+  // meshes: 0 or 1 does all the work on the calling thread.
+  int thread_count;
+
+  // Optionally run parsing and meshing jobs with your own scheduler
+  // instead of the built-in threads. It must call function(jobs[i]) 
+  // for every job, and only return once all of them have finished.
+  void (*run_jobs)(ptm_job_function* function, void** jobs, int job_count, void* userdata);
+  void* run_jobs_userdata;
+
+  // Also create ptm_map.flat, a flattened view of the brushes
+  int flatten;
+
+  // Also create ptm_map.collision, for collision queries against the 
+  // world's brushes. It comes from clipping them, so with defer_meshes
+  // the world is still meshed while loading.
+  int collision;
+
+  // Leave out world faces that are entirely covered by the opposite 
+  // faces of the brushes they touch (so can never be seen), and faces
+  // with the skip, clip or __TB_empty tool textures
+  int cull_hidden_faces;
+
+  // Split the world's meshes into clusters by the cells of a grid 
+  // this big, so they can be culled a cell at a time (0 doesn't). 
+  // Each brush goes in the cell its center is in.
+  PTM_REAL cluster_size;
+
+  // Keep every brush's clipped polygons (and a hash of its source) in 
+  // the map, so reloading it with ptm_reload_source only has to parse
+  // and clip the brushes that changed
+  int reloadable;
+
+  // Don't mesh anything while loading: each entity is only meshed the 
+  // first time ptm_entity_get_meshes asks for it. A reloadable map 
+  // still reuses unchanged brushes, but not their polygons.
+  int defer_meshes;
+
+  // Also write every mesh's vertices interleaved into ptm_mesh.vertices,
+  // ready to upload: vertex_format is PTM_VERTEX_ flags, and 
+  // vertex_stride can pad each vertex (0 packs them)
+  int interleave_vertices;
+  int vertex_format;
+  int vertex_stride;
+
+  // Optionally called as each entity's closing brace is parsed, before
+  // anything is meshed (so its meshes are still NULL, but its 
+  // properties can already be found). World entities
+  // are reported too: their brush list runs on into the next world 
+  // entity's, so only the first brush_count brushes are theirs.
+  void (*on_entity)(const ptm_entity* entity, void* userdata);
+  void* on_entity_userdata;
+} ptm_load_options;
+
 #ifndef PTM_NO_STDIO
 ptm_map* ptm_load(const char* file_path);
+ptm_map* ptm_load_ex(const char* file_path, const ptm_load_options* options);
 #endif 
 
+#ifndef PTM_NO_MMAP
+ptm_map* ptm_load_mapped(const char* file_path);
+ptm_map* ptm_load_mapped_ex(const char* file_path, const ptm_load_options* options);
+#endif
+
 ptm_map* ptm_load_source(const char* source, int source_length);
+ptm_map* ptm_load_source_ex(const char* source, int source_length, const ptm_load_options* options);
 void ptm_free(ptm_map* map);
 
+// An entity's meshes, built on the first call for it if the map was 
+// loaded with ptm_load_options.defer_meshes (and just entity->meshes
+// otherwise). Any number of threads can call this at once: different
+// entities are built in parallel, and a thread that asks for one that
+// is being built waits for it. Meshes are built with the load options
+// (threads included), and stay until the map is freed.
+ptm_mesh* ptm_entity_get_meshes(ptm_map* map, ptm_entity* entity);
+
+// Load a new version of old_map's source (for hot-reloading while it's
+// edited). Brushes with the same source as one in old_map are copied
+// instead of parsed, and brushes with the same planes reuse its 
+// polygons instead of being clipped again. That needs old_map to be 
+// loaded with ptm_load_options.reloadable (otherwise this is a plain
+// load), and options should set it too to keep reloading. old_map 
+// can be freed as soon as this returns.
+ptm_map* ptm_reload_source(const ptm_map* old_map, const char* source, int source_length, const ptm_load_options* options);
+
+// Parse a map as it arrives (from the network, say), a chunk at a 
+// time: chunks can be cut anywhere, even in the middle of a line. 
+// Only the last partial line is kept between them, so the source 
+// never has to be in memory all at once. Finishing meshes the map 
+// like ptm_load_source_ex and frees the parser, as does freeing it 
+// to give up on a map. old_map can be NULL, otherwise it's reloaded
+// like with ptm_reload_source, except brushes that straddle a chunk 
+// are always parsed (but still reuse old_map's polygons).
+typedef struct ptm_parser ptm_parser;
+
+ptm_parser* ptm_parser_create(const ptm_map* old_map, const ptm_load_options* options);
+void ptm_parser_feed(ptm_parser* parser, const char* chunk, int chunk_length);
+ptm_map* ptm_parser_finish(ptm_parser* parser);
+void ptm_parser_free(ptm_parser* parser);
+
+// Find the map's interned copy of a string, for comparing by pointer.
+// The result has NULL data if the map never uses the string.
+ptm_string ptm_find_string(const ptm_map* map, const char* data, int length);
+
+// Find an entity's property by key, without walking the list: key has
+// to be the map's copy (from ptm_find_string), since they're compared
+// by pointer. Returns NULL if the entity doesn't have it. If it's set 
+// twice the last one wins, like the list order.
+ptm_property* ptm_find_property(const ptm_entity* entity, ptm_string key);
+
+// Decode a property value's leading numbers ("angle" "90", "origin" 
+// "-64 128 24"), caching them in the property so it's only parsed
+// once. Returns 0 (and leaves value alone) if the property is NULL or
+// doesn't start with enough numbers. Vectors are in the order they're
+// written, so positions are still z-up: swap y and z to match meshes.
+int ptm_property_float(ptm_property* property, PTM_REAL* value);
+int ptm_property_vec3(ptm_property* property, PTM_REAL* value);
+
+// Where each attribute goes in a vertex of the format (PTM_VERTEX_ 
+// flags), with at least vertex_stride bytes per vertex. Everything is
+// 4-byte aligned.
+ptm_vertex_layout ptm_get_vertex_layout(int vertex_format, int vertex_stride);
+
+// Write a mesh's vertices interleaved in a format into vertices (of 
+// vertex_count times the layout's stride), front to back and without 
+// reading any of it back: it can be mapped GPU memory.
+void ptm_write_vertices(const ptm_mesh* mesh, int vertex_format, int vertex_stride, void* vertices);
+
+// Collision queries against ptm_map.collision. A ray stops at the first
+// brush it hits between start and end: returns 1 if it hit one. The 
+// brush a point is in is -1 if it's in none. Finding the brushes a box
+// overlaps returns how many there are, but only writes up to capacity
+// of them: boxes are tested against each brush's bounds and planes, so
+// they can count as overlapping a brush they only come close to, past
+// the edge between two of its sloped faces.
+int ptm_trace_ray(const ptm_collision* collision, const PTM_REAL* start, const PTM_REAL* end, ptm_trace* trace);
+int ptm_find_brush_at_point(const ptm_collision* collision, const PTM_REAL* point);
+int ptm_find_brushes_in_box(const ptm_collision* collision, const PTM_REAL* min, const PTM_REAL* max, int* brushes, int capacity);
+
+// Binary caches skip parsing and meshing entirely. A map (with its
+// meshes, clusters, flat view and collision) is written as one 
+// relocatable blob, tagged with the hash of the source it was loaded
+// from: loading it back fails (returns NULL) unless the hash, the 
+// version and the layout of this build all match, so a NULL means 
+// rebuild the cache. Writing a map loaded with defer_meshes builds 
+// the meshes of every entity it doesn't have yet, first.
+// ptm_free works the same on the maps they return.
+unsigned long long ptm_hash_source(const char* source, int source_length);
+
+// Returns the size of the blob, only writing it if buffer_size fits it
+int ptm_write_binary(ptm_map* map, unsigned long long source_hash, void* buffer, int buffer_size);
+ptm_map* ptm_load_binary_source(const void* binary, int binary_size, unsigned long long source_hash);
+
+#ifndef PTM_NO_STDIO
+int ptm_save_binary(ptm_map* map, unsigned long long source_hash, const char* file_path);
+#endif
+
+#ifndef PTM_NO_MMAP
+// The file is mapped copy-on-write and its pointers fixed up in place
+ptm_map* ptm_load_binary(const char* file_path, unsigned long long source_hash);
+#endif
+
 #endif // PT_MAP_H
 
 #ifdef PT_MAP_IMPLEMENTATION
 
 #include <stdint.h> // for ptrdiff_t with string parsing
 #include <stddef.h> // for intptr_t, with string parsing
+#include <stdlib.h> // for malloc/strtod, used by the defaults
 
 #ifndef PTM_ASSERT
 #include <assert.h>
@@ -93,88 +407,681 @@ void ptm_free(ptm_map* map);
 #define PTM_ACREATE(capacity) ptm__arena_create(capacity)
 #define PTM_APUSH(arena, bytes) ptm__arena_push(arena, bytes)
 #define PTM_AFREE(arena) ptm__arena_free(arena)
+#define PTM_ASTATS(arena, stats) ptm__arena_stats(arena, stats)
+#endif
+
+#ifndef PTM_ASTATS
+#define PTM_ASTATS(arena, stats) ptm__zero_memory(stats, sizeof *(stats))
+#endif
+
+#ifndef PTM_ARENA_ALIGNMENT
+#define PTM_ARENA_ALIGNMENT 16
 #endif
 
 #ifndef PTM_STRTOR
-#include <stdlib.h>
-#define PTM_STRTOR(start, end) ptm__strtor(start, end)
+#define PTM_STRTOR(start, end) ptm__strtor_fast(start, end)
 #endif
 
 #ifndef PTM_CREATE_HASH
 #define PTM_CREATE_HASH(data, size) ptm__create_hash_fnv32(data, size)
 #endif 
 
+#ifndef PTM_PROFILE_BEGIN
+#define PTM_PROFILE_BEGIN(zone)
+#define PTM_PROFILE_END(zone)
+#endif
+
+// Without PTM_LOAD_STATS, counting is never evaluated (sizeof doesn't
+// evaluate its operand), but what it counts still counts as used
+#ifdef PTM_LOAD_STATS
+#define PTM__COUNT(counter, amount) ((counter) += (amount))
+#else
+#define PTM__COUNT(counter, amount) ((void)sizeof((counter) += (amount)))
+#endif
+
+#ifndef PTM_WORLD_EXTENT
+#define PTM_WORLD_EXTENT 32768
+#endif
+
+#ifndef PTM_WELD_EPSILON
+#define PTM_WELD_EPSILON 0.01f
+#endif
+
+#ifndef PTM_SQRTR
+#include <math.h>
+#define PTM_SQRTR(value) sqrtf(value)
+#endif
+
+#ifndef PTM_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PTM__SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define PTM__NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#if defined(PTM__SSE2) || defined(PTM__NEON)
+#if defined(_MSC_VER)
+#include <intrin.h>
+static int ptm__ctz32(unsigned int value) { unsigned long index; _BitScanForward(&index, value); return (int)index; }
+static int ptm__ctz64(unsigned long long value) { unsigned long index; _BitScanForward64(&index, value); return (int)index; }
+#define PTM__CTZ32(value) ptm__ctz32(value)
+#define PTM__CTZ64(value) ptm__ctz64(value)
+#else
+#define PTM__CTZ32(value) __builtin_ctz(value)
+#define PTM__CTZ64(value) __builtin_ctzll(value)
+#endif
+#endif
+
+#ifndef PTM_NO_THREADS
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+#ifndef PTM_NO_MMAP
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
+// Brush meshing is built on top of pt_clip: we compile its implementation
+// here, unless the user wants to provide it from another file. Its 
+// profiling zones and counters go along with ours.
+#ifndef PTM_NO_CLIP_IMPLEMENTATION
+#define PT_CLIP_IMPLEMENTATION
+#endif
+
+#ifndef PTC_PROFILE_BEGIN
+#define PTC_PROFILE_BEGIN(zone) PTM_PROFILE_BEGIN(zone)
+#define PTC_PROFILE_END(zone) PTM_PROFILE_END(zone)
+#endif
+
+#if defined(PTM_LOAD_STATS) && !defined(PTC_STATS)
+#define PTC_STATS
+#endif
+#include "pt_clip.h"
+
 typedef enum ptm_scope {
   PTM_SCOPE_MAP,
   PTM_SCOPE_ENTITY,
   PTM_SCOPE_BRUSH,
 } ptm_scope;
 
-typedef struct ptm_arena {
-  char* data;
+typedef struct ptm_arena_block {
+  struct ptm_arena_block* next;
   int head;
   int capacity;
+} ptm_arena_block;
+
+typedef struct ptm_arena {
+  ptm_arena_block* blocks;
+  int bytes_used;
+  int bytes_reserved;
+  int block_count;
 } ptm_arena;
 
-typedef struct ptm_cached_string {
-  struct ptm_cached_string* next;
-  struct ptm_string content;
-} ptm_cached_string;
+
+typedef struct ptm_class_slot {
+  ptm_entity_class* entity_class;
+  ptm_entity* last_entity;
+} ptm_class_slot;
+
+typedef struct ptm_class_index {
+  ptm_class_slot* slots;
+  int slot_count;
+  int class_count;
+} ptm_class_index;
+
+typedef struct ptm_polygon {
+  ptm_brush_face* face;
+  PTM_REAL* positions;
+  int vertex_count;
+} ptm_polygon;
+
+typedef struct ptm_brush_polygons {
+  ptm_polygon* polygons;
+  int polygon_count;
+} ptm_brush_polygons;
+
+// Collision brushes are gathered here, then written out in the order
+// the hierarchy's leaves end up with them
+typedef struct ptm_collision_build {
+  ptm_collision_node* nodes;
+  int node_count;
+  int* order;             // brushes, in leaf order once it's built
+  const PTM_REAL* bounds; // 6 per brush
+} ptm_collision_build;
+
+// Brushes per leaf of a collision hierarchy (at most)
+#define PTM__COLLISION_LEAF_SIZE 4
+
+// A world polygon that could hide, or be hidden by, the polygons 
+// of other brushes on the same plane: they're sorted by plane key, 
+// so the ones that can touch are next to each other.
+typedef struct ptm_cull_polygon {
+  ptm_polygon* polygon;
+  int index; // in brush order
+  PTM_REAL min[3];
+  PTM_REAL max[3];
+} ptm_cull_polygon;
+
+// Brushes are found by the hash of their source, from their opening
+// brace to their closing one, when reloading
+typedef struct ptm_brush_source {
+  unsigned long long hash;
+  ptm_brush* brush;
+} ptm_brush_source;
+
+// What a map loaded with ptm_load_options.reloadable keeps for reloads
+typedef struct ptm_reload_cache {
+  ptm_brush_source* brush_sources;    // in source order
+  int brush_source_count;
+  ptm_brush_polygons* brush_polygons; // in meshing order, from before culling
+  int brush_count;
+} ptm_reload_cache;
+
+// Arenas of lazily built meshes, freed with the map
+typedef struct ptm_mesh_arena {
+  struct ptm_mesh_arena* next;
+  void* arena;
+} ptm_mesh_arena;
+
+// What a map loaded with ptm_load_options.defer_meshes needs to build
+// meshes later. The lock guards every entity's is_meshed (2 while it's
+// being built) and the arena list; meshing itself is done outside it.
+typedef struct ptm_deferred_meshes {
+  ptm_load_options options;
+  ptm_mesh_arena* arenas;
+#ifndef PTM_NO_THREADS
+#if defined(_WIN32)
+  SRWLOCK lock;
+  CONDITION_VARIABLE built;
+#else
+  pthread_mutex_t lock;
+  pthread_cond_t built;
+#endif
+#endif
+} ptm_deferred_meshes;
+
+// Everything the parser needs to carry on from one chunk to the next.
+// The line a chunk ends in the middle of is copied into carry, and 
+// parsed once the next chunk finishes it.
+struct ptm_parser {
+  ptm_map* map;
+  void* pool_arena;
+  ptm_string_pool pool;
+  ptm_class_index class_index;
+  PTM_HASH hash_classname;
+  PTM_HASH hash_worldspawn;
+  PTM_HASH hash_func_group;
+
+  ptm_entity_class* last_class;
+  ptm_brush* last_world_brush;
+  ptm_brush* last_brush;
+  ptm_entity* scoped_entity;
+  ptm_brush* scoped_brush;
+  ptm_scope scope;
+
+  ptm_load_options options;
+  int has_options;
+
+  const ptm_map* old_map;
+  const ptm_reload_cache* old_cache;
+  int is_reloadable;
+  int* source_slots;
+  int source_slot_mask;
+  ptm_brush_source* brush_sources;
+  int brush_source_count;
+  int brush_source_capacity;
+
+  void* parser_arena; // only for parsers from ptm_parser_create
+  char* carry;
+  int carry_length;
+  int carry_capacity;
+
+  ptm_load_stats stats;
+};
+
+// Sources are only parsed in parts of at least this many bytes
+#define PTM__PARSE_PART_SIZE (256 * 1024)
+
+typedef struct ptm_parse_job {
+  ptm_parser parser;
+  const char* source;
+  const char* source_end;
+  const char* entity_start;    // parts that start inside an entity parse
+  const char* class_line;      // its opening and classname lines first
+  const ptm_entity** entities; // in the order they closed
+  int entity_count;
+  int entity_capacity;
+} ptm_parse_job;
+
+typedef struct ptm_mesh_job {
+  ptm_brush** brushes;
+  ptm_brush_polygons* results;
+  int brush_count;
+  void* arena;
+  int scratch_reserved;
+  ptc_stats clip_stats;
+} ptm_mesh_job;
+
+typedef struct ptm_job_stripe {
+  ptm_job_function* function;
+  void** jobs;
+  int job_count;
+  int first;
+  int stride;
+} ptm_job_stripe;
+
+// Binary caches start with this header, then the ptm_map. Pointers
+// in the blob are offsets from its start (0 is NULL, since that's 
+// the header), and the relocations list where every one of them is.
+#define PTM__BINARY_VERSION 6
+
+typedef struct ptm_binary_header {
+  char magic[4];
+  int version;
+  int layout; // sizes of PTM_REAL, PTM_INDEX, PTM_HASH and pointers
+  int size;
+  int map_offset;
+  int relocation_offset;
+  int relocation_count;
+  unsigned long long source_hash;
+} ptm_binary_header;
+
+typedef struct ptm_binary_writer {
+  char* data; // NULL while only measuring
+  int size;
+  int* relocations;
+  int relocation_count;
+  const ptm_string_pool* strings;
+  int* string_offsets; // per string pool slot
+} ptm_binary_writer;
 
 // - Memory
 static void* ptm__arena_create(int capacity);
 static void ptm__arena_free(void* opaque_arena);
 static void* ptm__arena_push(void* opaque_arena, int bytes);
+static void ptm__arena_stats(void* opaque_arena, ptm_arena_stats* stats);
+static ptm_arena_block* ptm__arena_add_block(ptm_arena* arena, int capacity);
+static int ptm__arena_header_size(void);
+static int ptm__arena_reserved(void* arena);
+
+// - Threads
+static void ptm__run_jobs(ptm_job_function* function, void** jobs, int job_count, int thread_count);
+static void ptm__run_job_stripe(ptm_job_stripe* stripe);
+static void ptm__init_lock(ptm_deferred_meshes* deferred);
+static void ptm__free_lock(ptm_deferred_meshes* deferred);
+static void ptm__lock(ptm_deferred_meshes* deferred);
+static void ptm__unlock(ptm_deferred_meshes* deferred);
+static void ptm__wait_built(ptm_deferred_meshes* deferred);
+static void ptm__wake_built(ptm_deferred_meshes* deferred);
 
 // - Util
 static PTM_REAL ptm__strtor(const char* start, const char** end);
+static PTM_REAL ptm__strtor_fast(const char* start, const char** end);
 static PTM_HASH ptm__create_hash_fnv32(const char* data, int size);
+static int ptm__compare_memory(const void* a, const void* b, int bytes);
+static int ptm__is_string(ptm_string string, const char* data, int length, PTM_HASH hash);
 static void ptm__copy_memory(void* dest, const void* src, int bytes);
 static void ptm__zero_memory(void* dest, int bytes);
+static void ptm__add_load_stats(ptm_load_stats* stats, const ptm_load_stats* other);
 
 // - Math
-static void ptm__subtract_vec3(const float* a, const float* b, float* r);
-static float ptm__dot_vec3(const float* a, const float* b);
-static void ptm__cross_vec3(const float* a, const float* b, float* r);
+static void ptm__subtract_vec3(const PTM_REAL* a, const PTM_REAL* b, PTM_REAL* r);
+static PTM_REAL ptm__dot_vec3(const PTM_REAL* a, const PTM_REAL* b);
+static void ptm__cross_vec3(const PTM_REAL* a, const PTM_REAL* b, PTM_REAL* r);
+static void ptm__normalize_vec3(const PTM_REAL* a, PTM_REAL* r);
+static void ptm__create_plane(PTM_REAL points[3][3], PTM_REAL* normal, PTM_REAL* c);
+static PTM_REAL ptm__round_real(PTM_REAL value);
 
 // - Parsing 
-static void ptm__consume_until_at(const char** head, char value);
-static void ptm__consume_until_after(const char** head, char value);
-static void ptm__consume_whitespace(const char** head);
-static PTM_REAL ptm__consume_number(const char** head);
-static ptm_string ptm__consume_string(const char** head, char delimiter, 
-  ptm_cached_string** cache, void* arena);
+static const char* ptm__find_char(const char* head, const char* end, char value);
+static void ptm__consume_until_at(const char** head, const char* end, char value);
+static void ptm__consume_until_after(const char** head, const char* end, char value);
+static void ptm__consume_whitespace(const char** head, const char* end);
+static PTM_REAL ptm__consume_number(const char** head, const char* end);
+static ptm_string ptm__consume_string(const char** head, const char* end, char delimiter, 
+  ptm_string_pool* pool, void* pool_arena, void* arena);
+static ptm_string ptm__intern_string(const char* data, int length, PTM_HASH hash, ptm_string_pool* pool, void* pool_arena, void* arena);
+static const char* ptm__find_brush_end(const char* head, const char* end);
+static unsigned long long ptm__hash_brush_source(const char* start, const char* end);
+static void ptm__copy_brush(ptm_brush* brush, const ptm_brush* source, ptm_string_pool* pool, void* pool_arena, void* arena);
+static void ptm__append_carry(ptm_parser* parser, const char* source, const char* source_end);
+static int ptm__split_source(const char* source, const char* source_end, ptm_parse_job* parts, int part_count);
+static ptm_entity* ptm__copy_entity(const ptm_entity* source, ptm_string_pool* pool, void* pool_arena, void* arena);
+static void ptm__join_entity(ptm_entity* entity, ptm_brush** last_brush, ptm_entity* rest, ptm_brush* rest_last_brush);
+
+// - Properties
+static void ptm__index_properties(ptm_entity* entity, void* arena);
+static ptm_property** ptm__find_property_slot(ptm_property** slots, int slot_count, ptm_string key);
+static void ptm__decode_property(ptm_property* property);
+
+// - Strings
+static ptm_string* ptm__find_string_slot(const ptm_string_pool* pool, const char* data, int length, PTM_HASH hash);
+static void ptm__grow_string_pool(ptm_string_pool* pool, void* pool_arena);
+static ptm_class_slot* ptm__find_class_slot(const ptm_class_index* index, ptm_string name);
+static void ptm__grow_class_index(ptm_class_index* index, void* pool_arena);
 
 // - Meshing
-static ptm_mesh* ptm__create_meshes(ptm_brush* brushes, void* arena);
+static ptm_map* ptm__load_source(const char* source, int source_length, const ptm_load_options* options, const ptm_map* old_map);
+static void ptm__init_parser(ptm_parser* parser, const ptm_load_options* options, const ptm_map* old_map, int arena_capacity);
+static void ptm__parse(ptm_parser* parser, const char* source, const char* source_end);
+static void ptm__add_entity(ptm_parser* parser, ptm_entity* entity, ptm_brush* last_brush);
+static void ptm__parse_parts(ptm_parser* parser, const char* source, const char* source_end, int part_count);
+static void ptm__run_parse_job(void* opaque_job);
+static void ptm__record_entity(const ptm_entity* entity, void* opaque_job);
+static ptm_map* ptm__finish_parser(ptm_parser* parser);
+static int ptm__create_meshes(ptm_map* map, const ptm_load_options* options, const ptm_map* old_map);
+static int ptm__mesh_entities(ptm_map* map, ptm_entity** entities, int entity_count, const ptm_load_options* options, const ptm_map* old_map, void* arena, ptm_load_stats* stats);
+static void ptm__reuse_polygons(const ptm_map* old_map, ptm_brush** brushes, ptm_brush_polygons* results, int brush_count, void* scratch);
+static PTM_HASH ptm__hash_brush_planes(const ptm_brush* brush);
+static int ptm__is_same_planes(const ptm_brush* a, const ptm_brush* b);
+static void ptm__keep_polygons(ptm_map* map, ptm_brush_polygons* results, int brush_count);
+static void ptm__run_mesh_job(void* opaque_job);
+static void* ptm__reallocate_hull(void* arena, void* block, int old_bytes, int new_bytes);
+static void ptm__merge_meshes(ptm_entity* entity, ptm_brush_polygons* brushes, PTM_REAL cluster_size, void* arena);
+static void ptm__create_clusters(ptm_entity* entity, ptm_brush_polygons* brushes, PTM_REAL cluster_size, int* brush_clusters, void* scratch, void* arena);
+static void ptm__sort_clusters(ptm_entity* entity, ptm_mesh** tails);
+static void ptm__sort_polygons(ptm_polygon** polygons, int count, void* scratch);
+static unsigned int ptm__spread_bits(unsigned int bits);
+static int ptm__clip_brush(ptm_brush* brush, ptc_mesh* hull, ptc_plane* planes, void** faces);
+static int ptm__is_hull_closed(ptc_mesh* hull);
+static int ptm__is_face_visible(ptc_face* face);
+static void ptm__weld_hull(ptc_mesh* hull, int* welds, PTM_REAL* positions);
+static int ptm__add_mesh_vertex(ptm_mesh* mesh, int* slots, int slot_count);
+static void ptm__cull_hidden_faces(ptm_entity* entity, ptm_brush_polygons* brushes);
+static int ptm__is_tool_texture(ptm_string texture_name);
+static void ptm__get_plane_key(ptm_brush_face* face, int* key);
+static int ptm__is_polygon_covered(ptm_cull_polygon* cull, ptm_cull_polygon* first, ptm_cull_polygon* last, PTM_REAL* fragments, int fragment_size);
+static int ptm__is_on_opposite_plane(const ptm_brush_face* face, const ptm_polygon* cover);
+static int ptm__split_polygon(const PTM_REAL* positions, int count, const PTM_REAL* normal, PTM_REAL c,
+  PTM_REAL* inside, int* inside_count, PTM_REAL* outside, int* outside_count, int capacity);
+static ptm_mesh** ptm__find_mesh_slot(ptm_mesh** slots, int slot_count, ptm_string texture_name, ptm_cluster* cluster);
+
+static void ptm__interleave_meshes(ptm_entity* entity, const ptm_load_options* options, void* arena);
+
+// - Vertices
+static unsigned short ptm__float_to_half(float value);
+static int ptm__to_snorm(PTM_REAL value, int max);
+static void ptm__encode_octahedral(const PTM_REAL* direction, PTM_REAL* encoded);
+
+// - Flattening
+static ptm_flat_map* ptm__flatten_map(ptm_map* map);
+static void ptm__flatten_entity(ptm_flat_map* flat, ptm_entity* entity);
+
+// - Collision
+static ptm_collision* ptm__create_collision(ptm_entity* world, ptm_brush_polygons* brushes, void* arena);
+static void ptm__build_collision_node(ptm_collision_build* build, int first, int count);
+static void ptm__select_brushes(int* order, int count, int k, const PTM_REAL* bounds, int axis);
+static int ptm__is_segment_in_bounds(const PTM_REAL* bounds_min, const PTM_REAL* bounds_max, const PTM_REAL* start, const PTM_REAL* direction, PTM_REAL max_fraction);
+static void ptm__trace_brush(const ptm_collision* collision, int brush, const PTM_REAL* start, const PTM_REAL* end, ptm_trace* trace);
+static int ptm__is_point_in_brush(const ptm_collision* collision, int brush, const PTM_REAL* point);
+static int ptm__is_box_in_brush(const ptm_collision* collision, int brush, const PTM_REAL* min, const PTM_REAL* max);
+static int ptm__is_box_overlapping(const PTM_REAL* a_min, const PTM_REAL* a_max, const PTM_REAL* b_min, const PTM_REAL* b_max);
+
+// - Binary
+static void ptm__write_binary_map(ptm_binary_writer* writer, const ptm_map* map, int* entity_offsets);
+static void ptm__write_binary_entity(ptm_binary_writer* writer, int offset, const ptm_entity* entity);
+static void ptm__write_binary_flat(ptm_binary_writer* writer, int field, const ptm_flat_map* flat, const int* entity_offsets);
+static void ptm__write_binary_collision(ptm_binary_writer* writer, int field, const ptm_collision* collision);
+static int ptm__write_binary_array(ptm_binary_writer* writer, int field, const void* source, int bytes);
+static int ptm__write_binary(ptm_binary_writer* writer, const void* source, int bytes);
+static void ptm__write_binary_at(ptm_binary_writer* writer, int offset, const void* source, int bytes);
+static void ptm__write_binary_pointer(ptm_binary_writer* writer, int field, int target);
+static void ptm__write_binary_string(ptm_binary_writer* writer, int field, ptm_string string);
+static int ptm__get_binary_layout(void);
+static int ptm__get_binary_header_size(void);
+static ptm_map* ptm__relocate_binary(char* binary, int binary_size, unsigned long long source_hash);
 
 // === API ===
 
 ptm_map* ptm_load_source(const char* source, int source_length) {
+  return ptm_load_source_ex(source, source_length, NULL);
+}
+
+static void ptm__join_entity(ptm_entity* entity, ptm_brush** last_brush, ptm_entity* rest, ptm_brush* rest_last_brush) {
+  // Appends the rest of an entity that was split between parts. 
+  // Properties are listed last first, so the rest's go in front.
+  if (rest->properties != NULL) {
+    ptm_property* last_property = rest->properties;
+
+    while (last_property->next != NULL) {
+      last_property = last_property->next;
+    }
+
+    last_property->next = entity->properties;
+    entity->properties = rest->properties;
+    entity->property_count += rest->property_count;
+  }
+
+  if (rest->brushes != NULL) {
+    if (*last_brush == NULL) {
+      entity->brushes = rest->brushes;
+    }
+    else {
+      (*last_brush)->next = rest->brushes;
+    }
+
+    *last_brush = rest_last_brush;
+    entity->brush_count += rest->brush_count;
+  }
+}
+
+ptm_map* ptm_load_source_ex(const char* source, int source_length, const ptm_load_options* options) {
+  return ptm__load_source(source, source_length, options, NULL);
+}
+
+ptm_map* ptm_reload_source(const ptm_map* old_map, const char* source, int source_length, const ptm_load_options* options) {
+  return ptm__load_source(source, source_length, options, old_map);
+}
+
+ptm_parser* ptm_parser_create(const ptm_map* old_map, const ptm_load_options* options) {
+  // The parser lives between calls, in an arena of its own with the 
+  // partial lines. Without a source length to go by, the map's arena
+  // starts small, it grows as needed.
+  void* parser_arena = PTM_ACREATE((int)sizeof(ptm_parser) + 4096);
+  ptm_parser* parser = (ptm_parser*)PTM_APUSH(parser_arena, sizeof *parser);
+  ptm__init_parser(parser, options, old_map, 65536);
+  parser->parser_arena = parser_arena;
+  return parser;
+}
+
+void ptm_parser_feed(ptm_parser* parser, const char* chunk, int chunk_length) {
+  const char* head = chunk;
+  const char* end = chunk + chunk_length;
+  PTM_PROFILE_BEGIN("parse");
+
+  // Finish the line the last chunk ended in the middle of, if this
+  // one gets to its end: it's parsed on its own, from the carry.
+  if (parser->carry_length > 0) {
+    const char* line_end = ptm__find_char(head, end, '\n');
+
+    if (line_end == end) {
+      ptm__append_carry(parser, head, end);
+      PTM_PROFILE_END("parse");
+      return;
+    }
+
+    ptm__append_carry(parser, head, line_end + 1);
+    ptm__parse(parser, parser->carry, parser->carry + parser->carry_length);
+    parser->carry_length = 0;
+    head = line_end + 1;
+  }
+
+  // Every whole line left is parsed straight from the chunk
+  const char* lines_end = end;
+
+  while (lines_end > head && lines_end[-1] != '\n') {
+    lines_end--;
+  }
+
+  ptm__parse(parser, head, lines_end);
+  ptm__append_carry(parser, lines_end, end);
+  PTM_PROFILE_END("parse");
+}
+
+ptm_map* ptm_parser_finish(ptm_parser* parser) {
+  // The last line doesn't need a newline
+  if (parser->carry_length > 0) {
+    PTM_PROFILE_BEGIN("parse");
+    ptm__parse(parser, parser->carry, parser->carry + parser->carry_length);
+    PTM_PROFILE_END("parse");
+  }
+
+  void* parser_arena = parser->parser_arena;
+  ptm_map* map = ptm__finish_parser(parser);
+  PTM_AFREE(parser_arena);
+  return map;
+}
+
+void ptm_parser_free(ptm_parser* parser) {
+  PTM_AFREE(parser->pool_arena);
+  PTM_AFREE(parser->map->arena);
+  PTM_AFREE(parser->parser_arena);
+}
+
+static ptm_map* ptm__load_source(const char* source, int source_length, const ptm_load_options* options, const ptm_map* old_map) {
+  // The whole source is one chunk: every line is complete, and the
+  // last one is ended by the end of the source.
+  ptm_parser parser;
+  ptm__init_parser(&parser, options, old_map, source_length / 4 * 3 + 4096);
+  PTM_PROFILE_BEGIN("parse");
+
+  // Big sources are split into parts between entities (or brushes),
+  // which are parsed on the meshing threads. Parts are copied into 
+  // the map afterwards, so small ones aren't worth it.
+  int thread_count = options != NULL ? options->thread_count : 1;
+  int has_scheduler = options != NULL && options->run_jobs != NULL;
+  int part_count = thread_count > 1 ? thread_count : has_scheduler ? 4 : 1;
+
+  if (part_count > source_length / PTM__PARSE_PART_SIZE) {
+    part_count = source_length / PTM__PARSE_PART_SIZE;
+  }
+
+  if (part_count > 1) {
+    ptm__parse_parts(&parser, source, source + source_length, part_count);
+  }
+  else {
+    ptm__parse(&parser, source, source + source_length);
+  }
+
+  PTM_PROFILE_END("parse");
+  return ptm__finish_parser(&parser);
+}
+
+static void ptm__init_parser(ptm_parser* parser, const ptm_load_options* options, const ptm_map* old_map, int arena_capacity) {
+  ptm__zero_memory(parser, sizeof *parser);
+
+  if (options != NULL) {
+    parser->options = *options;
+    parser->has_options = 1;
+  }
+
   // Cache some hashed strings that we frequently evaluate
-  PTM_HASH hash_classname = PTM_CREATE_HASH("classname", 9);
-  PTM_HASH hash_worldspawn = PTM_CREATE_HASH("worldspawn", 10);
-  PTM_HASH hash_func_group = PTM_CREATE_HASH("func_group", 10);
+  parser->hash_classname = PTM_CREATE_HASH("classname", 9);
+  parser->hash_worldspawn = PTM_CREATE_HASH("worldspawn", 10);
+  parser->hash_func_group = PTM_CREATE_HASH("func_group", 10);
 
-  // Initialize the map structure that will be returned
-  void* arena = PTM_ACREATE(source_length * 2);
+  // Initialize the map structure that will be returned.
+  // The arena grows as needed: start with about what the parsed 
+  // entities and brushes take, meshes will get blocks of their own.
+  void* arena = PTM_ACREATE(arena_capacity);
   ptm_map* map = (ptm_map*)PTM_APUSH(arena, sizeof *map);
   ptm__zero_memory(map, sizeof *map);
   map->arena = arena;
+  parser->map = map;
+
+  // Initialize state that isn't returned, but helps a lot while parsing.
+  // The string pool and class index grow while parsing, so their tables 
+  // live in a scratch arena until we know how big they end up. Other
+  // arrays that grow while parsing double in it too: the old copies are
+  // left behind, and only add up to the size of the final one.
+  void* pool_arena = PTM_ACREATE(1024 * (int)sizeof(ptm_string) + 64 * (int)sizeof(ptm_class_slot));
+  ptm__grow_string_pool(&parser->pool, pool_arena);
+  ptm__grow_class_index(&parser->class_index, pool_arena);
+  parser->pool_arena = pool_arena;
+  parser->scope = PTM_SCOPE_MAP;
+
+  // Reloads look brushes up by the hash of their source, in a table 
+  // (of old brush + 1, or 0 if unused). Reloadable maps record them.
+  const ptm_reload_cache* old_cache = old_map != NULL ? old_map->reload_cache : NULL;
+  parser->old_map = old_map;
+  parser->old_cache = old_cache;
+  parser->is_reloadable = options != NULL && options->reloadable;
+
+  if (old_cache != NULL) {
+    int source_slot_count = 16;
+
+    while (source_slot_count < old_cache->brush_source_count * 2) {
+      source_slot_count *= 2;
+    }
+
+    int* source_slots = (int*)PTM_APUSH(pool_arena, source_slot_count * (int)sizeof(int));
+    int source_slot_mask = source_slot_count - 1;
+    ptm__zero_memory(source_slots, source_slot_count * (int)sizeof(int));
+
+    for (int i = 0; i < old_cache->brush_source_count; i++) {
+      int index = (int)(old_cache->brush_sources[i].hash & (unsigned long long)source_slot_mask);
+
+      while (source_slots[index] != 0) {
+        index = (index + 1) & source_slot_mask;
+      }
+
+      source_slots[index] = i + 1;
+    }
+
+    parser->source_slots = source_slots;
+    parser->source_slot_mask = source_slot_mask;
+  }
+}
+
+static void ptm__parse(ptm_parser* parser, const char* source, const char* source_end) {
+  // The state lives in the parser between chunks, but in locals while
+  // parsing one: they're written back at the end.
+  PTM_HASH hash_classname = parser->hash_classname;
+  void* arena = parser->map->arena;
+  void* pool_arena = parser->pool_arena;
+  ptm_string_pool pool = parser->pool;
+
+  // Lists are appended to through their last element, so they keep 
+  // the order of the file without having to walk them.
+  ptm_brush* last_brush = parser->last_brush;
+  ptm_entity* scoped_entity = parser->scoped_entity;
+  ptm_brush* scoped_brush = parser->scoped_brush;
+  ptm_scope scope = parser->scope;
 
-  // Initialize state that isn't returned, but helps a lot while parsing
-  ptm_cached_string* string_cache = NULL;
-  ptm_entity* scoped_entity = NULL;
-  ptm_brush* scoped_brush = NULL;
-  ptm_scope scope = PTM_SCOPE_MAP;
+  // Brushes are only hashed when all of their source is in this chunk
+  const ptm_reload_cache* old_cache = parser->old_cache;
+  int is_reloadable = parser->is_reloadable;
+  int* source_slots = parser->source_slots;
+  int source_slot_mask = parser->source_slot_mask;
+  ptm_brush_source* brush_sources = parser->brush_sources;
+  int brush_source_count = parser->brush_source_count;
+  int brush_source_capacity = parser->brush_source_capacity;
 
   // Tracking for our current position in the source, and when to stop
   const char* head = source;
-  const char* end = source + source_length + 1;
+  const char* end = source_end;
+  PTM__COUNT(parser->stats.bytes_scanned, end - head);
 
   while (head < end) {
     // Leading whitespace does not affect the meaning of a line
-    ptm__consume_whitespace(&head);
+    ptm__consume_whitespace(&head, end);
+
+    if (head >= end) {
+      break;
+    }
 
     switch (*head) {
       case '{': {
@@ -186,80 +1093,60 @@ ptm_map* ptm_load_source(const char* source, int source_length) {
           scope = PTM_SCOPE_ENTITY;
           scoped_entity = (ptm_entity*)PTM_APUSH(arena, sizeof(ptm_entity));
           ptm__zero_memory(scoped_entity, sizeof(ptm_entity));
+          last_brush = NULL;
         }
         else if (scope == PTM_SCOPE_ENTITY) {
           scope = PTM_SCOPE_BRUSH;
           scoped_brush = (ptm_brush*)PTM_APUSH(arena, sizeof(ptm_brush));
           ptm__zero_memory(scoped_brush, sizeof(ptm_brush));
-        }
+          const char* brush_end = old_cache != NULL || is_reloadable ? ptm__find_brush_end(head, end) : end;
 
-        break;
-      }
-      case '}': {
-        PTM_ASSERT(scope != PTM_SCOPE_MAP);
+          if (brush_end < end) {
+            unsigned long long hash = ptm__hash_brush_source(head, brush_end);
 
-        // We have finished processing an entity: now we need to determine 
-        // where it should be stored.
-        if (scope == PTM_SCOPE_ENTITY) {
-          PTM_ASSERT(scoped_entity != NULL);
-	        PTM_ASSERT(scoped_entity->class_name.data != NULL);
-          scope = PTM_SCOPE_MAP;
-  
-          ptm_string class_name = scoped_entity->class_name;
-          int is_func_group = class_name.hash == hash_func_group;
-          int is_worldspawn = class_name.hash == hash_worldspawn;
-          int is_world_entity = is_func_group | is_worldspawn;
-          
-          // Merge special entity brushes into the singleton "world" entity
-          if (is_world_entity && scoped_entity->brushes != NULL) {
-            ptm_brush* brush = scoped_entity->brushes;
+            if (is_reloadable) {
+              if (brush_source_count == brush_source_capacity) {
+                ptm_brush_source* grown_sources = brush_sources;
+                brush_source_capacity = brush_source_capacity == 0 ? 256 : brush_source_capacity * 2;
+                brush_sources = (ptm_brush_source*)PTM_APUSH(pool_arena, brush_source_capacity * (int)sizeof(ptm_brush_source));
+                ptm__copy_memory(brush_sources, grown_sources, brush_source_count * (int)sizeof(ptm_brush_source));
+              }
 
-            while (brush->next != NULL) {
-              brush = brush->next;
+              brush_sources[brush_source_count].hash = hash;
+              brush_sources[brush_source_count++].brush = scoped_brush;
             }
 
-            brush->next = map->world.brushes;
-            map->world.brushes = scoped_entity->brushes;
-            map->world.brush_count += scoped_entity->brush_count;
-          }
-
-          // "worldspawn" properties define the "world" entity properties
-          if (class_name.hash == hash_worldspawn) {
-            map->world.properties = scoped_entity->properties;
-            map->world.property_count = scoped_entity->property_count;
-          }
-
-          if (!is_world_entity) {
-            // Generate a mesh for the entity
-            scoped_entity->meshes = ptm__create_meshes(scoped_entity->brushes, arena);
+            // Same source, same brush: copy it and carry on at its closing brace
+            for (int index = (int)(hash & (unsigned long long)source_slot_mask); source_slots != NULL && source_slots[index] != 0; index = (index + 1) & source_slot_mask) {
+              const ptm_brush_source* old = &old_cache->brush_sources[source_slots[index] - 1];
 
-            // Try and find an existing class that matches
-            ptm_entity_class* entity_class = map->entity_classes;
-            
-            while (entity_class != NULL) {
-              if (entity_class->name.hash == class_name.hash) {
+              if (old->hash == hash) {
+                ptm__copy_brush(scoped_brush, old->brush, &pool, pool_arena, arena);
+                PTM__COUNT(parser->stats.string_lookups, old->brush->face_count);
+                PTM__COUNT(parser->stats.string_hits, old->brush->face_count);
+                head = brush_end;
                 break;
               }
-              entity_class = entity_class->next;
             }
 
-            // Create a new class if one doesn't exist
-            if (entity_class == NULL) {
-              entity_class = (ptm_entity_class*)PTM_APUSH(arena, sizeof *entity_class);
-              ptm__zero_memory(entity_class, sizeof *entity_class);
-              entity_class->name = class_name;
-
-              entity_class->next = map->entity_classes;
-              map->entity_classes = entity_class;
-              map->entity_class_count++;
+            if (head == brush_end) {
+              continue;
             }
-
-            // Add the scoped entity to it's class
-            scoped_entity->next = entity_class->entities;
-            entity_class->entities = scoped_entity;
-            entity_class->entity_count++;
           }
+        }
+
+        break;
+      }
+      case '}': {
+        PTM_ASSERT(scope != PTM_SCOPE_MAP);
 
+        // We have finished processing an entity: now we need to determine 
+        // where it should be stored.
+        if (scope == PTM_SCOPE_ENTITY) {
+          PTM_ASSERT(scoped_entity != NULL);
+	        PTM_ASSERT(scoped_entity->class_name.data != NULL);
+          scope = PTM_SCOPE_MAP;
+          ptm__add_entity(parser, scoped_entity, last_brush);
           scoped_entity = NULL;
         }
         else if (scope == PTM_SCOPE_BRUSH) {
@@ -268,8 +1155,14 @@ ptm_map* ptm_load_source(const char* source, int source_length) {
           scope = PTM_SCOPE_ENTITY;
           
           // Adding a brush is much easier than an entity: no special cases, just add
-          scoped_brush->next = scoped_entity->brushes;
-          scoped_entity->brushes = scoped_brush;
+          if (last_brush == NULL) {
+            scoped_entity->brushes = scoped_brush;
+          }
+          else {
+            last_brush->next = scoped_brush;
+          }
+
+          last_brush = scoped_brush;
           scoped_entity->brush_count++;
           
           scoped_brush = NULL;
@@ -281,22 +1174,25 @@ ptm_map* ptm_load_source(const char* source, int source_length) {
         PTM_ASSERT(scope == PTM_SCOPE_ENTITY);
         PTM_ASSERT(scoped_entity != NULL);
 
-        ptm__consume_whitespace(&head);
+        ptm__consume_whitespace(&head, end);
 
         // Ignore any names with the prefix "_tb"
         // (These are used internally by trenchbroom)
-        if (*(head + 1) == '_' && *(head + 2) == 't' && *(head + 3) == 'b') {
+        if (end - head > 3 && head[1] == '_' && head[2] == 't' && head[3] == 'b') {
           break;
         }
 
         // Add a new property to the scoped entity's list
         ptm_property* property = PTM_APUSH(arena, sizeof *property);
-        property->key = ptm__consume_string(&head, '"', &string_cache, arena);
-        property->value = ptm__consume_string(&head, '"', &string_cache, arena);
+        property->key = ptm__consume_string(&head, end, '"', &pool, pool_arena, arena);
+        property->value = ptm__consume_string(&head, end, '"', &pool, pool_arena, arena);
+        property->is_decoded = 0;
+        PTM__COUNT(parser->stats.string_lookups, 2);
+        PTM__COUNT(parser->stats.string_hits, 2);
 
         // The "classname" property is special: it is stored separately
         // because it *must* be defined for every entity.
-        if (property->key.hash == hash_classname) {
+        if (ptm__is_string(property->key, "classname", 9, hash_classname)) {
           scoped_entity->class_name = property->value;
         }
         else {
@@ -324,42 +1220,43 @@ ptm_map* ptm_load_source(const char* source, int source_length) {
         PTM_REAL p[3][3];
 
         for (int i = 0; i < 3; i++) {
-          ptm__consume_until_after(&head, '(');
+          ptm__consume_until_after(&head, end, '(');
           // Quake uses z=up, and we probably want y=up so swap X and Y here
-          p[i][0] = ptm__consume_number(&head);
-          p[i][2] = ptm__consume_number(&head);
-          p[i][1] = ptm__consume_number(&head);
-          ptm__consume_until_after(&head, ')');
+          p[i][0] = ptm__consume_number(&head, end);
+          p[i][2] = ptm__consume_number(&head, end);
+          p[i][1] = ptm__consume_number(&head, end);
+          ptm__consume_until_after(&head, end, ')');
         }
 
         // Calculate the normal and plane constant from the points
-        float v[2][3];
-        ptm__subtract_vec3(p[0], p[1], v[0]);
-        ptm__subtract_vec3(p[0], p[2], v[1]);
-        ptm__cross_vec3(v[0], v[1], face->plane_normal);
-        face->plane_c = ptm__dot_vec3(face->plane_normal, p[0]);
+        ptm__create_plane(p, face->plane_normal, &face->plane_c);
 
         // Now, read the texture string name
-        face->texture_name = ptm__consume_string(&head, ' ', &string_cache, arena);
+        face->texture_name = ptm__consume_string(&head, end, ' ', &pool, pool_arena, arena);
 
         // Next, 2 blocks of uv information.
+        // The uv axes are directions in the same space as the 
+        // points, so they need the same axis swap.
         for (int i = 0; i < 2; i++) {
-          ptm__consume_until_after(&head, '[');
-          face->texture_uv[i][0] = ptm__consume_number(&head);
-          face->texture_uv[i][1] = ptm__consume_number(&head);
-          face->texture_uv[i][2] = ptm__consume_number(&head);
-          face->texture_offset[i] = ptm__consume_number(&head);
-          ptm__consume_until_after(&head, ']');
+          ptm__consume_until_after(&head, end, '[');
+          face->texture_uv[i][0] = ptm__consume_number(&head, end);
+          face->texture_uv[i][2] = ptm__consume_number(&head, end);
+          face->texture_uv[i][1] = ptm__consume_number(&head, end);
+          face->texture_offset[i] = ptm__consume_number(&head, end);
+          ptm__consume_until_after(&head, end, ']');
         }
 
         // The rotation value is actually unused in valve220,
         // so we totally ignore and skip it.
-        ptm__consume_whitespace(&head);
-        ptm__consume_until_at(&head, ' ');
+        ptm__consume_whitespace(&head, end);
+        ptm__consume_until_at(&head, end, ' ');
 
         // Finally, some closing texture info
-        face->texture_scale[0] = ptm__consume_number(&head);
-        face->texture_scale[1] = ptm__consume_number(&head);
+        face->texture_scale[0] = ptm__consume_number(&head, end);
+        face->texture_scale[1] = ptm__consume_number(&head, end);
+        PTM__COUNT(parser->stats.numbers_parsed, 19);
+        PTM__COUNT(parser->stats.string_lookups, 1);
+        PTM__COUNT(parser->stats.string_hits, 1);
 
         break;
       }
@@ -367,202 +1264,4169 @@ ptm_map* ptm_load_source(const char* source, int source_length) {
 
     // Finished parsing the current line: consume to 
     // the next newline or until we finish the file
-    for (;;) {
-      int reached_newline = *head == '\n';
-      int reached_end = head >= end;
+    ptm__consume_until_after(&head, end, '\n');
+  }
 
-      if (reached_newline) {
-        head++;
-        break;
-      }
-      if (reached_end) {
-        break;
-      }
-      else {
-        head++;
-      }
+  // Every lookup was counted as a hit: take back the ones that added a string
+  PTM__COUNT(parser->stats.string_hits, parser->pool.string_count - pool.string_count);
+  parser->pool = pool;
+  parser->last_brush = last_brush;
+  parser->scoped_entity = scoped_entity;
+  parser->scoped_brush = scoped_brush;
+  parser->scope = scope;
+  parser->brush_sources = brush_sources;
+  parser->brush_source_count = brush_source_count;
+  parser->brush_source_capacity = brush_source_capacity;
+}
+
+static void ptm__add_entity(ptm_parser* parser, ptm_entity* entity, ptm_brush* last_brush) {
+  const ptm_load_options* options = parser->has_options ? &parser->options : NULL;
+  ptm_map* map = parser->map;
+  ptm_class_index* class_index = &parser->class_index;
+  ptm_string class_name = entity->class_name;
+  int is_func_group = ptm__is_string(class_name, "func_group", 10, parser->hash_func_group);
+  int is_worldspawn = ptm__is_string(class_name, "worldspawn", 10, parser->hash_worldspawn);
+  int is_world_entity = is_func_group | is_worldspawn;
+  ptm__index_properties(entity, map->arena);
+  
+  // Merge special entity brushes into the singleton "world" entity
+  if (is_world_entity && entity->brushes != NULL) {
+    if (parser->last_world_brush == NULL) {
+      map->world.brushes = entity->brushes;
     }
+    else {
+      parser->last_world_brush->next = entity->brushes;
+    }
+
+    parser->last_world_brush = last_brush;
+    map->world.brush_count += entity->brush_count;
   }
 
-  // Only after everything is parsed is worldspawn stable:
-  // now we can create the mesh for it
-  map->world.meshes = ptm__create_meshes(map->world.brushes, arena);
+  // "worldspawn" properties define the "world" entity properties
+  if (is_worldspawn) {
+    map->world.properties = entity->properties;
+    map->world.property_slots = entity->property_slots;
+    map->world.property_count = entity->property_count;
+    map->world.property_slot_count = entity->property_slot_count;
+  }
+
+  if (!is_world_entity) {
+    // Try and find an existing class that matches
+    ptm_class_slot* slot = ptm__find_class_slot(class_index, class_name);
+
+    // Create a new class if one doesn't exist
+    if (slot->entity_class == NULL) {
+      if ((class_index->class_count + 1) * 2 > class_index->slot_count) {
+        ptm__grow_class_index(class_index, parser->pool_arena);
+        slot = ptm__find_class_slot(class_index, class_name);
+      }
+
+      ptm_entity_class* entity_class = (ptm_entity_class*)PTM_APUSH(map->arena, sizeof *entity_class);
+      ptm__zero_memory(entity_class, sizeof *entity_class);
+      entity_class->name = class_name;
+
+      if (parser->last_class == NULL) {
+        map->entity_classes = entity_class;
+      }
+      else {
+        parser->last_class->next = entity_class;
+      }
+
+      parser->last_class = entity_class;
+      map->entity_class_count++;
+      slot->entity_class = entity_class;
+      class_index->class_count++;
+    }
+
+    // Add the entity to it's class
+    ptm_entity_class* entity_class = slot->entity_class;
+
+    if (slot->last_entity == NULL) {
+      entity_class->entities = entity;
+    }
+    else {
+      slot->last_entity->next = entity;
+    }
+
+    slot->last_entity = entity;
+    entity_class->entity_count++;
+  }
+
+  if (options != NULL && options->on_entity != NULL) {
+    options->on_entity(entity, options->on_entity_userdata);
+  }
+}
+
+static void ptm__parse_parts(ptm_parser* parser, const char* source, const char* source_end, int part_count) {
+  // Every part gets a parser (with its own arena and string pool) that
+  // only records its entities, in the order they close. Reloads share
+  // the table of old brush sources, it's only read.
+  int jobs_size = part_count * (int)(sizeof(ptm_parse_job) + sizeof(void*));
+  void* scratch = PTM_ACREATE(jobs_size);
+  ptm_parse_job* jobs = (ptm_parse_job*)PTM_APUSH(scratch, part_count * (int)sizeof(ptm_parse_job));
+  void** job_pointers = (void**)PTM_APUSH(scratch, part_count * (int)sizeof(void*));
+  ptm__zero_memory(jobs, part_count * (int)sizeof(ptm_parse_job));
+  part_count = ptm__split_source(source, source_end, jobs, part_count);
+
+  for (int i = 0; i < part_count; i++) {
+    ptm_parse_job* job = &jobs[i];
+    job->source_end = i + 1 < part_count ? jobs[i + 1].source : source_end;
+
+    ptm_load_options part_options = parser->options;
+    part_options.on_entity = ptm__record_entity;
+    part_options.on_entity_userdata = job;
+    ptm__init_parser(&job->parser, &part_options, NULL, (int)(job->source_end - job->source) / 4 * 3 + 4096);
+    job->parser.old_cache = parser->old_cache;
+    job->parser.source_slots = parser->source_slots;
+    job->parser.source_slot_mask = parser->source_slot_mask;
+    job_pointers[i] = job;
+  }
+
+  const ptm_load_options* options = &parser->options;
+
+  if (options->run_jobs != NULL) {
+    options->run_jobs(ptm__run_parse_job, job_pointers, part_count, options->run_jobs_userdata);
+  }
+  else {
+    ptm__run_jobs(ptm__run_parse_job, job_pointers, part_count, options->thread_count);
+  }
+
+  // Merging is adding every entity as if it was just parsed, after 
+  // copying it into the map (and its strings into the map's pool)
+  int brush_source_count = 0;
+  int entity_count = 0;
+
+  for (int i = 0; i < part_count; i++) {
+    brush_source_count += jobs[i].parser.brush_source_count;
+    entity_count += jobs[i].entity_count;
+  }
+
+  ptm_brush_source* brush_sources = (ptm_brush_source*)PTM_APUSH(parser->pool_arena, brush_source_count * (int)sizeof(ptm_brush_source));
+  brush_source_count = 0;
+
+  // Lookups count as hits, until the new strings are taken back out
+  PTM__COUNT(parser->stats.string_hits, parser->pool.string_count);
+
+  // The "classname" keys aren't kept in the entities, but the pool has
+  // every string of the source, as if it was parsed in one go
+  if (entity_count > 0) {
+    ptm__intern_string("classname", 9, parser->hash_classname, &parser->pool, parser->pool_arena, parser->map->arena);
+    PTM__COUNT(parser->stats.string_lookups, 1);
+    PTM__COUNT(parser->stats.string_hits, 1);
+  }
+
+  // An entity still open at the end of a part is finished by the next
+  ptm_entity* open_entity = NULL;
+  ptm_brush* open_last_brush = NULL;
+
+  for (int i = 0; i < part_count; i++) {
+    ptm_parse_job* job = &jobs[i];
+    const ptm_entity* last_open = job->parser.scope != PTM_SCOPE_MAP ? job->parser.scoped_entity : NULL;
+    int piece_count = job->entity_count + (last_open != NULL);
+    int source_index = 0;
+
+    for (int j = 0; j < piece_count; j++) {
+      const ptm_entity* entity = j < job->entity_count ? job->entities[j] : last_open;
+      ptm_entity* copy = ptm__copy_entity(entity, &parser->pool, parser->pool_arena, parser->map->arena);
+      const ptm_brush* brush = entity->brushes;
+      ptm_brush* copy_brush = copy->brushes;
+      ptm_brush* last_brush = NULL;
+      PTM__COUNT(parser->stats.string_lookups, 1 + entity->property_count * 2);
+      PTM__COUNT(parser->stats.string_hits, 1 + entity->property_count * 2);
+
+      // Brushes and their sources are both in source order, but not
+      // every brush has to have one
+      for (int k = 0; k < entity->brush_count; k++) {
+        const ptm_brush_source* brush_source = &job->parser.brush_sources[source_index];
+        PTM__COUNT(parser->stats.string_lookups, brush->face_count);
+        PTM__COUNT(parser->stats.string_hits, brush->face_count);
+
+        if (source_index < job->parser.brush_source_count && brush_source->brush == brush) {
+          brush_sources[brush_source_count].hash = brush_source->hash;
+          brush_sources[brush_source_count++].brush = copy_brush;
+          source_index++;
+        }
+
+        last_brush = copy_brush;
+        brush = brush->next;
+        copy_brush = copy_brush->next;
+      }
+
+      if (j == 0 && job->entity_start != NULL && open_entity != NULL) {
+        ptm__join_entity(open_entity, &open_last_brush, copy, last_brush);
+        copy = open_entity;
+        last_brush = open_last_brush;
+      }
+
+      if (j < job->entity_count) {
+        ptm__add_entity(parser, copy, last_brush);
+        open_entity = NULL;
+      }
+      else {
+        open_entity = copy;
+        open_last_brush = last_brush;
+      }
+    }
+
+    ptm__add_load_stats(&parser->stats, &job->parser.stats);
+    PTM_AFREE(job->parser.pool_arena);
+    PTM_AFREE(job->parser.map->arena);
+  }
+
+  PTM__COUNT(parser->stats.string_hits, -parser->pool.string_count);
+  parser->brush_sources = brush_sources;
+  parser->brush_source_count = brush_source_count;
+  parser->brush_source_capacity = brush_source_count;
+  PTM_AFREE(scratch);
+}
+
+static void ptm__run_parse_job(void* opaque_job) {
+  ptm_parse_job* job = (ptm_parse_job*)opaque_job;
+
+  // Parts that start inside an entity open it again first
+  if (job->entity_start != NULL) {
+    ptm__parse(&job->parser, job->entity_start, ptm__find_char(job->entity_start, job->source, '\n'));
+    ptm__parse(&job->parser, job->class_line, ptm__find_char(job->class_line, job->source, '\n'));
+  }
+
+  ptm__parse(&job->parser, job->source, job->source_end);
+}
+
+static void ptm__record_entity(const ptm_entity* entity, void* opaque_job) {
+  ptm_parse_job* job = (ptm_parse_job*)opaque_job;
+
+  if (job->entity_count == job->entity_capacity) {
+    const ptm_entity** entities = job->entities;
+    job->entity_capacity = job->entity_capacity == 0 ? 256 : job->entity_capacity * 2;
+    job->entities = (const ptm_entity**)PTM_APUSH(job->parser.pool_arena, job->entity_capacity * (int)sizeof(ptm_entity*));
+    ptm__copy_memory(job->entities, entities, job->entity_count * (int)sizeof(ptm_entity*));
+  }
+
+  job->entities[job->entity_count++] = entity;
+}
+
+static ptm_map* ptm__finish_parser(ptm_parser* parser) {
+  const ptm_load_options* options = parser->has_options ? &parser->options : NULL;
+  ptm_map* map = parser->map;
+  void* arena = map->arena;
+  ptm_string_pool pool = parser->pool;
+  int brush_source_count = parser->brush_source_count;
+
+  map->load_stats = parser->stats;
+
+  // The pool won't change anymore: move it into the map
+  int slots_size = pool.slot_count * (int)sizeof(ptm_string);
+  map->strings = pool;
+  map->strings.slots = (ptm_string*)PTM_APUSH(arena, slots_size);
+  ptm__copy_memory(map->strings.slots, pool.slots, slots_size);
+
+  if (parser->is_reloadable) {
+    ptm_reload_cache* cache = (ptm_reload_cache*)PTM_APUSH(arena, sizeof *cache);
+    ptm__zero_memory(cache, sizeof *cache);
+    cache->brush_sources = (ptm_brush_source*)PTM_APUSH(arena, brush_source_count * (int)sizeof(ptm_brush_source));
+    cache->brush_source_count = brush_source_count;
+    ptm__copy_memory(cache->brush_sources, parser->brush_sources, brush_source_count * (int)sizeof(ptm_brush_source));
+    map->reload_cache = cache;
+  }
+
+  PTM_AFREE(parser->pool_arena);
+
+  for (ptm_entity_class* c = map->entity_classes; c != NULL; c = c->next) {
+    c->entity_array = (ptm_entity**)PTM_APUSH(arena, c->entity_count * (int)sizeof(ptm_entity*));
+    int entity_index = 0;
+
+    for (ptm_entity* entity = c->entities; entity != NULL; entity = entity->next) {
+      c->entity_array[entity_index++] = entity;
+    }
+  }
+
+  // Only after everything is parsed is worldspawn stable:
+  // now we can create the meshes for it and every other entity
+  int high_water_mark = 0;
+
+  if (options != NULL && options->defer_meshes) {
+    // Later builds only see the options that meshing needs
+    ptm_deferred_meshes* deferred = (ptm_deferred_meshes*)PTM_APUSH(arena, sizeof *deferred);
+    ptm__zero_memory(deferred, sizeof *deferred);
+    deferred->options = *options;
+    deferred->options.reloadable = 0;
+    deferred->options.on_entity = NULL;
+    ptm__init_lock(deferred);
+    map->deferred_meshes = deferred;
+
+    // Collision comes from the world's clipped brushes: it can't wait
+    if (options->collision) {
+      ptm_entity* world = &map->world;
+      PTM_PROFILE_BEGIN("mesh");
+      high_water_mark = ptm__mesh_entities(map, &world, 1, &deferred->options, NULL, arena, &map->load_stats);
+      world->is_meshed = 1;
+      PTM_PROFILE_END("mesh");
+    }
+  }
+  else {
+    PTM_PROFILE_BEGIN("mesh");
+    high_water_mark = ptm__create_meshes(map, options, parser->old_map);
+    PTM_PROFILE_END("mesh");
+  }
+
+  if (options != NULL && options->flatten) {
+    map->flat = ptm__flatten_map(map);
+  }
+
+  PTM_ASTATS(arena, &map->arena_stats);
+
+  if (map->arena_stats.high_water_mark < high_water_mark) {
+    map->arena_stats.high_water_mark = high_water_mark;
+  }
 
   // We finished parsing the map: return final structure
   return map;
 }
 
 void ptm_free(ptm_map* map) {
-  PTM_AFREE(map->arena);
-}
-
-#ifndef PTM_NO_STDIO
-#include <stdio.h>
-ptm_map* ptm_load(const char* file_path) {
-  FILE* file; 
-#if defined(_MSC_VER) && _MSC_VER >= 1400
-  fopen_s(&file, file_path, "r");
+#ifndef PTM_NO_MMAP
+  // Only maps from ptm_load_binary have no arena: they're the file mapping
+  if (map->arena == NULL) {
+    ptm_binary_header* header = (ptm_binary_header*)((char*)map - ptm__get_binary_header_size());
+#if defined(_WIN32)
+    UnmapViewOfFile(header);
 #else
-  file = fopen(file_path, "r");
+    munmap(header, (size_t)header->size);
 #endif
-  fseek(file, 0, SEEK_END);
-  int source_length = ftell(file);
-  fseek(file, 0, SEEK_SET);
-  void* arena = PTM_ACREATE(source_length);
-  char* source = (char*)PTM_APUSH(arena, source_length);
-  source_length = fread(source, 1, source_length, file);
-  fclose(file);
-  ptm_map* map = ptm_load_source(source, source_length);
-  PTM_AFREE(arena);
-  return map;
-}
+    return;
+  }
 #endif
+  ptm_deferred_meshes* deferred = map->deferred_meshes;
 
-// === MEMORY ===
+  if (deferred != NULL) {
+    ptm__free_lock(deferred);
 
-static void* ptm__arena_create(int capacity) {
-  ptm_arena* arena = (ptm_arena*)malloc(sizeof *arena);
-  arena->data = (char*)malloc(capacity);
-  arena->capacity = capacity;
-  arena->head = 0;
-  return arena;
-}
+    // Each node is in the arena it points to
+    for (ptm_mesh_arena* node = deferred->arenas; node != NULL;) {
+      ptm_mesh_arena* next = node->next;
+      PTM_AFREE(node->arena);
+      node = next;
+    }
+  }
 
-static void* ptm__arena_push(void* opaque_arena, int bytes) {
-  ptm_arena* arena = (ptm_arena*)opaque_arena;
-  PTM_ASSERT(arena->head + bytes <= arena->capacity);
-  void* result = arena->data + arena->head;
-  arena->head += bytes;
-  return result;
+  PTM_AFREE(map->arena);
 }
 
-static void ptm__arena_free(void* opaque_arena) {
-  ptm_arena* arena = (ptm_arena*)opaque_arena;
-  free(arena->data);
-  free(arena);
-}
+ptm_mesh* ptm_entity_get_meshes(ptm_map* map, ptm_entity* entity) {
+  ptm_deferred_meshes* deferred = map->deferred_meshes;
 
-// === MATH ===
+  // Everything was meshed while loading (or comes from a binary cache)
+  if (deferred == NULL) {
+    return entity->meshes;
+  }
 
-static void ptm__subtract_vec3(const float* a, const float* b, float* r) {
-  r[0] = a[0] - b[0];
-  r[1] = a[1] - b[1];
-  r[2] = a[2] - b[2];
+  ptm__lock(deferred);
+
+  while (entity->is_meshed == 2) {
+    ptm__wait_built(deferred);
+  }
+
+  if (entity->is_meshed) {
+    ptm__unlock(deferred);
+    return entity->meshes;
+  }
+
+  entity->is_meshed = 2;
+  ptm__unlock(deferred);
+
+  // Each build gets its own arena, so builds never share an allocator
+  void* arena = PTM_ACREATE(64 * 1024);
+  ptm_load_stats stats;
+  ptm__zero_memory(&stats, sizeof stats);
+  ptm__mesh_entities(map, &entity, 1, &deferred->options, NULL, arena, &stats);
+  ptm_mesh_arena* node = (ptm_mesh_arena*)PTM_APUSH(arena, sizeof *node);
+  node->arena = arena;
+
+  ptm__lock(deferred);
+  ptm__add_load_stats(&map->load_stats, &stats);
+  node->next = deferred->arenas;
+  deferred->arenas = node;
+  entity->is_meshed = 1;
+  ptm__wake_built(deferred);
+  ptm__unlock(deferred);
+  return entity->meshes;
 }
 
-static float ptm__dot_vec3(const float* a, const float* b) {
-  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+ptm_string ptm_find_string(const ptm_map* map, const char* data, int length) {
+  PTM_HASH hash = PTM_CREATE_HASH(data, length);
+  return *ptm__find_string_slot(&map->strings, data, length, hash);
 }
 
-static void ptm__cross_vec3(const float* a, const float* b, float* r) {
-  r[0] = a[1] * b[2] - a[2] * b[1];
-  r[1] = a[2] * b[0] - a[0] * b[2];
-  r[2] = a[0] * b[1] - a[1] * b[0];
+ptm_property* ptm_find_property(const ptm_entity* entity, ptm_string key) {
+  if (entity->property_slot_count == 0 || key.data == NULL) {
+    return NULL;
+  }
+
+  return *ptm__find_property_slot(entity->property_slots, entity->property_slot_count, key);
 }
 
-// === UTIL ===
+int ptm_property_float(ptm_property* property, PTM_REAL* value) {
+  if (property == NULL) {
+    return 0;
+  }
 
-static PTM_REAL ptm__strtor(const char* start, const char** end) {
-  #if PTM_REAL == double
-    return strtod(start, (char**)end);
-  #elif PTM_REAL == float
-    return strtof(start, (char**)end);
-  #else
-    #error Value of PTM_REAL has no default implementation.
-  #endif
+  ptm__decode_property(property);
+
+  if (property->number_count < 1) {
+    return 0;
+  }
+
+  *value = property->numbers[0];
+  return 1;
 }
 
-static PTM_HASH ptm__create_hash_fnv32(const char* data, int size) {
-  unsigned int hash = 2166136261u;
+int ptm_property_vec3(ptm_property* property, PTM_REAL* value) {
+  if (property == NULL) {
+    return 0;
+  }
 
-  for (int i = 0; i < size; i++) {
-    hash ^= *data++;
-    hash *= 16777619u;
+  ptm__decode_property(property);
+
+  if (property->number_count < 3) {
+    return 0;
   }
 
-  return hash;
+  value[0] = property->numbers[0];
+  value[1] = property->numbers[1];
+  value[2] = property->numbers[2];
+  return 1;
 }
 
-static void ptm__copy_memory(void* dest, const void* src, int bytes) {
-  char* d = (char*)dest;
-  const char* s = (const char*)src;
+ptm_vertex_layout ptm_get_vertex_layout(int vertex_format, int vertex_stride) {
+  ptm_vertex_layout layout;
+  layout.position_offset = 0;
+  layout.texcoord_offset = layout.position_offset + 3 * (int)sizeof(float);
+  layout.normal_offset = layout.texcoord_offset + ((vertex_format & PTM_VERTEX_HALF_TEXCOORDS) ? 2 * 2 : 2 * (int)sizeof(float));
+  layout.tangent_offset = layout.normal_offset + ((vertex_format & PTM_VERTEX_OCT_NORMALS) ? 2 * 2 : 3 * (int)sizeof(float));
+  layout.stride = layout.tangent_offset + ((vertex_format & PTM_VERTEX_OCT_NORMALS) ? 4 : 4 * (int)sizeof(float));
 
-  for (int i = 0; i < bytes; i++)
-    d[i] = s[i];
+  if (vertex_stride > layout.stride) {
+    layout.stride = (vertex_stride + 3) & ~3;
+  }
+
+  return layout;
 }
 
-static void ptm__zero_memory(void* dest, int bytes) {
-  char* d = (char*)dest;
+void ptm_write_vertices(const ptm_mesh* mesh, int vertex_format, int vertex_stride, void* vertices) {
+  ptm_vertex_layout layout = ptm_get_vertex_layout(vertex_format, vertex_stride);
+  int padding_offset = ptm_get_vertex_layout(vertex_format, 0).stride;
+  unsigned char* vertex = (unsigned char*)vertices;
 
-  for (int i = 0; i < bytes; i++)
-    d[i] = 0;
+  // Every attribute is built on the stack and copied in whole, so the
+  // destination is only ever written in order
+  for (int i = 0; i < mesh->vertex_count; i++, vertex += layout.stride) {
+    const PTM_REAL* position = &mesh->vertex_positions[i * 3];
+    const PTM_REAL* texcoord = &mesh->vertex_texcoords[i * 2];
+    const PTM_REAL* normal = &mesh->vertex_normals[i * 3];
+    const PTM_REAL* tangent = &mesh->vertex_tangents[i * 4];
+
+    float floats[4] = { (float)position[0], (float)position[1], (float)position[2], 0 };
+    ptm__copy_memory(vertex + layout.position_offset, floats, 3 * sizeof(float));
+
+    if (vertex_format & PTM_VERTEX_HALF_TEXCOORDS) {
+      unsigned short halves[2] = { ptm__float_to_half((float)texcoord[0]), ptm__float_to_half((float)texcoord[1]) };
+      ptm__copy_memory(vertex + layout.texcoord_offset, halves, sizeof halves);
+    }
+    else {
+      floats[0] = (float)texcoord[0];
+      floats[1] = (float)texcoord[1];
+      ptm__copy_memory(vertex + layout.texcoord_offset, floats, 2 * sizeof(float));
+    }
+
+    if (vertex_format & PTM_VERTEX_OCT_NORMALS) {
+      PTM_REAL encoded[2];
+      ptm__encode_octahedral(normal, encoded);
+      short shorts[2] = { (short)ptm__to_snorm(encoded[0], 32767), (short)ptm__to_snorm(encoded[1], 32767) };
+      ptm__copy_memory(vertex + layout.normal_offset, shorts, sizeof shorts);
+
+      ptm__encode_octahedral(tangent, encoded);
+      signed char bytes[4] = { (signed char)ptm__to_snorm(encoded[0], 127), (signed char)ptm__to_snorm(encoded[1], 127), (signed char)(tangent[3] < 0 ? -127 : 127), 0 };
+      ptm__copy_memory(vertex + layout.tangent_offset, bytes, sizeof bytes);
+    }
+    else {
+      floats[0] = (float)normal[0];
+      floats[1] = (float)normal[1];
+      floats[2] = (float)normal[2];
+      ptm__copy_memory(vertex + layout.normal_offset, floats, 3 * sizeof(float));
+
+      floats[0] = (float)tangent[0];
+      floats[1] = (float)tangent[1];
+      floats[2] = (float)tangent[2];
+      floats[3] = (float)tangent[3];
+      ptm__copy_memory(vertex + layout.tangent_offset, floats, 4 * sizeof(float));
+    }
+
+    // Padding is zeroed, so the same mesh always writes the same bytes
+    if (layout.stride > padding_offset) {
+      ptm__zero_memory(vertex + padding_offset, layout.stride - padding_offset);
+    }
+  }
 }
 
-// === PARSING ===
+int ptm_trace_ray(const ptm_collision* collision, const PTM_REAL* start, const PTM_REAL* end, ptm_trace* trace) {
+  ptm__zero_memory(trace, sizeof *trace);
+  trace->fraction = 1;
+  trace->brush = -1;
 
-static void ptm__consume_until_at(const char** head, char value) {
-  while (**head != value)
-    (*head)++;
+  if (collision->node_count == 0) {
+    return 0;
+  }
+
+  PTM_REAL direction[3];
+  ptm__subtract_vec3(end, start, direction);
+
+  // Depth-first, with the first child on top. Leaves only hold a few
+  // brushes, so the hierarchy is never deeper than there are bits.
+  int stack[64];
+  int stack_count = 0;
+  stack[stack_count++] = 0;
+
+  while (stack_count > 0) {
+    const ptm_collision_node* node = &collision->nodes[stack[--stack_count]];
+
+    // Nothing past the closest hit so far can be hit first
+    if (!ptm__is_segment_in_bounds(node->bounds_min, node->bounds_max, start, direction, trace->fraction)) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      for (int i = 0; i < node->count; i++) {
+        ptm__trace_brush(collision, node->first + i, start, end, trace);
+      }
+    }
+    else {
+      stack[stack_count++] = node->first;
+      stack[stack_count++] = (int)(node - collision->nodes) + 1;
+    }
+  }
+
+  return trace->brush != -1;
 }
 
-static void ptm__consume_until_after(const char** head, char value) {
-  ptm__consume_until_at(head, value);
-  (*head)++;
+int ptm_find_brush_at_point(const ptm_collision* collision, const PTM_REAL* point) {
+  int stack[64];
+  int stack_count = 0;
+
+  if (collision->node_count > 0) {
+    stack[stack_count++] = 0;
+  }
+
+  while (stack_count > 0) {
+    const ptm_collision_node* node = &collision->nodes[stack[--stack_count]];
+
+    if (!ptm__is_box_overlapping(node->bounds_min, node->bounds_max, point, point)) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      for (int i = 0; i < node->count; i++) {
+        if (ptm__is_point_in_brush(collision, node->first + i, point)) {
+          return node->first + i;
+        }
+      }
+    }
+    else {
+      stack[stack_count++] = node->first;
+      stack[stack_count++] = (int)(node - collision->nodes) + 1;
+    }
+  }
+
+  return -1;
 }
 
-static void ptm__consume_whitespace(const char** head) {
-  while (**head == ' ')
-    (*head)++;
+int ptm_find_brushes_in_box(const ptm_collision* collision, const PTM_REAL* min, const PTM_REAL* max, int* brushes, int capacity) {
+  int stack[64];
+  int stack_count = 0;
+  int count = 0;
+
+  if (collision->node_count > 0) {
+    stack[stack_count++] = 0;
+  }
+
+  while (stack_count > 0) {
+    const ptm_collision_node* node = &collision->nodes[stack[--stack_count]];
+
+    if (!ptm__is_box_overlapping(node->bounds_min, node->bounds_max, min, max)) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      for (int i = 0; i < node->count; i++) {
+        if (ptm__is_box_in_brush(collision, node->first + i, min, max)) {
+          if (count < capacity) {
+            brushes[count] = node->first + i;
+          }
+
+          count++;
+        }
+      }
+    }
+    else {
+      stack[stack_count++] = node->first;
+      stack[stack_count++] = (int)(node - collision->nodes) + 1;
+    }
+  }
+
+  return count;
 }
 
-static PTM_REAL ptm__consume_number(const char** head) {
-  const char* end;
-  const char* start = *head;
-  PTM_REAL value = PTM_STRTOR(start, &end);
-  *head = end;
-  return value;
-} 
+unsigned long long ptm_hash_source(const char* source, int source_length) {
+  // 64 bit FNV-1a: the cache key only has to tell sources apart
+  unsigned long long hash = 14695981039346656037ull;
 
-static ptm_string ptm__consume_string(const char** head, char delimiter, ptm_cached_string** cache, void* arena) {
-  // Parse a string between delimiters at head
-  ptm__consume_until_after(head, delimiter);
-  const char* start = *head;
-  ptm__consume_until_at(head, delimiter);
-  const char* end = *head;
-  (*head)++;
-  int length = (intptr_t)end - (intptr_t)start;
-  PTM_HASH hash = PTM_CREATE_HASH(start, length);
+  for (int i = 0; i < source_length; i++) {
+    hash ^= (unsigned char)source[i];
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
 
-  // Check for a cache hit as an early-out
-  ptm_cached_string* string = *cache;
+int ptm_write_binary(ptm_map* map, unsigned long long source_hash, void* buffer, int buffer_size) {
+  // Binary maps can't build meshes later, so deferred ones are all 
+  // built now (waiting for any other thread building one to finish)
+  if (map->deferred_meshes != NULL) {
+    ptm_entity_get_meshes(map, &map->world);
 
-  while (string != NULL) {
-    if (string->content.hash == hash) {
-      return string->content;
+    for (ptm_entity_class* c = map->entity_classes; c != NULL; c = c->next) {
+      for (int i = 0; i < c->entity_count; i++) {
+        ptm_entity_get_meshes(map, c->entity_array[i]);
+      }
     }
-    string = string->next;
   }
 
-  // Allocate new string from parsed value
-  char* data = (char*)PTM_APUSH(arena, length + 1);
-  ptm__copy_memory(data, start, length);
-  data[length] = '\0';
+  // Measure first: the same walk without data only counts the bytes
+  // and relocations, then it's repeated into the buffer if it fits.
+  int entity_count = 1;
+
+  for (ptm_entity_class* c = map->entity_classes; c != NULL; c = c->next) {
+    entity_count += c->entity_count;
+  }
+
+  int string_offsets_size = map->strings.slot_count * (int)sizeof(int);
+  int entity_offsets_size = entity_count * (int)sizeof(int);
+  void* scratch = PTM_ACREATE(string_offsets_size + entity_offsets_size);
+  int* entity_offsets = (int*)PTM_APUSH(scratch, entity_offsets_size);
+
+  ptm_binary_writer writer = {0};
+  writer.strings = &map->strings;
+  writer.string_offsets = (int*)PTM_APUSH(scratch, string_offsets_size);
+  ptm__write_binary_map(&writer, map, entity_offsets);
+
+  int relocation_offset = (writer.size + (int)sizeof(int) - 1) & ~((int)sizeof(int) - 1);
+  int relocation_count = writer.relocation_count;
+  int size = relocation_offset + relocation_count * (int)sizeof(int);
+
+  if (buffer != NULL && size <= buffer_size) {
+    writer.data = (char*)buffer;
+    writer.size = 0;
+    writer.relocations = (int*)(writer.data + relocation_offset);
+    writer.relocation_count = 0;
+    ptm__write_binary_map(&writer, map, entity_offsets);
+    ptm__zero_memory(writer.data + writer.size, relocation_offset - writer.size);
+    PTM_ASSERT(writer.relocation_count == relocation_count);
 
-  // Add new string to cache
-  ptm_cached_string* new_string;
-  new_string = (ptm_cached_string*)PTM_APUSH(arena, sizeof *new_string);
-  new_string->content.hash = hash;
-  new_string->content.data = data;
-  new_string->next = *cache;
-  *cache = new_string;
+    ptm_binary_header* header = (ptm_binary_header*)writer.data;
+    ptm__copy_memory(header->magic, "PTMB", 4);
+    header->version = PTM__BINARY_VERSION;
+    header->layout = ptm__get_binary_layout();
+    header->size = size;
+    header->map_offset = ptm__get_binary_header_size();
+    header->relocation_offset = relocation_offset;
+    header->relocation_count = relocation_count;
+    header->source_hash = source_hash;
+  }
 
-  return new_string->content;
+  PTM_AFREE(scratch);
+  return size;
 }
 
-// === MESHING ===
+ptm_map* ptm_load_binary_source(const void* binary, int binary_size, unsigned long long source_hash) {
+  // Copied into an arena of its own, so the map is freed like any other.
+  // The push is rounded up so the arena aligns it for anything.
+  void* arena = PTM_ACREATE(binary_size);
+  char* data = (char*)PTM_APUSH(arena, (binary_size + PTM_ARENA_ALIGNMENT - 1) & ~(PTM_ARENA_ALIGNMENT - 1));
+  ptm__copy_memory(data, binary, binary_size);
+  ptm_map* map = ptm__relocate_binary(data, binary_size, source_hash);
 
-static ptm_mesh* ptm__create_meshes(ptm_brush* brushes, void* arena) {
-  return NULL;
+  if (map == NULL) {
+    PTM_AFREE(arena);
+    return NULL;
+  }
+
+  map->arena = arena;
+  PTM_ASTATS(arena, &map->arena_stats);
+  return map;
+}
+
+#ifndef PTM_NO_STDIO
+#include <stdio.h>
+ptm_map* ptm_load(const char* file_path) {
+  return ptm_load_ex(file_path, NULL);
+}
+
+ptm_map* ptm_load_ex(const char* file_path, const ptm_load_options* options) {
+  // Binary mode: in text mode, windows translates line endings
+  // and ftell no longer matches what fread returns.
+  FILE* file = NULL; 
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+  fopen_s(&file, file_path, "rb");
+#else
+  file = fopen(file_path, "rb");
+#endif
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  int source_length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  void* arena = PTM_ACREATE(source_length);
+  char* source = (char*)PTM_APUSH(arena, source_length);
+  source_length = fread(source, 1, source_length, file);
+  fclose(file);
+  ptm_map* map = ptm_load_source_ex(source, source_length, options);
+
+  // The file contents were alive for the whole load, too
+  map->arena_stats.high_water_mark += ptm__arena_reserved(arena);
+  PTM_AFREE(arena);
+  return map;
+}
+
+int ptm_save_binary(ptm_map* map, unsigned long long source_hash, const char* file_path) {
+  int size = ptm_write_binary(map, source_hash, NULL, 0);
+  void* arena = PTM_ACREATE(size);
+  void* binary = PTM_APUSH(arena, size);
+  ptm_write_binary(map, source_hash, binary, size);
+
+  FILE* file = NULL; 
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+  fopen_s(&file, file_path, "wb");
+#else
+  file = fopen(file_path, "wb");
+#endif
+  int is_saved = 0;
+
+  if (file != NULL) {
+    is_saved = fwrite(binary, 1, size, file) == (size_t)size;
+    is_saved = fclose(file) == 0 && is_saved;
+  }
+
+  PTM_AFREE(arena);
+  return is_saved;
+}
+#endif
+
+#ifndef PTM_NO_MMAP
+ptm_map* ptm_load_mapped(const char* file_path) {
+  return ptm_load_mapped_ex(file_path, NULL);
+}
+
+ptm_map* ptm_load_mapped_ex(const char* file_path, const ptm_load_options* options) {
+  // Parse straight out of the file mapping: the source is never copied, 
+  // and the OS can page it in (and drop it) as the parser moves along.
+  ptm_map* map = NULL;
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart > 0x7fffffff) {
+    CloseHandle(file);
+    return NULL;
+  }
+
+  // Windows can't map an empty file
+  if (size.QuadPart == 0) {
+    CloseHandle(file);
+    return ptm_load_source_ex("", 0, options);
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping != NULL) {
+    const char* source = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (source != NULL) {
+      map = ptm_load_source_ex(source, (int)size.QuadPart, options);
+      UnmapViewOfFile(source);
+    }
+    CloseHandle(mapping);
+  }
+  CloseHandle(file);
+#else
+  int file = open(file_path, O_RDONLY);
+  if (file < 0) {
+    return NULL;
+  }
+
+  struct stat info;
+  if (fstat(file, &info) != 0 || info.st_size > 0x7fffffff) {
+    close(file);
+    return NULL;
+  }
+
+  // mmap can't map an empty file
+  if (info.st_size == 0) {
+    close(file);
+    return ptm_load_source_ex("", 0, options);
+  }
+
+  void* source = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+
+  if (source != MAP_FAILED) {
+    // We read it front to back exactly once
+    // (madvise is only a hint, and strict modes may hide it)
+#ifdef MADV_SEQUENTIAL
+    madvise(source, (size_t)info.st_size, MADV_SEQUENTIAL);
+#endif
+    map = ptm_load_source_ex((const char*)source, (int)info.st_size, options);
+    munmap(source, (size_t)info.st_size);
+  }
+#endif
+  return map;
+}
+
+ptm_map* ptm_load_binary(const char* file_path, unsigned long long source_hash) {
+  // Copy-on-write: only the pages with pointers in them get copied
+  // by the fixup, the vertex data stays shared with the page cache.
+  char* binary = NULL;
+  int size = 0;
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0 || file_size.QuadPart > 0x7fffffff) {
+    CloseHandle(file);
+    return NULL;
+  }
+
+  // The view keeps the mapping alive after its handle is closed
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  if (mapping != NULL) {
+    binary = (char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+  }
+  CloseHandle(file);
+  size = (int)file_size.QuadPart;
+#else
+  int file = open(file_path, O_RDONLY);
+  if (file < 0) {
+    return NULL;
+  }
+
+  struct stat info;
+  if (fstat(file, &info) != 0 || info.st_size == 0 || info.st_size > 0x7fffffff) {
+    close(file);
+    return NULL;
+  }
+
+  binary = (char*)mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+  close(file);
+  binary = binary != MAP_FAILED ? binary : NULL;
+  size = (int)info.st_size;
+#endif
+  if (binary == NULL) {
+    return NULL;
+  }
+
+  ptm_map* map = ptm__relocate_binary(binary, size, source_hash);
+
+  if (map == NULL) {
+#if defined(_WIN32)
+    UnmapViewOfFile(binary);
+#else
+    munmap(binary, (size_t)size);
+#endif
+    return NULL;
+  }
+
+  // No arena: ptm_free unmaps the file instead
+  map->arena = NULL;
+  ptm__zero_memory(&map->arena_stats, sizeof map->arena_stats);
+  map->arena_stats.bytes_used = size;
+  map->arena_stats.bytes_reserved = size;
+  map->arena_stats.block_count = 1;
+  map->arena_stats.high_water_mark = size;
+  return map;
+}
+#endif
+
+// === MEMORY ===
+
+static void* ptm__arena_create(int capacity) {
+  ptm_arena* arena = (ptm_arena*)malloc(sizeof *arena);
+  ptm__zero_memory(arena, sizeof *arena);
+
+  // The capacity is only a hint for the first block: leave 
+  // a little room for padding, it's usually exact otherwise.
+  ptm__arena_add_block(arena, capacity + PTM_ARENA_ALIGNMENT * 4);
+  return arena;
+}
+
+static void* ptm__arena_push(void* opaque_arena, int bytes) {
+  ptm_arena* arena = (ptm_arena*)opaque_arena;
+
+  // Any array of T has a size that's a multiple of T's alignment, so the
+  // lowest set bit of the size is always enough alignment (and strings
+  // don't get padded at all).
+  int alignment = bytes & -bytes;
+
+  if (alignment == 0 || alignment > PTM_ARENA_ALIGNMENT) {
+    alignment = PTM_ARENA_ALIGNMENT;
+  }
+
+  ptm_arena_block* block = arena->blocks;
+  int head = (block->head + alignment - 1) & ~(alignment - 1);
+
+  if (head + bytes > block->capacity) {
+    // New blocks grow with the arena, but only by a fraction of it:
+    // the empty end of the last block is wasted, so this keeps it small.
+    int next_capacity = arena->bytes_reserved / 8;
+
+    if (next_capacity < 4096) {
+      next_capacity = 4096;
+    }
+
+    // Big allocations (like mesh buffers) get a block that fits them exactly,
+    // kept behind the current one so its free space isn't thrown away.
+    // Small ones move on to a new block.
+    if (bytes > next_capacity / 2) {
+      ptm_arena_block* current = arena->blocks;
+      block = ptm__arena_add_block(arena, bytes);
+      arena->blocks = current;
+      block->next = current->next;
+      current->next = block;
+    }
+    else {
+      block = ptm__arena_add_block(arena, next_capacity);
+    }
+
+    head = 0;
+  }
+
+  void* result = (char*)block + ptm__arena_header_size() + head;
+  arena->bytes_used += head + bytes - block->head;
+  block->head = head + bytes;
+  return result;
+}
+
+static void ptm__arena_free(void* opaque_arena) {
+  ptm_arena* arena = (ptm_arena*)opaque_arena;
+  ptm_arena_block* block = arena->blocks;
+
+  while (block != NULL) {
+    ptm_arena_block* next = block->next;
+    free(block);
+    block = next;
+  }
+
+  free(arena);
+}
+
+static void ptm__arena_stats(void* opaque_arena, ptm_arena_stats* stats) {
+  ptm_arena* arena = (ptm_arena*)opaque_arena;
+  stats->bytes_used = arena->bytes_used;
+  stats->bytes_reserved = arena->bytes_reserved;
+  stats->bytes_wasted = arena->bytes_reserved - arena->bytes_used;
+  stats->block_count = arena->block_count;
+  stats->high_water_mark = arena->bytes_reserved;
+}
+
+static ptm_arena_block* ptm__arena_add_block(ptm_arena* arena, int capacity) {
+  ptm_arena_block* block = (ptm_arena_block*)malloc(ptm__arena_header_size() + capacity);
+  PTM_ASSERT(block != NULL);
+  block->next = arena->blocks;
+  block->head = 0;
+  block->capacity = capacity;
+  arena->blocks = block;
+  arena->bytes_reserved += capacity;
+  arena->block_count++;
+  return block;
+}
+
+static int ptm__arena_header_size(void) {
+  // The data follows the block header, aligned for anything
+  int header_size = (int)sizeof(ptm_arena_block);
+  return (header_size + PTM_ARENA_ALIGNMENT - 1) & ~(PTM_ARENA_ALIGNMENT - 1);
+}
+
+static int ptm__arena_reserved(void* arena) {
+  ptm_arena_stats stats;
+  PTM_ASTATS(arena, &stats);
+  return stats.bytes_reserved;
+}
+
+// === MATH ===
+
+static void ptm__subtract_vec3(const PTM_REAL* a, const PTM_REAL* b, PTM_REAL* r) {
+  r[0] = a[0] - b[0];
+  r[1] = a[1] - b[1];
+  r[2] = a[2] - b[2];
+}
+
+static PTM_REAL ptm__dot_vec3(const PTM_REAL* a, const PTM_REAL* b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void ptm__cross_vec3(const PTM_REAL* a, const PTM_REAL* b, PTM_REAL* r) {
+  r[0] = a[1] * b[2] - a[2] * b[1];
+  r[1] = a[2] * b[0] - a[0] * b[2];
+  r[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static void ptm__normalize_vec3(const PTM_REAL* a, PTM_REAL* r) {
+  PTM_REAL length = PTM_SQRTR(ptm__dot_vec3(a, a));
+  PTM_REAL scale = length > 0 ? 1 / length : 0;
+  r[0] = a[0] * scale;
+  r[1] = a[1] * scale;
+  r[2] = a[2] * scale;
+}
+
+static void ptm__create_plane(PTM_REAL points[3][3], PTM_REAL* normal, PTM_REAL* c) {
+  // In double precision: points are often far from the origin, and a 
+  // float cross product of them keeps few of its bits. The plane is 
+  // normalized here, so distances from it are in world units.
+  double a[3];
+  double b[3];
+
+  for (int i = 0; i < 3; i++) {
+    a[i] = (double)points[0][i] - (double)points[1][i];
+    b[i] = (double)points[0][i] - (double)points[2][i];
+  }
+
+  double n[3] = {
+    a[1] * b[2] - a[2] * b[1],
+    a[2] * b[0] - a[0] * b[2],
+    a[0] * b[1] - a[1] * b[0],
+  };
+
+  // PTM_SQRTR may only be single precision: one Newton step brings 
+  // its result back up to double.
+  double length_squared = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+  double length = (double)PTM_SQRTR((PTM_REAL)length_squared);
+
+  if (length <= 0) {
+    normal[0] = normal[1] = normal[2] = 0;
+    *c = 0;
+    return;
+  }
+
+  length = 0.5 * (length + length_squared / length);
+
+  for (int i = 0; i < 3; i++) {
+    n[i] /= length;
+    normal[i] = (PTM_REAL)n[i];
+  }
+
+  *c = (PTM_REAL)(n[0] * points[0][0] + n[1] * points[0][1] + n[2] * points[0][2]);
+}
+
+static PTM_REAL ptm__round_real(PTM_REAL value) {
+  // Only used inside the world, so this can't overflow
+  return (PTM_REAL)(long long)(value < 0 ? value - (PTM_REAL)0.5 : value + (PTM_REAL)0.5);
+}
+
+// === THREADS ===
+
+#ifndef PTM_NO_THREADS
+#if defined(_WIN32)
+static DWORD WINAPI ptm__thread_main(LPVOID stripe) {
+  ptm__run_job_stripe((ptm_job_stripe*)stripe);
+  return 0;
+}
+#else
+static void* ptm__thread_main(void* stripe) {
+  ptm__run_job_stripe((ptm_job_stripe*)stripe);
+  return NULL;
+}
+#endif
+#endif
+
+static void ptm__run_jobs(ptm_job_function* function, void** jobs, int job_count, int thread_count) {
+#ifdef PTM_NO_THREADS
+  thread_count = 1;
+#endif
+  if (thread_count > job_count) {
+    thread_count = job_count;
+  }
+  if (thread_count < 1) {
+    thread_count = 1;
+  }
+  if (thread_count > 64) {
+    thread_count = 64;
+  }
+
+  // Each thread takes every n-th job: the jobs are already split up evenly,
+  // so this is good enough without needing any synchronization.
+  void* arena = PTM_ACREATE(thread_count * (int)sizeof(ptm_job_stripe));
+  ptm_job_stripe* stripes = (ptm_job_stripe*)PTM_APUSH(arena, thread_count * (int)sizeof(ptm_job_stripe));
+
+  for (int i = 0; i < thread_count; i++) {
+    stripes[i].function = function;
+    stripes[i].jobs = jobs;
+    stripes[i].job_count = job_count;
+    stripes[i].first = i;
+    stripes[i].stride = thread_count;
+  }
+
+#ifndef PTM_NO_THREADS
+#if defined(_WIN32)
+  HANDLE threads[64];
+#else
+  pthread_t threads[64];
+#endif
+  int spawned_count = 0;
+
+  // The calling thread works too, so we only need to spawn the rest
+  for (int i = 1; i < thread_count; i++) {
+#if defined(_WIN32)
+    threads[spawned_count] = CreateThread(NULL, 0, ptm__thread_main, &stripes[i], 0, NULL);
+    int did_spawn = threads[spawned_count] != NULL;
+#else
+    int did_spawn = pthread_create(&threads[spawned_count], NULL, ptm__thread_main, &stripes[i]) == 0;
+#endif
+    // If we can't get a thread, just do its work ourselves
+    if (did_spawn) spawned_count++;
+    else ptm__run_job_stripe(&stripes[i]);
+  }
+#endif
+
+  ptm__run_job_stripe(&stripes[0]);
+
+#ifndef PTM_NO_THREADS
+  for (int i = 0; i < spawned_count; i++) {
+#if defined(_WIN32)
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+#else
+    pthread_join(threads[i], NULL);
+#endif
+  }
+#endif
+
+  PTM_AFREE(arena);
+}
+
+static void ptm__run_job_stripe(ptm_job_stripe* stripe) {
+  for (int i = stripe->first; i < stripe->job_count; i += stripe->stride) {
+    stripe->function(stripe->jobs[i]);
+  }
+}
+
+// Without threads, nothing can be built at the same time: no locking
+static void ptm__init_lock(ptm_deferred_meshes* deferred) {
+#ifndef PTM_NO_THREADS
+#if defined(_WIN32)
+  InitializeSRWLock(&deferred->lock);
+  InitializeConditionVariable(&deferred->built);
+#else
+  pthread_mutex_init(&deferred->lock, NULL);
+  pthread_cond_init(&deferred->built, NULL);
+#endif
+#endif
+  (void)deferred;
+}
+
+static void ptm__free_lock(ptm_deferred_meshes* deferred) {
+#if !defined(PTM_NO_THREADS) && !defined(_WIN32)
+  pthread_cond_destroy(&deferred->built);
+  pthread_mutex_destroy(&deferred->lock);
+#endif
+  (void)deferred;
+}
+
+static void ptm__lock(ptm_deferred_meshes* deferred) {
+#ifndef PTM_NO_THREADS
+#if defined(_WIN32)
+  AcquireSRWLockExclusive(&deferred->lock);
+#else
+  pthread_mutex_lock(&deferred->lock);
+#endif
+#endif
+  (void)deferred;
+}
+
+static void ptm__unlock(ptm_deferred_meshes* deferred) {
+#ifndef PTM_NO_THREADS
+#if defined(_WIN32)
+  ReleaseSRWLockExclusive(&deferred->lock);
+#else
+  pthread_mutex_unlock(&deferred->lock);
+#endif
+#endif
+  (void)deferred;
+}
+
+static void ptm__wait_built(ptm_deferred_meshes* deferred) {
+#ifndef PTM_NO_THREADS
+#if defined(_WIN32)
+  SleepConditionVariableSRW(&deferred->built, &deferred->lock, INFINITE, 0);
+#else
+  pthread_cond_wait(&deferred->built, &deferred->lock);
+#endif
+#endif
+  (void)deferred;
+}
+
+static void ptm__wake_built(ptm_deferred_meshes* deferred) {
+#ifndef PTM_NO_THREADS
+#if defined(_WIN32)
+  WakeAllConditionVariable(&deferred->built);
+#else
+  pthread_cond_broadcast(&deferred->built);
+#endif
+#endif
+  (void)deferred;
+}
+
+// === UTIL ===
+
+static PTM_REAL ptm__strtor(const char* start, const char** end) {
+  // The preprocessor can't compare types, but sizeof can
+  if (sizeof(PTM_REAL) == sizeof(float)) {
+    return (PTM_REAL)strtof(start, (char**)end);
+  }
+  return (PTM_REAL)strtod(start, (char**)end);
+}
+
+static PTM_REAL ptm__strtor_fast(const char* start, const char** end) {
+  // Powers of ten that a double can represent exactly
+  static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+
+  const char* head = start;
+
+  while (*head == ' ' || *head == '\t') {
+    head++;
+  }
+
+  int is_negative = *head == '-';
+
+  if (*head == '-' || *head == '+') {
+    head++;
+  }
+
+  // Read every digit into one integer, and remember where the 
+  // decimal point was as a power of ten: "-12.5" is -125 * 10^-1
+  uint64_t mantissa = 0;
+  int digit_count = 0;
+  int exponent = 0;
+
+  while (*head >= '0' && *head <= '9') {
+    mantissa = mantissa * 10 + (uint64_t)(*head++ - '0');
+    digit_count++;
+  }
+
+  if (*head == '.') {
+    head++;
+
+    while (*head >= '0' && *head <= '9') {
+      mantissa = mantissa * 10 + (uint64_t)(*head++ - '0');
+      digit_count++;
+      exponent--;
+    }
+  }
+
+  if (*head == 'e' || *head == 'E') {
+    const char* exponent_head = head + 1;
+    int is_exponent_negative = *exponent_head == '-';
+    int value = 0;
+
+    if (*exponent_head == '-' || *exponent_head == '+') {
+      exponent_head++;
+    }
+
+    // Without digits, the 'e' isn't part of the number
+    if (*exponent_head >= '0' && *exponent_head <= '9') {
+      while (*exponent_head >= '0' && *exponent_head <= '9') {
+        if (value < 10000) value = value * 10 + (*exponent_head - '0');
+        exponent_head++;
+      }
+
+      exponent += is_exponent_negative ? -value : value;
+      head = exponent_head;
+    }
+  }
+
+  // Anything else .map files don't really contain (hex, inf, nan, 
+  // too many digits for an exact integer) goes to the slow path.
+  int is_odd = digit_count == 0 || digit_count > 19 || *head == 'x' || *head == 'X';
+
+  // When both the digits and the power of ten are exact doubles, one 
+  // multiply or divide rounds correctly.
+  if (is_odd || mantissa > ((uint64_t)1 << 53) || exponent < -22 || exponent > 22) {
+    return ptm__strtor(start, end);
+  }
+
+  double value = (double)mantissa;
+  value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+
+  // Converting to float rounds a second time, which is only wrong when
+  // the double landed exactly halfway between two floats: the 29 bits
+  // a float drops are a one and then zeros. Those few take the slow
+  // path. (Everything here is a normal float, so the 29 bits hold.)
+  if (sizeof(PTM_REAL) == sizeof(float)) {
+    uint64_t bits;
+    ptm__copy_memory(&bits, &value, sizeof(bits));
+
+    if ((bits & 0x1fffffff) == 0x10000000) {
+      return ptm__strtor(start, end);
+    }
+  }
+
+  *end = head;
+  return (PTM_REAL)(is_negative ? -value : value);
+}
+
+static PTM_HASH ptm__create_hash_fnv32(const char* data, int size) {
+  unsigned int hash = 2166136261u;
+
+  for (int i = 0; i < size; i++) {
+    hash ^= *data++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+static int ptm__compare_memory(const void* a, const void* b, int bytes) {
+  const char* x = (const char*)a;
+  const char* y = (const char*)b;
+
+  for (int i = 0; i < bytes; i++)
+    if (x[i] != y[i]) return 0;
+
+  return 1;
+}
+
+static int ptm__is_string(ptm_string string, const char* data, int length, PTM_HASH hash) {
+  return string.hash == hash && string.length == length && ptm__compare_memory(string.data, data, length);
+}
+
+static void ptm__copy_memory(void* dest, const void* src, int bytes) {
+  char* d = (char*)dest;
+  const char* s = (const char*)src;
+
+  for (int i = 0; i < bytes; i++)
+    d[i] = s[i];
+}
+
+static void ptm__zero_memory(void* dest, int bytes) {
+  char* d = (char*)dest;
+
+  for (int i = 0; i < bytes; i++)
+    d[i] = 0;
+}
+
+static void ptm__add_load_stats(ptm_load_stats* stats, const ptm_load_stats* other) {
+  stats->bytes_scanned += other->bytes_scanned;
+  stats->numbers_parsed += other->numbers_parsed;
+  stats->string_lookups += other->string_lookups;
+  stats->string_hits += other->string_hits;
+  stats->brushes_clipped += other->brushes_clipped;
+  stats->planes_clipped += other->planes_clipped;
+  stats->planes_skipped += other->planes_skipped;
+  stats->vertices_created += other->vertices_created;
+  stats->edges_created += other->edges_created;
+  stats->faces_created += other->faces_created;
+}
+
+// === PARSING ===
+
+// Every scan stops at "end": the source isn't terminated, and may not
+// be readable past it at all when it comes from a memory-mapped file.
+// Returns "end" when the value can't be found.
+static const char* ptm__find_char(const char* head, const char* end, char value) {
+  // Most of a .map file is long face lines and comments, so look 
+  // at 16 bytes at a time while there is room for it.
+#if defined(PTM__SSE2)
+  __m128i needle = _mm_set1_epi8(value);
+
+  while (end - head >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)head);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+
+    if (mask != 0) {
+      return head + PTM__CTZ32(mask);
+    }
+    head += 16;
+  }
+#elif defined(PTM__NEON)
+  uint8x16_t needle = vdupq_n_u8((uint8_t)value);
+
+  while (end - head >= 16) {
+    uint8x16_t matches = vceqq_u8(vld1q_u8((const uint8_t*)head), needle);
+
+    // Narrow each byte of the comparison into 4 bits of a 64 bit mask
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+
+    if (mask != 0) {
+      return head + (PTM__CTZ64(mask) >> 2);
+    }
+    head += 16;
+  }
+#endif
+
+  while (head < end && *head != value) {
+    head++;
+  }
+
+  return head;
+}
+
+static void ptm__consume_until_at(const char** head, const char* end, char value) {
+  *head = ptm__find_char(*head, end, value);
+}
+
+static void ptm__consume_until_after(const char** head, const char* end, char value) {
+  ptm__consume_until_at(head, end, value);
+
+  if (*head < end) {
+    (*head)++;
+  }
+}
+
+static void ptm__consume_whitespace(const char** head, const char* end) {
+  while (*head < end && **head == ' ')
+    (*head)++;
+}
+
+static PTM_REAL ptm__consume_number(const char** head, const char* end) {
+  const char* number_end;
+  const char* start = *head;
+
+  // The number parser only stops on a character that isn't part of
+  // the number. Close to the end of the source there might not be one,
+  // so parse a terminated copy of what's left instead.
+  if (end - start < 64) {
+    char buffer[64];
+    int length = (int)(end - start);
+    ptm__copy_memory(buffer, start, length);
+    buffer[length] = '\0';
+    PTM_REAL value = PTM_STRTOR(buffer, &number_end);
+    *head = start + (number_end - buffer);
+    return value;
+  }
+
+  PTM_REAL value = PTM_STRTOR(start, &number_end);
+  *head = number_end;
+  return value;
+} 
+
+static ptm_string ptm__consume_string(const char** head, const char* source_end, char delimiter, ptm_string_pool* pool, void* pool_arena, void* arena) {
+  // Parse a string between delimiters at head
+  ptm__consume_until_after(head, source_end, delimiter);
+  const char* start = *head;
+  ptm__consume_until_at(head, source_end, delimiter);
+  const char* end = *head;
+
+  if (*head < source_end) {
+    (*head)++;
+  }
+
+  PTM_PROFILE_BEGIN("intern");
+  int length = (int)((intptr_t)end - (intptr_t)start);
+  PTM_HASH hash = PTM_CREATE_HASH(start, length);
+  ptm_string result = ptm__intern_string(start, length, hash, pool, pool_arena, arena);
+  PTM_PROFILE_END("intern");
+  return result;
+}
+
+static ptm_string ptm__intern_string(const char* data, int length, PTM_HASH hash, ptm_string_pool* pool, void* pool_arena, void* arena) {
+  // Most strings are already in the pool (texture names especially)
+  ptm_string* slot = ptm__find_string_slot(pool, data, length, hash);
+  ptm_string result = *slot;
+
+  if (result.data == NULL) {
+    // Allocate new string from parsed value
+    char* copy = (char*)PTM_APUSH(arena, length + 1);
+    ptm__copy_memory(copy, data, length);
+    copy[length] = '\0';
+
+    slot->data = copy;
+    slot->hash = hash;
+    slot->length = length;
+    pool->string_count++;
+    result = *slot;
+
+    // Keep the table under half full, so probes stay short
+    if (pool->string_count * 2 > pool->slot_count) {
+      ptm__grow_string_pool(pool, pool_arena);
+    }
+  }
+
+  return result;
+}
+
+static const char* ptm__find_brush_end(const char* head, const char* end) {
+  // The closing brace is the first line of the brush that starts with 
+  // one (texture names can have braces in them, but never start a line).
+  // Returns end if the brush is never closed.
+  head = ptm__find_char(head, end, '\n');
+
+  while (head < end) {
+    head++;
+    ptm__consume_whitespace(&head, end);
+
+    if (head < end && *head == '}') {
+      return head;
+    }
+
+    head = ptm__find_char(head, end, '\n');
+  }
+
+  return end;
+}
+
+static unsigned long long ptm__hash_brush_source(const char* start, const char* end) {
+  // Every brush of a reloadable map is hashed, so this takes 8 bytes at
+  // a time (in a fixed order, so the hash doesn't depend on the machine)
+  unsigned long long hash = (unsigned long long)(end - start);
+
+  for (; end - start >= 8; start += 8) {
+    const unsigned char* bytes = (const unsigned char*)start;
+    unsigned long long word = 
+      (unsigned long long)bytes[0] | (unsigned long long)bytes[1] << 8 | 
+      (unsigned long long)bytes[2] << 16 | (unsigned long long)bytes[3] << 24 |
+      (unsigned long long)bytes[4] << 32 | (unsigned long long)bytes[5] << 40 | 
+      (unsigned long long)bytes[6] << 48 | (unsigned long long)bytes[7] << 56;
+    hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 29;
+  }
+
+  for (; start < end; start++) {
+    hash = (hash ^ (unsigned char)*start) * 0x100000001b3ull;
+  }
+
+  hash ^= hash >> 32;
+  hash *= 0xd6e8feb86659fd93ull;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+static void ptm__copy_brush(ptm_brush* brush, const ptm_brush* source, ptm_string_pool* pool, void* pool_arena, void* arena) {
+  // An unchanged brush is copied into the new map (in one array of
+  // faces), with its texture names interned into the new pool
+  ptm_brush_face* faces = (ptm_brush_face*)PTM_APUSH(arena, source->face_count * (int)sizeof(ptm_brush_face));
+  ptm_string texture_name = {0};
+  const char* source_texture = NULL;
+  int face_count = 0;
+
+  for (ptm_brush_face* face = source->faces; face != NULL; face = face->next) {
+    ptm_brush_face* copy = &faces[face_count];
+    *copy = *face;
+    copy->next = face->next != NULL ? &faces[face_count + 1] : NULL;
+    face_count++;
+
+    // Faces of a brush mostly share a texture
+    if (face->texture_name.data != source_texture) {
+      source_texture = face->texture_name.data;
+      texture_name = ptm__intern_string(source_texture, face->texture_name.length, face->texture_name.hash, pool, pool_arena, arena);
+    }
+
+    copy->texture_name = texture_name;
+  }
+
+  brush->faces = face_count > 0 ? faces : NULL;
+  brush->face_count = face_count;
+}
+
+static void ptm__append_carry(ptm_parser* parser, const char* source, const char* source_end) {
+  int length = (int)(source_end - source);
+
+  if (parser->carry_length + length > parser->carry_capacity) {
+    // A carry is only the line a chunk was cut in, so it rarely
+    // outgrows the first one; a grown one leaves the old behind.
+    char* carry = parser->carry;
+    int capacity = parser->carry_capacity == 0 ? 256 : parser->carry_capacity;
+
+    while (capacity < parser->carry_length + length) {
+      capacity *= 2;
+    }
+
+    parser->carry = (char*)PTM_APUSH(parser->parser_arena, capacity);
+    parser->carry_capacity = capacity;
+    ptm__copy_memory(parser->carry, carry, parser->carry_length);
+  }
+
+  ptm__copy_memory(parser->carry + parser->carry_length, source, length);
+  parser->carry_length += length;
+}
+
+static int ptm__split_source(const char* source, const char* source_end, ptm_parse_job* parts, int part_count) {
+  // Parts start at the first entity or brush after evenly spaced points
+  // (so one big entity, which the world usually is, still gets split).
+  // Only the first character of a line matters to the parser, so it's
+  // all that matters here too: braces inside strings and comments 
+  // never start a line.
+  long long length = source_end - source;
+  const char* head = source;
+  const char* entity_start = NULL;
+  const char* class_line = NULL;
+  int depth = 0;
+  int found_count = 1;
+  int target_index = 1;
+
+  parts[0].source = source;
+
+  while (head < source_end && target_index < part_count) {
+    ptm__consume_whitespace(&head, source_end);
+
+    if (head >= source_end) {
+      break;
+    }
+
+    if (*head == '{') {
+      // A part inside an entity can only start once its classname is known
+      if ((depth == 0 || (depth == 1 && class_line != NULL)) && head >= source + length * target_index / part_count) {
+        parts[found_count].source = head;
+        parts[found_count].entity_start = depth == 1 ? entity_start : NULL;
+        parts[found_count].class_line = depth == 1 ? class_line : NULL;
+        found_count++;
+
+        while (target_index < part_count && head >= source + length * target_index / part_count) {
+          target_index++;
+        }
+      }
+
+      if (depth == 0) {
+        entity_start = head;
+        class_line = NULL;
+      }
+
+      depth++;
+    }
+    else if (*head == '}') {
+      depth--;
+    }
+    else if (*head == '"' && depth == 1) {
+      const char* key = "\"classname\"";
+      int matched = 0;
+
+      while (matched < 11 && head + matched < source_end && head[matched] == key[matched]) {
+        matched++;
+      }
+
+      if (matched == 11) {
+        class_line = head;
+      }
+    }
+
+    ptm__consume_until_after(&head, source_end, '\n');
+  }
+
+  return found_count;
+}
+
+static ptm_entity* ptm__copy_entity(const ptm_entity* source, ptm_string_pool* pool, void* pool_arena, void* arena) {
+  // Entities parsed in parts are copied into the map, with their 
+  // properties and brushes in arrays (listed in the same order), and
+  // every string interned into the map's pool
+  ptm_entity* entity = (ptm_entity*)PTM_APUSH(arena, sizeof *entity);
+  *entity = *source;
+  entity->next = NULL;
+  entity->class_name = ptm__intern_string(source->class_name.data, source->class_name.length, source->class_name.hash, pool, pool_arena, arena);
+
+  ptm_property* properties = (ptm_property*)PTM_APUSH(arena, source->property_count * (int)sizeof(ptm_property));
+  int property_count = 0;
+
+  for (ptm_property* property = source->properties; property != NULL; property = property->next) {
+    ptm_property* copy = &properties[property_count++];
+    *copy = *property;
+    copy->next = property->next != NULL ? copy + 1 : NULL;
+    copy->key = ptm__intern_string(property->key.data, property->key.length, property->key.hash, pool, pool_arena, arena);
+    copy->value = ptm__intern_string(property->value.data, property->value.length, property->value.hash, pool, pool_arena, arena);
+  }
+
+  entity->properties = property_count > 0 ? properties : NULL;
+
+  // World entities' brush lists go on into the next one's
+  ptm_brush* brushes = (ptm_brush*)PTM_APUSH(arena, source->brush_count * (int)sizeof(ptm_brush));
+  const ptm_brush* brush = source->brushes;
+
+  for (int i = 0; i < source->brush_count; i++) {
+    brushes[i].next = i + 1 < source->brush_count ? &brushes[i + 1] : NULL;
+    ptm__copy_brush(&brushes[i], brush, pool, pool_arena, arena);
+    brush = brush->next;
+  }
+
+  entity->brushes = source->brush_count > 0 ? brushes : NULL;
+  return entity;
+}
+
+// === PROPERTIES ===
+
+static void ptm__index_properties(ptm_entity* entity, void* arena) {
+  // Keys are interned, so slots hold properties by the hash of their
+  // key, compared by pointer. Lists are walked from the front, so the
+  // first of the same key (the last in the file) is the one kept.
+  int slot_count = 0;
+
+  if (entity->property_count > 0) {
+    slot_count = 4;
+
+    while (slot_count < entity->property_count * 2) {
+      slot_count *= 2;
+    }
+  }
+
+  ptm_property** slots = (ptm_property**)PTM_APUSH(arena, slot_count * (int)sizeof(ptm_property*));
+  ptm__zero_memory(slots, slot_count * (int)sizeof(ptm_property*));
+
+  for (ptm_property* property = entity->properties; property != NULL; property = property->next) {
+    ptm_property** slot = ptm__find_property_slot(slots, slot_count, property->key);
+
+    if (*slot == NULL) {
+      *slot = property;
+    }
+  }
+
+  entity->property_slots = slot_count > 0 ? slots : NULL;
+  entity->property_slot_count = slot_count;
+}
+
+static ptm_property** ptm__find_property_slot(ptm_property** slots, int slot_count, ptm_string key) {
+  // The table is never more than half full, so there's always an empty slot
+  int mask = slot_count - 1;
+  int index = (int)(key.hash & (PTM_HASH)mask);
+
+  while (slots[index] != NULL && slots[index]->key.data != key.data) {
+    index = (index + 1) & mask;
+  }
+
+  return &slots[index];
+}
+
+static void ptm__decode_property(ptm_property* property) {
+  // Values are terminated, so the number parser can run on them directly
+  if (property->is_decoded) {
+    return;
+  }
+
+  const char* head = property->value.data;
+  int number_count = 0;
+
+  while (number_count < 3) {
+    const char* number_end;
+    PTM_REAL number = PTM_STRTOR(head, &number_end);
+
+    if (number_end == head) {
+      break;
+    }
+
+    property->numbers[number_count++] = number;
+    head = number_end;
+  }
+
+  property->number_count = number_count;
+  property->is_decoded = 1;
+}
+
+// === STRINGS ===
+
+static ptm_string* ptm__find_string_slot(const ptm_string_pool* pool, const char* data, int length, PTM_HASH hash) {
+  int mask = pool->slot_count - 1;
+  int index = (int)(hash & (PTM_HASH)mask);
+
+  // Linear probing: the table is never more than half full, 
+  // so we always reach either the match or an empty slot.
+  // A hash match alone isn't enough, different strings can share one.
+  for (;;) {
+    ptm_string* slot = &pool->slots[index];
+
+    if (slot->data == NULL) {
+      return slot;
+    }
+    if (slot->hash == hash && slot->length == length && ptm__compare_memory(slot->data, data, length)) {
+      return slot;
+    }
+
+    index = (index + 1) & mask;
+  }
+}
+
+static void ptm__grow_string_pool(ptm_string_pool* pool, void* pool_arena) {
+  // Old tables are left behind in the scratch arena: 
+  // they only add up to the size of the final one.
+  ptm_string_pool grown = *pool;
+  grown.slot_count = pool->slot_count == 0 ? 1024 : pool->slot_count * 2;
+  grown.slots = (ptm_string*)PTM_APUSH(pool_arena, grown.slot_count * (int)sizeof(ptm_string));
+  ptm__zero_memory(grown.slots, grown.slot_count * (int)sizeof(ptm_string));
+
+  for (int i = 0; i < pool->slot_count; i++) {
+    ptm_string string = pool->slots[i];
+
+    if (string.data != NULL) {
+      *ptm__find_string_slot(&grown, string.data, string.length, string.hash) = string;
+    }
+  }
+
+  *pool = grown;
+}
+
+static ptm_class_slot* ptm__find_class_slot(const ptm_class_index* index, ptm_string name) {
+  int mask = index->slot_count - 1;
+  int slot_index = (int)(name.hash & (PTM_HASH)mask);
+
+  // Linear probing, like the string pool: the names are interned, 
+  // so a class matches exactly when the data pointers do.
+  for (;;) {
+    ptm_class_slot* slot = &index->slots[slot_index];
+
+    if (slot->entity_class == NULL || slot->entity_class->name.data == name.data) {
+      return slot;
+    }
+
+    slot_index = (slot_index + 1) & mask;
+  }
+}
+
+static void ptm__grow_class_index(ptm_class_index* index, void* pool_arena) {
+  ptm_class_index grown = *index;
+  grown.slot_count = index->slot_count == 0 ? 64 : index->slot_count * 2;
+  grown.slots = (ptm_class_slot*)PTM_APUSH(pool_arena, grown.slot_count * (int)sizeof(ptm_class_slot));
+  ptm__zero_memory(grown.slots, grown.slot_count * (int)sizeof(ptm_class_slot));
+
+  for (int i = 0; i < index->slot_count; i++) {
+    ptm_class_slot slot = index->slots[i];
+
+    if (slot.entity_class != NULL) {
+      *ptm__find_class_slot(&grown, slot.entity_class->name) = slot;
+    }
+  }
+
+  *index = grown;
+}
+
+// === MESHING ===
+
+static int ptm__create_meshes(ptm_map* map, const ptm_load_options* options, const ptm_map* old_map) {
+  // Every entity at once: the world goes first, then the other entities
+  int entity_count = 1;
+
+  for (ptm_entity_class* c = map->entity_classes; c != NULL; c = c->next) {
+    entity_count += c->entity_count;
+  }
+
+  void* scratch = PTM_ACREATE(entity_count * (int)sizeof(ptm_entity*));
+  ptm_entity** entities = (ptm_entity**)PTM_APUSH(scratch, entity_count * (int)sizeof(ptm_entity*));
+  int entity_index = 0;
+  entities[entity_index++] = &map->world;
+
+  for (ptm_entity_class* c = map->entity_classes; c != NULL; c = c->next) {
+    ptm__copy_memory(entities + entity_index, c->entity_array, c->entity_count * (int)sizeof(ptm_entity*));
+    entity_index += c->entity_count;
+  }
+
+  int high_water_mark = ptm__mesh_entities(map, entities, entity_count, options, old_map, map->arena, &map->load_stats);
+
+  for (int i = 0; i < entity_count; i++) {
+    entities[i]->is_meshed = 1;
+  }
+
+  PTM_AFREE(scratch);
+  return high_water_mark;
+}
+
+static int ptm__mesh_entities(ptm_map* map, ptm_entity** entities, int entity_count, const ptm_load_options* options, const ptm_map* old_map, void* arena, ptm_load_stats* stats) {
+  // Brushes don't depend on each other, so the expensive part (clipping 
+  // them into polygons) can be split into jobs over a flat list of every
+  // brush we need to mesh, in entity order
+  int brush_count = 0;
+
+  for (int i = 0; i < entity_count; i++) {
+    brush_count += entities[i]->brush_count;
+  }
+
+  int thread_count = options != NULL ? options->thread_count : 1;
+  int has_scheduler = options != NULL && options->run_jobs != NULL;
+  int job_count = 1;
+
+  // A few jobs per thread evens out brushes that are slower to clip
+  if (thread_count > 1 || has_scheduler) {
+    job_count = (thread_count > 1 ? thread_count : 1) * 4;
+  }
+  if (job_count > brush_count) {
+    job_count = brush_count > 0 ? brush_count : 1;
+  }
+
+  int brushes_size = brush_count * (int)sizeof(ptm_brush*);
+  int results_size = brush_count * (int)sizeof(ptm_brush_polygons);
+  int jobs_size = job_count * (int)(sizeof(ptm_mesh_job) + sizeof(void*));
+  void* scratch = PTM_ACREATE(brushes_size + results_size + jobs_size);
+  ptm_brush** brushes = (ptm_brush**)PTM_APUSH(scratch, brushes_size);
+  ptm_brush_polygons* results = (ptm_brush_polygons*)PTM_APUSH(scratch, results_size);
+  ptm_mesh_job* jobs = (ptm_mesh_job*)PTM_APUSH(scratch, job_count * (int)sizeof(ptm_mesh_job));
+  void** job_pointers = (void**)PTM_APUSH(scratch, job_count * (int)sizeof(void*));
+
+  int brush_index = 0;
+
+  for (int i = 0; i < entity_count; i++) {
+    for (ptm_brush* brush = entities[i]->brushes; brush != NULL; brush = brush->next) {
+      brushes[brush_index++] = brush;
+    }
+  }
+
+  // When reloading, brushes that didn't change reuse their old polygons.
+  // The rest are moved to the front of a copy of the list to be clipped,
+  // and their results are moved back into place afterwards.
+  ptm_brush** clip_brushes = brushes;
+  ptm_brush_polygons* clip_results = results;
+  int* clip_indices = NULL;
+  int clip_count = brush_count;
+
+  if (old_map != NULL && old_map->reload_cache != NULL && old_map->reload_cache->brush_polygons != NULL) {
+    clip_brushes = (ptm_brush**)PTM_APUSH(scratch, brushes_size);
+    clip_results = (ptm_brush_polygons*)PTM_APUSH(scratch, results_size);
+    clip_indices = (int*)PTM_APUSH(scratch, brush_count * (int)sizeof(int));
+    ptm__reuse_polygons(old_map, brushes, results, brush_count, scratch);
+    clip_count = 0;
+
+    for (int i = 0; i < brush_count; i++) {
+      if (results[i].polygons == NULL) {
+        clip_indices[clip_count] = i;
+        clip_brushes[clip_count++] = brushes[i];
+      }
+    }
+
+    if (job_count > clip_count) {
+      job_count = clip_count > 0 ? clip_count : 1;
+    }
+  }
+
+  // Split the brushes into contiguous ranges: each job gets its own 
+  // arena for its results, so the jobs never need to synchronize.
+  for (int i = 0; i < job_count; i++) {
+    int first = (int)((long long)clip_count * i / job_count);
+    int last = (int)((long long)clip_count * (i + 1) / job_count);
+    jobs[i].brushes = clip_brushes + first;
+    jobs[i].results = clip_results + first;
+    jobs[i].brush_count = last - first;
+    jobs[i].arena = NULL;
+    jobs[i].scratch_reserved = 0;
+    ptm__zero_memory(&jobs[i].clip_stats, sizeof jobs[i].clip_stats);
+    job_pointers[i] = &jobs[i];
+  }
+
+  if (has_scheduler) {
+    options->run_jobs(ptm__run_mesh_job, job_pointers, job_count, options->run_jobs_userdata);
+  }
+  else {
+    ptm__run_jobs(ptm__run_mesh_job, job_pointers, job_count, thread_count);
+  }
+
+  for (int i = 0; clip_indices != NULL && i < clip_count; i++) {
+    results[clip_indices[i]] = clip_results[i];
+  }
+
+  // Kept from before culling, which depends on the neighbors
+  if (options != NULL && options->reloadable) {
+    ptm__keep_polygons(map, results, brush_count);
+  }
+
+  // Culling looks across brushes, so it can only start once every 
+  // job is done. It only drops polygons: the merge can't tell.
+  // Only the world is culled (and split into clusters), and it's
+  // always first when it's meshed.
+  int has_world = entity_count > 0 && entities[0] == &map->world;
+
+  // Collision needs every face that blocks, hidden or not
+  if (has_world && options != NULL && options->collision) {
+    map->collision = ptm__create_collision(&map->world, results, arena);
+  }
+
+  if (has_world && options != NULL && options->cull_hidden_faces) {
+    ptm__cull_hidden_faces(&map->world, results);
+  }
+
+  // Merging is done in brush order on this thread, so the output is the 
+  // same no matter how many jobs (or threads) the polygons came from.
+  ptm_brush_polygons* entity_results = results;
+  PTM_REAL cluster_size = options != NULL ? options->cluster_size : 0;
+
+  for (int i = 0; i < entity_count; i++) {
+    ptm__merge_meshes(entities[i], entity_results, i == 0 && has_world ? cluster_size : 0, arena);
+    entity_results += entities[i]->brush_count;
+  }
+
+  if (options != NULL && options->interleave_vertices) {
+    for (int i = 0; i < entity_count; i++) {
+      ptm__interleave_meshes(entities[i], options, arena);
+    }
+  }
+
+  // This is when the most memory is alive during a load: the map with
+  // all its meshes, and every job's polygons. The jobs' clipping memory
+  // is already freed, but could all have been alive at once too.
+  int high_water_mark = ptm__arena_reserved(arena) + ptm__arena_reserved(scratch);
+
+  for (int i = 0; i < job_count; i++) {
+    high_water_mark += jobs[i].scratch_reserved;
+    PTM__COUNT(stats->brushes_clipped, jobs[i].brush_count);
+    PTM__COUNT(stats->planes_clipped, jobs[i].clip_stats.planes_clipped);
+    PTM__COUNT(stats->planes_skipped, jobs[i].clip_stats.planes_skipped);
+    PTM__COUNT(stats->vertices_created, jobs[i].clip_stats.vertices_created);
+    PTM__COUNT(stats->edges_created, jobs[i].clip_stats.edges_created);
+    PTM__COUNT(stats->faces_created, jobs[i].clip_stats.faces_created);
+
+    if (jobs[i].arena != NULL) {
+      high_water_mark += ptm__arena_reserved(jobs[i].arena);
+      PTM_AFREE(jobs[i].arena);
+    }
+  }
+
+  PTM_AFREE(scratch);
+  return high_water_mark;
+}
+
+static void ptm__reuse_polygons(const ptm_map* old_map, ptm_brush** brushes, ptm_brush_polygons* results, int brush_count, void* scratch) {
+  // Old brushes are found by their planes with an open-addressing table
+  // (of old brush + 1, or 0 if unused): a brush's polygons only depend 
+  // on its planes, in order. Its textures can change.
+  int old_brush_count = old_map->world.brush_count;
+
+  for (ptm_entity_class* c = old_map->entity_classes; c != NULL; c = c->next) {
+    for (ptm_entity* entity = c->entities; entity != NULL; entity = entity->next) {
+      old_brush_count += entity->brush_count;
+    }
+  }
+
+  int slot_count = 16;
+
+  while (slot_count < old_brush_count * 2) {
+    slot_count *= 2;
+  }
+
+  ptm_brush** old_brushes = (ptm_brush**)PTM_APUSH(scratch, old_brush_count * (int)sizeof(ptm_brush*));
+  int* slots = (int*)PTM_APUSH(scratch, slot_count * (int)sizeof(int));
+  ptm__zero_memory(slots, slot_count * (int)sizeof(int));
+  int old_index = 0;
+
+  for (ptm_brush* brush = old_map->world.brushes; brush != NULL; brush = brush->next) {
+    old_brushes[old_index++] = brush;
+  }
+
+  for (ptm_entity_class* c = old_map->entity_classes; c != NULL; c = c->next) {
+    for (ptm_entity* entity = c->entities; entity != NULL; entity = entity->next) {
+      for (ptm_brush* brush = entity->brushes; brush != NULL; brush = brush->next) {
+        old_brushes[old_index++] = brush;
+      }
+    }
+  }
+
+  for (int i = 0; i < old_brush_count; i++) {
+    int index = (int)(ptm__hash_brush_planes(old_brushes[i]) & (PTM_HASH)(slot_count - 1));
+
+    while (slots[index] != 0) {
+      index = (index + 1) & (slot_count - 1);
+    }
+
+    slots[index] = i + 1;
+  }
+
+  // Reused polygons point at the new brush's faces: the old ones 
+  // (and the map they're in) may be gone by the next reload.
+  int face_capacity = 0;
+  ptm_brush_face** old_faces = NULL;
+  ptm_brush_face** new_faces = NULL;
+
+  for (int i = 0; i < brush_count; i++) {
+    ptm_brush* brush = brushes[i];
+    int index = (int)(ptm__hash_brush_planes(brush) & (PTM_HASH)(slot_count - 1));
+    int old = -1;
+    results[i].polygons = NULL;
+    results[i].polygon_count = 0;
+
+    for (; slots[index] != 0; index = (index + 1) & (slot_count - 1)) {
+      if (ptm__is_same_planes(old_brushes[slots[index] - 1], brush)) {
+        old = slots[index] - 1;
+        break;
+      }
+    }
+
+    // Brushes that were skipped before are clipped again: they have 
+    // no polygons to tell them apart from brushes that need clipping.
+    if (old < 0 || old_map->reload_cache->brush_polygons[old].polygon_count == 0) {
+      continue;
+    }
+
+    if (face_capacity < brush->face_count) {
+      face_capacity = brush->face_count * 2;
+      old_faces = (ptm_brush_face**)PTM_APUSH(scratch, face_capacity * (int)sizeof(ptm_brush_face*));
+      new_faces = (ptm_brush_face**)PTM_APUSH(scratch, face_capacity * (int)sizeof(ptm_brush_face*));
+    }
+
+    int face_index = 0;
+
+    for (ptm_brush_face* face = old_brushes[old]->faces; face != NULL; face = face->next) {
+      old_faces[face_index++] = face;
+    }
+
+    face_index = 0;
+
+    for (ptm_brush_face* face = brush->faces; face != NULL; face = face->next) {
+      new_faces[face_index++] = face;
+    }
+
+    ptm_brush_polygons* old_polygons = &old_map->reload_cache->brush_polygons[old];
+    results[i].polygons = (ptm_polygon*)PTM_APUSH(scratch, old_polygons->polygon_count * (int)sizeof(ptm_polygon));
+    results[i].polygon_count = old_polygons->polygon_count;
+
+    for (int j = 0; j < old_polygons->polygon_count; j++) {
+      ptm_polygon polygon = old_polygons->polygons[j];
+      int k = 0;
+
+      while (old_faces[k] != polygon.face) {
+        k++;
+      }
+
+      polygon.face = new_faces[k];
+      results[i].polygons[j] = polygon;
+    }
+  }
+}
+
+static PTM_HASH ptm__hash_brush_planes(const ptm_brush* brush) {
+  // The normal and c are next to each other in a face
+  PTM_HASH hash = (PTM_HASH)brush->face_count;
+
+  for (ptm_brush_face* face = brush->faces; face != NULL; face = face->next) {
+    hash = hash * 31 + PTM_CREATE_HASH((const char*)face->plane_normal, 4 * (int)sizeof(PTM_REAL));
+  }
+
+  return hash;
+}
+
+static int ptm__is_same_planes(const ptm_brush* a, const ptm_brush* b) {
+  if (a->face_count != b->face_count) {
+    return 0;
+  }
+
+  ptm_brush_face* b_face = b->faces;
+
+  for (ptm_brush_face* a_face = a->faces; a_face != NULL; a_face = a_face->next) {
+    if (!ptm__compare_memory(a_face->plane_normal, b_face->plane_normal, 4 * (int)sizeof(PTM_REAL))) {
+      return 0;
+    }
+
+    b_face = b_face->next;
+  }
+
+  return 1;
+}
+
+static void ptm__keep_polygons(ptm_map* map, ptm_brush_polygons* results, int brush_count) {
+  // Copied into the map in three exact pushes: each brush's range,
+  // then all the polygons, then all their positions.
+  int polygon_count = 0;
+  int position_count = 0;
+
+  for (int i = 0; i < brush_count; i++) {
+    polygon_count += results[i].polygon_count;
+
+    for (int j = 0; j < results[i].polygon_count; j++) {
+      position_count += results[i].polygons[j].vertex_count * 3;
+    }
+  }
+
+  ptm_reload_cache* cache = map->reload_cache;
+  cache->brush_polygons = (ptm_brush_polygons*)PTM_APUSH(map->arena, brush_count * (int)sizeof(ptm_brush_polygons));
+  cache->brush_count = brush_count;
+  ptm_polygon* polygons = (ptm_polygon*)PTM_APUSH(map->arena, polygon_count * (int)sizeof(ptm_polygon));
+  PTM_REAL* positions = (PTM_REAL*)PTM_APUSH(map->arena, position_count * (int)sizeof(PTM_REAL));
+
+  for (int i = 0; i < brush_count; i++) {
+    cache->brush_polygons[i].polygons = polygons;
+    cache->brush_polygons[i].polygon_count = results[i].polygon_count;
+
+    for (int j = 0; j < results[i].polygon_count; j++) {
+      ptm_polygon polygon = results[i].polygons[j];
+      int count = polygon.vertex_count * 3;
+
+      for (int k = 0; k < count; k++) {
+        positions[k] = polygon.positions[k];
+      }
+
+      polygon.positions = positions;
+      *polygons++ = polygon;
+      positions += count;
+    }
+  }
+}
+
+static void ptm__run_mesh_job(void* opaque_job) {
+  ptm_mesh_job* job = (ptm_mesh_job*)opaque_job;
+
+  // One hull is reused for every brush, so once it has grown to fit 
+  // the biggest brush, clipping doesn't allocate at all. Its memory 
+  // comes out of a scratch arena that only lives as long as the job.
+  void* scratch = PTM_ACREATE(16384);
+  ptc_mesh hull = {0};
+  hull.allocator.reallocate = ptm__reallocate_hull;
+  hull.allocator.userdata = scratch;
+  int* loop = NULL;
+  int loop_capacity = 0;
+  int* welds = NULL;
+  PTM_REAL* weld_positions = NULL;
+  int weld_capacity = 0;
+  ptc_plane* planes = NULL;
+  void** plane_faces = NULL;
+  int plane_capacity = 0;
+
+  // Most brushes are boxes: about 6 polygons of 4 vertices each
+  int polygon_size = (int)sizeof(ptm_polygon) + 4 * 3 * (int)sizeof(PTM_REAL);
+  job->arena = PTM_ACREATE(job->brush_count * 6 * polygon_size);
+
+  for (int i = 0; i < job->brush_count; i++) {
+    ptm_brush_polygons* result = &job->results[i];
+    result->polygons = NULL;
+    result->polygon_count = 0;
+
+    // Step one: clip the brush into a convex hull, and count 
+    // how much room its polygons need.
+    ptm_brush* brush = job->brushes[i];
+
+    if (plane_capacity < brush->face_count) {
+      plane_capacity = brush->face_count * 2;
+      planes = (ptc_plane*)PTM_APUSH(scratch, plane_capacity * (int)sizeof(ptc_plane));
+      plane_faces = (void**)PTM_APUSH(scratch, plane_capacity * (int)sizeof(void*));
+    }
+
+    if (!ptm__clip_brush(brush, &hull, planes, plane_faces) || !ptm__is_hull_closed(&hull)) {
+      continue;
+    }
+
+    int polygon_count = 0;
+    int vertex_count = 0;
+    int max_loop_size = 0;
+
+    for (int j = 0; j < hull.face_count; j++) {
+      ptc_face* face = &hull.faces[j];
+
+      if (!ptm__is_face_visible(face)) {
+        continue;
+      }
+
+      polygon_count++;
+      vertex_count += face->edge_count;
+
+      if (face->edge_count + 1 > max_loop_size) {
+        max_loop_size = face->edge_count + 1;
+      }
+    }
+
+    if (loop_capacity < max_loop_size) {
+      loop_capacity = max_loop_size * 2;
+      loop = (int*)PTM_APUSH(scratch, loop_capacity * (int)sizeof(int));
+    }
+
+    if (weld_capacity < hull.vertex_count) {
+      weld_capacity = hull.vertex_count * 2;
+      welds = (int*)PTM_APUSH(scratch, weld_capacity * 2 * (int)sizeof(int));
+      weld_positions = (PTM_REAL*)PTM_APUSH(scratch, weld_capacity * 3 * (int)sizeof(PTM_REAL));
+    }
+
+    ptm__weld_hull(&hull, welds, weld_positions);
+
+    // Step two: write out each face as a polygon with its vertices
+    // already in winding order. Welded vertices can leave a corner 
+    // twice in a row, or a polygon with no area left: drop those.
+    ptm_polygon* polygons = (ptm_polygon*)PTM_APUSH(job->arena, polygon_count * (int)sizeof(ptm_polygon));
+    PTM_REAL* positions = (PTM_REAL*)PTM_APUSH(job->arena, vertex_count * 3 * (int)sizeof(PTM_REAL));
+    result->polygons = polygons;
+
+    for (int j = 0; j < hull.face_count; j++) {
+      ptc_face* face = &hull.faces[j];
+
+      if (!ptm__is_face_visible(face)) {
+        continue;
+      }
+
+      int loop_size = ptc_get_vertices(&hull, j, loop, PTC_WINDING_CCW) - 1;
+      int count = 0;
+
+      for (int k = 0; k < loop_size; k++) {
+        int vertex = welds[loop[k]];
+
+        if (count == 0 || loop[count - 1] != vertex) {
+          loop[count++] = vertex;
+        }
+      }
+
+      if (count > 1 && loop[count - 1] == loop[0]) {
+        count--;
+      }
+      if (count < 3) {
+        continue;
+      }
+
+      ptm_polygon* polygon = &polygons[result->polygon_count++];
+      polygon->face = (ptm_brush_face*)face->userdata;
+      polygon->positions = positions;
+      polygon->vertex_count = count;
+
+      for (int k = 0; k < count; k++) {
+        PTM_REAL* position = &weld_positions[loop[k] * 3];
+        positions[0] = position[0];
+        positions[1] = position[1];
+        positions[2] = position[2];
+        positions += 3;
+      }
+    }
+  }
+
+  job->scratch_reserved = ptm__arena_reserved(scratch);
+  job->clip_stats = hull.stats;
+  PTM_AFREE(scratch);
+}
+
+static void* ptm__reallocate_hull(void* arena, void* block, int old_bytes, int new_bytes) {
+  // Arenas can't grow a block in place: old blocks are left behind,
+  // but hulls only grow by doubling so that adds up to little.
+  void* result = PTM_APUSH(arena, new_bytes);
+
+  if (block != NULL) {
+    ptm__copy_memory(result, block, old_bytes < new_bytes ? old_bytes : new_bytes);
+  }
+
+  return result;
+}
+
+static void ptm__merge_meshes(ptm_entity* entity, ptm_brush_polygons* brushes, PTM_REAL cluster_size, void* arena) {
+  entity->meshes = NULL;
+  entity->clusters = NULL;
+  entity->mesh_count = 0;
+  entity->cluster_count = 0;
+
+  if (entity->brush_count == 0) {
+    return;
+  }
+
+  // Meshes are grouped by texture name with a small open-addressing table.
+  // Every polygon could have a unique texture, so size it for the worst 
+  // case while keeping the load factor under half.
+  int polygon_count = 0;
+  int max_polygon_size = 0;
+
+  for (int i = 0; i < entity->brush_count; i++) {
+    polygon_count += brushes[i].polygon_count;
+
+    for (int j = 0; j < brushes[i].polygon_count; j++) {
+      int vertex_count = brushes[i].polygons[j].vertex_count;
+      max_polygon_size = vertex_count > max_polygon_size ? vertex_count : max_polygon_size;
+    }
+  }
+
+  int slot_count = 16;
+
+  while (slot_count < polygon_count * 2) {
+    slot_count *= 2;
+  }
+
+  int slots_size = slot_count * (int)sizeof(ptm_mesh*);
+  int slot_starts_size = slot_count * (int)sizeof(int);
+  int polygons_size = polygon_count * (int)(sizeof(int) + sizeof(ptm_polygon*));
+  void* scratch = PTM_ACREATE(slots_size + slot_starts_size + polygons_size);
+  ptm_mesh** slots = (ptm_mesh**)PTM_APUSH(scratch, slots_size);
+  int* slot_starts = (int*)PTM_APUSH(scratch, slot_starts_size);
+  int* polygon_slots = (int*)PTM_APUSH(scratch, polygon_count * (int)sizeof(int));
+  ptm_polygon** sorted_polygons = (ptm_polygon**)PTM_APUSH(scratch, polygon_count * (int)sizeof(ptm_polygon*));
+  ptm__zero_memory(slots, slots_size);
+  ptm__zero_memory(slot_starts, slot_starts_size);
+
+  // With clusters, meshes are grouped by cluster and texture instead
+  int* brush_clusters = NULL;
+
+  if (cluster_size > 0) {
+    brush_clusters = (int*)PTM_APUSH(scratch, entity->brush_count * (int)sizeof(int));
+    ptm__create_clusters(entity, brushes, cluster_size, brush_clusters, scratch, arena);
+  }
+
+  // Step one: find each polygon's mesh, and count how much vertex and 
+  // index data each mesh will need (at most: vertices can be shared).
+  ptm_mesh* tail = NULL;
+  int polygon_index = 0;
+
+  for (int i = 0; i < entity->brush_count; i++) {
+    ptm_cluster* cluster = brush_clusters != NULL && brushes[i].polygon_count > 0 ? &entity->clusters[brush_clusters[i]] : NULL;
+
+    for (int j = 0; j < brushes[i].polygon_count; j++) {
+      ptm_polygon* polygon = &brushes[i].polygons[j];
+      ptm_mesh** slot = ptm__find_mesh_slot(slots, slot_count, polygon->face->texture_name, cluster);
+
+      // First time we see this texture: create a new mesh for it
+      if (*slot == NULL) {
+        ptm_mesh* mesh = (ptm_mesh*)PTM_APUSH(arena, sizeof *mesh);
+        ptm__zero_memory(mesh, sizeof *mesh);
+        mesh->texture_name = polygon->face->texture_name;
+        mesh->cluster = cluster;
+        *slot = mesh;
+
+        if (tail == NULL) entity->meshes = mesh;
+        else tail->next = mesh;
+        tail = mesh;
+        entity->mesh_count++;
+      }
+
+      // Each polygon becomes a triangle fan around its first vertex
+      (*slot)->vertex_count += polygon->vertex_count;
+      (*slot)->index_count += (polygon->vertex_count - 2) * 3;
+      polygon_slots[polygon_index++] = (int)(slot - slots);
+      slot_starts[slot - slots]++;
+    }
+  }
+
+  if (entity->cluster_count > 0) {
+    ptm__sort_clusters(entity, (ptm_mesh**)PTM_APUSH(scratch, entity->cluster_count * (int)sizeof(ptm_mesh*)));
+  }
+
+  // Step two: sort the polygons by mesh, keeping them in brush order
+  // within each mesh, so meshes can be built one at a time. After this,
+  // each slot's start is where its mesh's polygons end.
+  int start = 0;
+
+  for (ptm_mesh* mesh = entity->meshes; mesh != NULL; mesh = mesh->next) {
+    int slot = (int)(ptm__find_mesh_slot(slots, slot_count, mesh->texture_name, mesh->cluster) - slots);
+    int count = slot_starts[slot];
+    slot_starts[slot] = start;
+    start += count;
+  }
+
+  polygon_index = 0;
+
+  for (int i = 0; i < entity->brush_count; i++) {
+    for (int j = 0; j < brushes[i].polygon_count; j++) {
+      sorted_polygons[slot_starts[polygon_slots[polygon_index++]]++] = &brushes[i].polygons[j];
+    }
+  }
+
+  // Step three: split meshes that could have more vertices than PTM_INDEX
+  // can address into chunks, each with the same texture, listed right 
+  // after the first. Their polygons are sorted along a curve through 
+  // space first, so each chunk covers one area (and can be culled as one).
+  // Every mesh (and chunk) gets where its polygons end in mesh_ends.
+  long long max_vertices = (long long)(PTM_INDEX)~(PTM_INDEX)0 + 1;
+  int* mesh_ends = (int*)PTM_APUSH(scratch, polygon_count * (int)sizeof(int));
+  int max_vertex_count = 0;
+  int mesh_index = 0;
+  int first = 0;
+
+  for (ptm_mesh* mesh = entity->meshes; mesh != NULL; mesh = mesh->next) {
+    int last = slot_starts[ptm__find_mesh_slot(slots, slot_count, mesh->texture_name, mesh->cluster) - slots];
+
+    if (mesh->vertex_count > max_vertices) {
+      ptm__sort_polygons(&sorted_polygons[first], last - first, scratch);
+      mesh->vertex_count = 0;
+      mesh->index_count = 0;
+
+      for (int i = first; i < last; i++) {
+        ptm_polygon* polygon = sorted_polygons[i];
+
+        if (mesh->vertex_count > 0 && mesh->vertex_count + polygon->vertex_count > max_vertices) {
+          ptm_mesh* chunk = (ptm_mesh*)PTM_APUSH(arena, sizeof *chunk);
+          ptm__zero_memory(chunk, sizeof *chunk);
+          chunk->texture_name = mesh->texture_name;
+          chunk->cluster = mesh->cluster;
+          chunk->next = mesh->next;
+          mesh->next = chunk;
+          entity->mesh_count++;
+
+          if (chunk->cluster != NULL) {
+            chunk->cluster->mesh_count++;
+          }
+
+          max_vertex_count = mesh->vertex_count > max_vertex_count ? mesh->vertex_count : max_vertex_count;
+          mesh_ends[mesh_index++] = i;
+          mesh = chunk;
+        }
+
+        mesh->vertex_count += polygon->vertex_count;
+        mesh->index_count += (polygon->vertex_count - 2) * 3;
+      }
+    }
+
+    max_vertex_count = mesh->vertex_count > max_vertex_count ? mesh->vertex_count : max_vertex_count;
+    mesh_ends[mesh_index++] = last;
+    first = last;
+  }
+
+  // Step four: build each mesh, sharing vertices that are exactly the 
+  // same through a table (of vertex + 1, or 0 if unused) that is never
+  // more than half full. It's reused for every mesh, so sized for the biggest.
+  int vertex_slot_capacity = 16;
+
+  while (vertex_slot_capacity < max_vertex_count * 2) {
+    vertex_slot_capacity *= 2;
+  }
+
+  int* vertex_slots = (int*)PTM_APUSH(scratch, vertex_slot_capacity * (int)sizeof(int));
+  int* polygon_vertices = (int*)PTM_APUSH(scratch, max_polygon_size * (int)sizeof(int));
+  mesh_index = 0;
+  first = 0;
+
+  for (ptm_mesh* mesh = entity->meshes; mesh != NULL; mesh = mesh->next) {
+    int last = mesh_ends[mesh_index++];
+    int vertex_slot_count = 16;
+
+    while (vertex_slot_count < mesh->vertex_count * 2) {
+      vertex_slot_count *= 2;
+    }
+
+    ptm__zero_memory(vertex_slots, vertex_slot_count * (int)sizeof(int));
+
+    // Buffers are sized as if no vertices were shared, which is cheaper
+    // than building the mesh elsewhere and copying it into the arena.
+    // The counts are reset so they can be used as write cursors.
+    int vertex_count = mesh->vertex_count;
+    mesh->vertex_positions = (PTM_REAL*)PTM_APUSH(arena, sizeof(PTM_REAL) * 3 * vertex_count);
+    mesh->vertex_texcoords = (PTM_REAL*)PTM_APUSH(arena, sizeof(PTM_REAL) * 2 * vertex_count);
+    mesh->vertex_normals = (PTM_REAL*)PTM_APUSH(arena, sizeof(PTM_REAL) * 3 * vertex_count);
+    mesh->vertex_tangents = (PTM_REAL*)PTM_APUSH(arena, sizeof(PTM_REAL) * 4 * vertex_count);
+    mesh->indices = (PTM_INDEX*)PTM_APUSH(arena, sizeof(PTM_INDEX) * mesh->index_count);
+    mesh->vertex_count = 0;
+    mesh->index_count = 0;
+
+    for (int i = first; i < last; i++) {
+      ptm_polygon* polygon = sorted_polygons[i];
+      ptm_brush_face* brush_face = polygon->face;
+
+      // These attributes are constant across the face
+      PTM_REAL normal[3];
+      PTM_REAL tangent[3];
+      PTM_REAL bitangent[3];
+      ptm__normalize_vec3(brush_face->plane_normal, normal);
+      ptm__normalize_vec3(brush_face->texture_uv[0], tangent);
+      ptm__cross_vec3(normal, tangent, bitangent);
+      PTM_REAL handedness = ptm__dot_vec3(bitangent, brush_face->texture_uv[1]) < 0 ? -1 : 1;
+      PTM_REAL scale_u = brush_face->texture_scale[0] != 0 ? brush_face->texture_scale[0] : 1;
+      PTM_REAL scale_v = brush_face->texture_scale[1] != 0 ? brush_face->texture_scale[1] : 1;
+
+      for (int k = 0; k < polygon->vertex_count; k++) {
+        PTM_REAL* position = &polygon->positions[k * 3];
+        int vertex = mesh->vertex_count;
+
+        ptm__copy_memory(&mesh->vertex_positions[vertex * 3], position, sizeof(PTM_REAL) * 3);
+        ptm__copy_memory(&mesh->vertex_normals[vertex * 3], normal, sizeof(PTM_REAL) * 3);
+        ptm__copy_memory(&mesh->vertex_tangents[vertex * 4], tangent, sizeof(PTM_REAL) * 3);
+        mesh->vertex_tangents[vertex * 4 + 3] = handedness;
+
+        // Texture coordinates are in texels: divide by the 
+        // texture's size to get normalized coordinates.
+        PTM_REAL u = ptm__dot_vec3(position, brush_face->texture_uv[0]);
+        PTM_REAL v = ptm__dot_vec3(position, brush_face->texture_uv[1]);
+        mesh->vertex_texcoords[vertex * 2 + 0] = u / scale_u + brush_face->texture_offset[0];
+        mesh->vertex_texcoords[vertex * 2 + 1] = v / scale_v + brush_face->texture_offset[1];
+
+        polygon_vertices[k] = ptm__add_mesh_vertex(mesh, vertex_slots, vertex_slot_count);
+      }
+
+      for (int k = 1; k < polygon->vertex_count - 1; k++) {
+        mesh->indices[mesh->index_count++] = (PTM_INDEX)polygon_vertices[0];
+        mesh->indices[mesh->index_count++] = (PTM_INDEX)polygon_vertices[k];
+        mesh->indices[mesh->index_count++] = (PTM_INDEX)polygon_vertices[k + 1];
+      }
+    }
+
+    PTM_ASSERT(mesh->vertex_count <= max_vertices);
+
+    ptm__copy_memory(mesh->bounds_min, mesh->vertex_positions, sizeof mesh->bounds_min);
+    ptm__copy_memory(mesh->bounds_max, mesh->vertex_positions, sizeof mesh->bounds_max);
+
+    for (int i = 1; i < mesh->vertex_count; i++) {
+      for (int j = 0; j < 3; j++) {
+        PTM_REAL value = mesh->vertex_positions[i * 3 + j];
+        mesh->bounds_min[j] = value < mesh->bounds_min[j] ? value : mesh->bounds_min[j];
+        mesh->bounds_max[j] = value > mesh->bounds_max[j] ? value : mesh->bounds_max[j];
+      }
+    }
+
+    first = last;
+  }
+
+  // Every cluster has at least one mesh: it was made for a brush with polygons
+  for (int i = 0; i < entity->cluster_count; i++) {
+    ptm_cluster* cluster = &entity->clusters[i];
+    ptm_mesh* mesh = cluster->meshes;
+    ptm__copy_memory(cluster->bounds_min, mesh->bounds_min, sizeof cluster->bounds_min);
+    ptm__copy_memory(cluster->bounds_max, mesh->bounds_max, sizeof cluster->bounds_max);
+
+    for (int j = 1; j < cluster->mesh_count; j++) {
+      mesh = mesh->next;
+
+      for (int k = 0; k < 3; k++) {
+        cluster->bounds_min[k] = mesh->bounds_min[k] < cluster->bounds_min[k] ? mesh->bounds_min[k] : cluster->bounds_min[k];
+        cluster->bounds_max[k] = mesh->bounds_max[k] > cluster->bounds_max[k] ? mesh->bounds_max[k] : cluster->bounds_max[k];
+      }
+    }
+  }
+
+  PTM_AFREE(scratch);
+}
+
+static void ptm__create_clusters(ptm_entity* entity, ptm_brush_polygons* brushes, PTM_REAL cluster_size, int* brush_clusters, void* scratch, void* arena) {
+  // Cells are found with an open-addressing table (of cluster + 1, or 
+  // 0 if unused) over each cluster's cell, and numbered in brush order.
+  int slot_count = 16;
+
+  while (slot_count < entity->brush_count * 2) {
+    slot_count *= 2;
+  }
+
+  int* slots = (int*)PTM_APUSH(scratch, slot_count * (int)sizeof(int));
+  int* cells = (int*)PTM_APUSH(scratch, entity->brush_count * 3 * (int)sizeof(int));
+  ptm__zero_memory(slots, slot_count * (int)sizeof(int));
+
+  for (int i = 0; i < entity->brush_count; i++) {
+    brush_clusters[i] = -1;
+
+    if (brushes[i].polygon_count == 0) {
+      continue;
+    }
+
+    PTM_REAL min[3];
+    PTM_REAL max[3];
+    ptm__copy_memory(min, brushes[i].polygons[0].positions, sizeof min);
+    ptm__copy_memory(max, brushes[i].polygons[0].positions, sizeof max);
+
+    for (int j = 0; j < brushes[i].polygon_count; j++) {
+      ptm_polygon* polygon = &brushes[i].polygons[j];
+
+      for (int k = 0; k < polygon->vertex_count * 3; k++) {
+        PTM_REAL value = polygon->positions[k];
+        min[k % 3] = value < min[k % 3] ? value : min[k % 3];
+        max[k % 3] = value > max[k % 3] ? value : max[k % 3];
+      }
+    }
+
+    int cell[3];
+
+    for (int j = 0; j < 3; j++) {
+      PTM_REAL center = (min[j] + max[j]) / (PTM_REAL)2 / cluster_size;
+      cell[j] = (int)center - (center < (int)center);
+    }
+
+    unsigned int hash = (unsigned int)cell[0] * 73856093u ^ (unsigned int)cell[1] * 19349663u ^ (unsigned int)cell[2] * 83492791u;
+    int index = (int)(hash & (unsigned int)(slot_count - 1));
+
+    for (;;) {
+      if (slots[index] == 0) {
+        ptm__copy_memory(&cells[entity->cluster_count * 3], cell, sizeof cell);
+        slots[index] = ++entity->cluster_count;
+        break;
+      }
+
+      int* found = &cells[(slots[index] - 1) * 3];
+
+      if (found[0] == cell[0] && found[1] == cell[1] && found[2] == cell[2]) {
+        break;
+      }
+
+      index = (index + 1) & (slot_count - 1);
+    }
+
+    brush_clusters[i] = slots[index] - 1;
+  }
+
+  if (entity->cluster_count == 0) {
+    return;
+  }
+
+  int clusters_size = entity->cluster_count * (int)sizeof(ptm_cluster);
+  entity->clusters = (ptm_cluster*)PTM_APUSH(arena, clusters_size);
+  ptm__zero_memory(entity->clusters, clusters_size);
+
+  for (int i = 0; i < entity->cluster_count; i++) {
+    ptm__copy_memory(entity->clusters[i].cell, &cells[i * 3], sizeof entity->clusters[i].cell);
+  }
+}
+
+static void ptm__sort_clusters(ptm_entity* entity, ptm_mesh** tails) {
+  // Relink the meshes so each cluster's are next to each other, in
+  // the order they were made, and the clusters follow in order too.
+  for (ptm_mesh* mesh = entity->meshes; mesh != NULL;) {
+    ptm_mesh* next = mesh->next;
+    ptm_cluster* cluster = mesh->cluster;
+    int index = (int)(cluster - entity->clusters);
+
+    if (cluster->meshes == NULL) cluster->meshes = mesh;
+    else tails[index]->next = mesh;
+    tails[index] = mesh;
+    cluster->mesh_count++;
+    mesh = next;
+  }
+
+  for (int i = 0; i < entity->cluster_count; i++) {
+    tails[i]->next = i + 1 < entity->cluster_count ? entity->clusters[i + 1].meshes : NULL;
+  }
+
+  entity->meshes = entity->clusters[0].meshes;
+}
+
+static void ptm__sort_polygons(ptm_polygon** polygons, int count, void* scratch) {
+  // Sort by the Morton code of each polygon's first vertex (its bits
+  // interleave x, y and z, 10 each) in the polygons' bounds: polygons 
+  // next to each other in the order are then close in space too.
+  PTM_REAL min[3];
+  PTM_REAL max[3];
+  ptm__copy_memory(min, polygons[0]->positions, sizeof min);
+  ptm__copy_memory(max, polygons[0]->positions, sizeof max);
+
+  for (int i = 1; i < count; i++) {
+    for (int j = 0; j < 3; j++) {
+      PTM_REAL value = polygons[i]->positions[j];
+      min[j] = value < min[j] ? value : min[j];
+      max[j] = value > max[j] ? value : max[j];
+    }
+  }
+
+  unsigned int* keys = (unsigned int*)PTM_APUSH(scratch, count * 2 * (int)sizeof(unsigned int));
+  ptm_polygon** sorted = (ptm_polygon**)PTM_APUSH(scratch, count * (int)sizeof(ptm_polygon*));
+  unsigned int* sorted_keys = &keys[count];
+
+  for (int i = 0; i < count; i++) {
+    unsigned int code = 0;
+
+    for (int j = 0; j < 3; j++) {
+      PTM_REAL extent = max[j] - min[j];
+      PTM_REAL t = extent > 0 ? (polygons[i]->positions[j] - min[j]) / extent : 0;
+      code |= ptm__spread_bits((unsigned int)(t * 1023)) << j;
+    }
+
+    keys[i] = code;
+  }
+
+  // A stable radix sort, a byte at a time (the top two bits are zero),
+  // keeps polygons with the same code in brush order.
+  for (int shift = 0; shift < 32; shift += 8) {
+    int counts[256] = {0};
+
+    for (int i = 0; i < count; i++) {
+      counts[(keys[i] >> shift) & 0xff]++;
+    }
+
+    int total = 0;
+
+    for (int i = 0; i < 256; i++) {
+      int bucket_count = counts[i];
+      counts[i] = total;
+      total += bucket_count;
+    }
+
+    for (int i = 0; i < count; i++) {
+      int index = counts[(keys[i] >> shift) & 0xff]++;
+      sorted[index] = polygons[i];
+      sorted_keys[index] = keys[i];
+    }
+
+    ptm__copy_memory(polygons, sorted, count * (int)sizeof(ptm_polygon*));
+    ptm__copy_memory(keys, sorted_keys, count * (int)sizeof(unsigned int));
+  }
+}
+
+static unsigned int ptm__spread_bits(unsigned int bits) {
+  // Put two zero bits between each of the low 10 bits
+  bits &= 0x3ff;
+  bits = (bits | (bits << 16)) & 0x030000ff;
+  bits = (bits | (bits << 8)) & 0x0300f00f;
+  bits = (bits | (bits << 4)) & 0x030c30c3;
+  bits = (bits | (bits << 2)) & 0x09249249;
+  return bits;
+}
+
+static int ptm__clip_brush(ptm_brush* brush, ptc_mesh* hull, ptc_plane* planes, void** faces) {
+  // A brush is the intersection of all its face planes: start with a 
+  // box the size of the world, and cut it down by each plane.
+  PTC_REAL min[3] = {-PTM_WORLD_EXTENT, -PTM_WORLD_EXTENT, -PTM_WORLD_EXTENT};
+  PTC_REAL max[3] = {PTM_WORLD_EXTENT, PTM_WORLD_EXTENT, PTM_WORLD_EXTENT};
+  ptc_init_bounds(hull, min, max);
+  int plane_count = 0;
+
+  for (ptm_brush_face* face = brush->faces; face != NULL; face = face->next) {
+    // Face planes are already unit length, as the clipper's epsilon 
+    // (in world units) needs. Points in a line don't make a plane.
+    if (face->plane_normal[0] == 0 && face->plane_normal[1] == 0 && face->plane_normal[2] == 0) {
+      continue;
+    }
+
+    ptc_plane* plane = &planes[plane_count];
+    plane->normal[0] = (PTC_REAL)face->plane_normal[0];
+    plane->normal[1] = (PTC_REAL)face->plane_normal[1];
+    plane->normal[2] = (PTC_REAL)face->plane_normal[2];
+    plane->c = (PTC_REAL)face->plane_c;
+    faces[plane_count++] = face;
+  }
+
+  return ptc_clip_planes(hull, planes, plane_count, faces);
+}
+
+static int ptm__is_hull_closed(ptc_mesh* hull) {
+  // If any side of the initial box survived, the brush planes never 
+  // enclosed a volume (or enclosed nothing at all): skip the brush.
+  int visible_count = 0;
+
+  for (int i = 0; i < hull->face_count; i++) {
+    ptc_face* face = &hull->faces[i];
+
+    if (face->is_clipped) {
+      continue;
+    }
+    if (face->userdata == NULL) {
+      return 0;
+    }
+
+    visible_count++;
+  }
+
+  return visible_count >= 4;
+}
+
+static int ptm__is_face_visible(ptc_face* face) {
+  return !face->is_clipped && face->userdata != NULL && face->edge_count >= 3;
+}
+
+static void ptm__weld_hull(ptc_mesh* hull, int* welds, PTM_REAL* positions) {
+  // Clipping leaves corners a little off the integer grid brushes are
+  // usually drawn on, and splits that should meet a little apart.
+  // Snap coordinates back onto the grid, and weld vertices that still
+  // (nearly) touch into one, so they can't make sliver polygons.
+  // Welds has room for twice the vertices: the live ones go at the end.
+  const PTM_REAL EPSILON = PTM_WELD_EPSILON;
+  int* live = &welds[hull->vertex_count];
+  int live_count = 0;
+
+  for (int i = 0; i < hull->vertex_count; i++) {
+    PTM_REAL* position = &positions[i * 3];
+    position[0] = (PTM_REAL)hull->vertex_x[i];
+    position[1] = (PTM_REAL)hull->vertex_y[i];
+    position[2] = (PTM_REAL)hull->vertex_z[i];
+    welds[i] = i;
+
+    if ((hull->vertex_clipped[i >> 5] >> (i & 31)) & 1) {
+      continue;
+    }
+
+    for (int j = 0; j < 3; j++) {
+      PTM_REAL rounded = ptm__round_real(position[j]);
+      PTM_REAL offset = position[j] - rounded;
+
+      if (offset < EPSILON && offset > -EPSILON) {
+        position[j] = rounded;
+      }
+    }
+
+    // Hulls are small, so this is cheaper than anything cleverer
+    for (int k = 0; k < live_count; k++) {
+      PTM_REAL* other = &positions[live[k] * 3];
+      PTM_REAL d[3];
+      ptm__subtract_vec3(position, other, d);
+
+      if (d[0] < EPSILON && d[0] > -EPSILON && d[1] < EPSILON && d[1] > -EPSILON && d[2] < EPSILON && d[2] > -EPSILON) {
+        welds[i] = live[k];
+        break;
+      }
+    }
+
+    if (welds[i] == i) {
+      live[live_count++] = i;
+    }
+  }
+}
+
+static int ptm__add_mesh_vertex(ptm_mesh* mesh, int* slots, int slot_count) {
+  // The new vertex has just been written past the end of the mesh. If 
+  // the mesh already has one exactly like it, that one is shared and 
+  // the new one is left to be overwritten.
+  int vertex = mesh->vertex_count;
+  PTM_REAL* position = &mesh->vertex_positions[vertex * 3];
+  PTM_REAL* normal = &mesh->vertex_normals[vertex * 3];
+  PTM_REAL* tangent = &mesh->vertex_tangents[vertex * 4];
+  PTM_REAL* texcoord = &mesh->vertex_texcoords[vertex * 2];
+
+  // Equal vertices must hash the same. Positions are mostly integers, 
+  // and a corner is usually shared by faces that differ in their normal.
+  PTM_HASH hash = (PTM_HASH)(long long)position[0] * 73856093u ^ (PTM_HASH)(long long)position[1] * 19349663u ^ (PTM_HASH)(long long)position[2] * 83492791u;
+  hash ^= (PTM_HASH)(long long)(normal[0] * 1024) * 2654435761u ^ (PTM_HASH)(long long)(normal[1] * 1024) * 40503u ^ (PTM_HASH)(long long)(normal[2] * 1024) * 2246822519u;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  int mask = slot_count - 1;
+  int index = (int)(hash & (PTM_HASH)mask);
+
+  // Linear probing, with the table never more than half full
+  for (;;) {
+    int other = slots[index] - 1;
+
+    if (other == -1) {
+      break;
+    }
+
+    {
+      PTM_REAL* other_position = &mesh->vertex_positions[other * 3];
+      PTM_REAL* other_normal = &mesh->vertex_normals[other * 3];
+      PTM_REAL* other_tangent = &mesh->vertex_tangents[other * 4];
+      PTM_REAL* other_texcoord = &mesh->vertex_texcoords[other * 2];
+
+      if (position[0] == other_position[0] && position[1] == other_position[1] && position[2] == other_position[2] &&
+          normal[0] == other_normal[0] && normal[1] == other_normal[1] && normal[2] == other_normal[2] &&
+          tangent[0] == other_tangent[0] && tangent[1] == other_tangent[1] && tangent[2] == other_tangent[2] && tangent[3] == other_tangent[3] &&
+          texcoord[0] == other_texcoord[0] && texcoord[1] == other_texcoord[1]) {
+        return other;
+      }
+    }
+
+    index = (index + 1) & mask;
+  }
+
+  slots[index] = vertex + 1;
+  mesh->vertex_count++;
+  return vertex;
+}
+
+// Opposite faces of touching brushes are on the same plane, so they 
+// are bucketed by a key of their plane, flipped to face one way, and 
+// rounded coarsely (keys that still disagree just don't cull). Only
+// the ones that really are on the same plane can cover each other.
+#define PTM__CULL_MAX_FRAGMENTS 64
+
+static void ptm__cull_hidden_faces(ptm_entity* entity, ptm_brush_polygons* brushes) {
+  int polygon_count = 0;
+  int max_polygon_size = 0;
+
+  for (int i = 0; i < entity->brush_count; i++) {
+    polygon_count += brushes[i].polygon_count;
+
+    for (int j = 0; j < brushes[i].polygon_count; j++) {
+      int vertex_count = brushes[i].polygons[j].vertex_count;
+      max_polygon_size = vertex_count > max_polygon_size ? vertex_count : max_polygon_size;
+    }
+  }
+
+  if (polygon_count == 0) {
+    return;
+  }
+
+  int bucket_count = 16;
+
+  while (bucket_count < polygon_count) {
+    bucket_count *= 2;
+  }
+
+  // Cutting a polygon by another's edges adds at most one vertex per
+  // edge: fragments never have more than twice the biggest polygon.
+  int fragment_size = max_polygon_size * 2 + 2;
+  int fragments_size = (PTM__CULL_MAX_FRAGMENTS * 2 + 2) * fragment_size * 3 * (int)sizeof(PTM_REAL);
+  int sorted_size = polygon_count * (int)sizeof(ptm_cull_polygon);
+  int buckets_size = (bucket_count + 1) * (int)sizeof(int);
+  int polygon_buckets_size = polygon_count * (int)sizeof(int);
+  void* scratch = PTM_ACREATE(sorted_size + buckets_size + polygon_buckets_size + polygon_count + fragments_size);
+  ptm_cull_polygon* sorted = (ptm_cull_polygon*)PTM_APUSH(scratch, sorted_size);
+  int* bucket_starts = (int*)PTM_APUSH(scratch, buckets_size);
+  int* polygon_buckets = (int*)PTM_APUSH(scratch, polygon_buckets_size);
+  PTM_REAL* fragments = (PTM_REAL*)PTM_APUSH(scratch, fragments_size);
+  char* is_dropped = (char*)PTM_APUSH(scratch, polygon_count);
+  ptm__zero_memory(bucket_starts, buckets_size);
+
+  // Step one: find every polygon's bucket, by a hash of its plane key.
+  // Tool textures are never drawn, so they're dropped straight away.
+  int index = 0;
+
+  for (int i = 0; i < entity->brush_count; i++) {
+    for (int j = 0; j < brushes[i].polygon_count; j++) {
+      ptm_polygon* polygon = &brushes[i].polygons[j];
+      is_dropped[index] = (char)ptm__is_tool_texture(polygon->face->texture_name);
+      polygon_buckets[index] = -1;
+
+      if (!is_dropped[index]) {
+        int key[4];
+        ptm__get_plane_key(polygon->face, key);
+        PTM_HASH hash = (PTM_HASH)key[0] * 73856093u ^ (PTM_HASH)key[1] * 19349663u ^ 
+          (PTM_HASH)key[2] * 83492791u ^ (PTM_HASH)key[3] * 2654435761u;
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6bu;
+        hash ^= hash >> 13;
+        polygon_buckets[index] = (int)(hash & (PTM_HASH)(bucket_count - 1));
+        bucket_starts[polygon_buckets[index] + 1]++;
+      }
+
+      index++;
+    }
+  }
+
+  // Step two: sort them by bucket, so the polygons that could cover 
+  // each other are all in one run. Each bucket's start moves up to its
+  // end as it's filled.
+  for (int i = 0; i < bucket_count; i++) {
+    bucket_starts[i + 1] += bucket_starts[i];
+  }
+
+  index = 0;
+
+  for (int i = 0; i < entity->brush_count; i++) {
+    for (int j = 0; j < brushes[i].polygon_count; j++, index++) {
+      if (polygon_buckets[index] == -1) {
+        continue;
+      }
+
+      ptm_polygon* polygon = &brushes[i].polygons[j];
+      ptm_cull_polygon* cull = &sorted[bucket_starts[polygon_buckets[index]]++];
+      cull->polygon = polygon;
+      cull->index = index;
+
+      for (int l = 0; l < 3; l++) {
+        cull->min[l] = polygon->positions[l];
+        cull->max[l] = polygon->positions[l];
+      }
+
+      for (int k = 1; k < polygon->vertex_count; k++) {
+        for (int l = 0; l < 3; l++) {
+          PTM_REAL value = polygon->positions[k * 3 + l];
+          cull->min[l] = value < cull->min[l] ? value : cull->min[l];
+          cull->max[l] = value > cull->max[l] ? value : cull->max[l];
+        }
+      }
+    }
+  }
+
+  // Step three: find what is covered. Polygons only ever hide each other
+  // as they were clipped, so this doesn't depend on the order.
+  int first = 0;
+
+  for (int i = 0; i < bucket_count; i++) {
+    int last = bucket_starts[i];
+
+    for (int j = first; j < last; j++) {
+      if (ptm__is_polygon_covered(&sorted[j], &sorted[first], &sorted[last], fragments, fragment_size)) {
+        is_dropped[sorted[j].index] = 1;
+      }
+    }
+
+    first = last;
+  }
+
+  // Step four: drop them, keeping the rest of each brush in order
+  index = 0;
+
+  for (int i = 0; i < entity->brush_count; i++) {
+    int count = 0;
+
+    for (int j = 0; j < brushes[i].polygon_count; j++) {
+      if (!is_dropped[index++]) {
+        brushes[i].polygons[count++] = brushes[i].polygons[j];
+      }
+    }
+
+    brushes[i].polygon_count = count;
+  }
+
+  PTM_AFREE(scratch);
+}
+
+static int ptm__is_tool_texture(ptm_string texture_name) {
+  // Tool textures can be in a folder, like "common/skip"
+  const char* name = texture_name.data;
+  int length = texture_name.length;
+
+  for (int i = texture_name.length - 1; i >= 0; i--) {
+    if (texture_name.data[i] == '/') {
+      name = &texture_name.data[i + 1];
+      length = texture_name.length - i - 1;
+      break;
+    }
+  }
+
+  return (length == 4 && ptm__compare_memory(name, "skip", 4)) ||
+         (length == 4 && ptm__compare_memory(name, "clip", 4)) ||
+         (length == 10 && ptm__compare_memory(name, "__TB_empty", 10));
+}
+
+static void ptm__get_plane_key(ptm_brush_face* face, int* key) {
+  // Flip the plane so its biggest normal component is positive: an 
+  // opposite plane has the same biggest component, so gets the same key.
+  PTM_REAL* normal = face->plane_normal;
+  int axis = 0;
+
+  for (int i = 1; i < 3; i++) {
+    PTM_REAL value = normal[i] < 0 ? -normal[i] : normal[i];
+    PTM_REAL biggest = normal[axis] < 0 ? -normal[axis] : normal[axis];
+    axis = value > biggest ? i : axis;
+  }
+
+  PTM_REAL sign = normal[axis] < 0 ? -1 : 1;
+  key[0] = (int)ptm__round_real(normal[0] * sign * 64);
+  key[1] = (int)ptm__round_real(normal[1] * sign * 64);
+  key[2] = (int)ptm__round_real(normal[2] * sign * 64);
+  key[3] = (int)ptm__round_real(face->plane_c * sign);
+}
+
+static int ptm__is_on_opposite_plane(const ptm_brush_face* face, const ptm_polygon* cover) {
+  // The same plane is often written with different points, so normals
+  // only nearly match: the cover's corners being on this face's plane
+  // is what matters, and the normals just have to face each other.
+  const PTM_REAL EPSILON = PTM_WELD_EPSILON;
+  const PTM_REAL* normal = face->plane_normal;
+  const PTM_REAL* cover_normal = cover->face->plane_normal;
+  PTM_REAL c_sum = face->plane_c + cover->face->plane_c;
+
+  if (c_sum > EPSILON || c_sum < -EPSILON) {
+    return 0;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    PTM_REAL sum = normal[i] + cover_normal[i];
+
+    if (sum > (PTM_REAL)0.001f || sum < (PTM_REAL)-0.001f) {
+      return 0;
+    }
+  }
+
+  for (int i = 0; i < cover->vertex_count; i++) {
+    PTM_REAL distance = ptm__dot_vec3(normal, &cover->positions[i * 3]) - face->plane_c;
+
+    if (distance > EPSILON || distance < -EPSILON) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int ptm__is_polygon_covered(ptm_cull_polygon* cull, ptm_cull_polygon* first, ptm_cull_polygon* last, PTM_REAL* fragments, int fragment_size) {
+  // Subtract every opposite polygon that overlaps this one from it, one
+  // at a time: it's covered if nothing is left. What's left is kept as
+  // convex fragments, cut along the edges of the polygons subtracted.
+  // Too many fragments (or vertices) just leave the polygon in.
+  const PTM_REAL EPSILON = PTM_WELD_EPSILON;
+  ptm_brush_face* face = cull->polygon->face;
+  int stride = fragment_size * 3;
+  PTM_REAL* current = fragments;
+  PTM_REAL* next = &fragments[PTM__CULL_MAX_FRAGMENTS * stride];
+  PTM_REAL* pieces = &fragments[PTM__CULL_MAX_FRAGMENTS * 2 * stride];
+  int current_sizes[PTM__CULL_MAX_FRAGMENTS];
+  int next_sizes[PTM__CULL_MAX_FRAGMENTS];
+  int current_count = 1;
+  current_sizes[0] = cull->polygon->vertex_count;
+  ptm__copy_memory(current, cull->polygon->positions, cull->polygon->vertex_count * 3 * (int)sizeof(PTM_REAL));
+
+  for (ptm_cull_polygon* cover = first; cover != last; cover++) {
+    ptm_brush_face* cover_face = cover->polygon->face;
+
+    // Only polygons overlapping this one, on the same plane and facing
+    // the other way, can cover any of it
+    if (cover->min[0] > cull->max[0] + EPSILON || cover->max[0] < cull->min[0] - EPSILON ||
+        cover->min[1] > cull->max[1] + EPSILON || cover->max[1] < cull->min[1] - EPSILON ||
+        cover->min[2] > cull->max[2] + EPSILON || cover->max[2] < cull->min[2] - EPSILON) {
+      continue;
+    }
+
+    if (!ptm__is_on_opposite_plane(face, cover->polygon)) {
+      continue;
+    }
+
+    PTM_REAL* cover_positions = cover->polygon->positions;
+    int cover_count = cover->polygon->vertex_count;
+    int next_count = 0;
+
+    for (int i = 0; i < current_count; i++) {
+      // Cut the fragment along each of the cover's edges: what's outside
+      // an edge is left over, what's inside goes on to the next edge.
+      PTM_REAL* remaining = &current[i * stride];
+      int remaining_count = current_sizes[i];
+      int is_apart = 0;
+
+      // Most fragments are nowhere near the cover: keep them whole
+      for (int j = 0; j < 3 && !is_apart; j++) {
+        PTM_REAL min = remaining[j];
+        PTM_REAL max = remaining[j];
+
+        for (int k = 1; k < remaining_count; k++) {
+          PTM_REAL value = remaining[k * 3 + j];
+          min = value < min ? value : min;
+          max = value > max ? value : max;
+        }
+
+        // Along a flat axis (that the plane faces) everything touches
+        is_apart = max - min > EPSILON && (cover->min[j] > max - EPSILON || cover->max[j] < min + EPSILON);
+      }
+
+      if (is_apart) {
+        if (next_count == PTM__CULL_MAX_FRAGMENTS) {
+          return 0;
+        }
+
+        ptm__copy_memory(&next[next_count * stride], remaining, remaining_count * 3 * (int)sizeof(PTM_REAL));
+        next_sizes[next_count++] = remaining_count;
+        continue;
+      }
+
+      for (int k = 0; k < cover_count && remaining_count > 0; k++) {
+        // Polygons wind counter-clockwise around their normal, so 
+        // this points out of the cover, along its plane.
+        PTM_REAL* a = &cover_positions[k * 3];
+        PTM_REAL* b = &cover_positions[(k + 1 < cover_count ? k + 1 : 0) * 3];
+        PTM_REAL edge[3];
+        PTM_REAL normal[3];
+        ptm__subtract_vec3(b, a, edge);
+        ptm__cross_vec3(edge, cover_face->plane_normal, normal);
+        ptm__normalize_vec3(normal, normal);
+        PTM_REAL c = ptm__dot_vec3(normal, a);
+
+        if (next_count == PTM__CULL_MAX_FRAGMENTS) {
+          return 0;
+        }
+
+        PTM_REAL* inside = &pieces[(k & 1) * stride];
+        int inside_count = 0;
+        int outside_count = 0;
+
+        if (!ptm__split_polygon(remaining, remaining_count, normal, c, inside, &inside_count, 
+            &next[next_count * stride], &outside_count, fragment_size)) {
+          return 0;
+        }
+        if (outside_count > 0) {
+          next_sizes[next_count++] = outside_count;
+        }
+
+        remaining = inside;
+        remaining_count = inside_count;
+      }
+    }
+
+    PTM_REAL* swap = current;
+    current = next;
+    next = swap;
+    current_count = next_count;
+    ptm__copy_memory(current_sizes, next_sizes, next_count * (int)sizeof(int));
+
+    if (current_count == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int ptm__split_polygon(const PTM_REAL* positions, int count, const PTM_REAL* normal, PTM_REAL c,
+  PTM_REAL* inside, int* inside_count, PTM_REAL* outside, int* outside_count, int capacity) {
+  // Vertices within epsilon of the plane go to both sides, and a side
+  // is only kept if some vertex is clearly on it. Returns 0 if either
+  // side would have needed more than capacity vertices.
+  const PTM_REAL EPSILON = PTM_WELD_EPSILON;
+  int is_inside = 0;
+  int is_outside = 0;
+  *inside_count = 0;
+  *outside_count = 0;
+
+  for (int i = 0; i < count; i++) {
+    const PTM_REAL* p = &positions[i * 3];
+    const PTM_REAL* q = &positions[(i + 1 < count ? i + 1 : 0) * 3];
+    PTM_REAL dp = ptm__dot_vec3(normal, p) - c;
+    PTM_REAL dq = ptm__dot_vec3(normal, q) - c;
+
+    if (*inside_count + 2 > capacity || *outside_count + 2 > capacity) {
+      return 0;
+    }
+    if (dp <= EPSILON) {
+      PTM_REAL* point = &inside[(*inside_count)++ * 3];
+      point[0] = p[0];
+      point[1] = p[1];
+      point[2] = p[2];
+    }
+    if (dp >= -EPSILON) {
+      PTM_REAL* point = &outside[(*outside_count)++ * 3];
+      point[0] = p[0];
+      point[1] = p[1];
+      point[2] = p[2];
+    }
+
+    is_inside |= dp < -EPSILON;
+    is_outside |= dp > EPSILON;
+
+    // The edge crosses the plane: both sides get the crossing point
+    if ((dp < -EPSILON && dq > EPSILON) || (dp > EPSILON && dq < -EPSILON)) {
+      PTM_REAL t = dp / (dp - dq);
+      PTM_REAL* point = &inside[(*inside_count)++ * 3];
+      PTM_REAL* other = &outside[(*outside_count)++ * 3];
+
+      for (int j = 0; j < 3; j++) {
+        point[j] = p[j] + (q[j] - p[j]) * t;
+        other[j] = point[j];
+      }
+    }
+  }
+
+  if (!is_inside) *inside_count = 0;
+  if (!is_outside) *outside_count = 0;
+  return 1;
+}
+
+static ptm_mesh** ptm__find_mesh_slot(ptm_mesh** slots, int slot_count, ptm_string texture_name, ptm_cluster* cluster) {
+  int mask = slot_count - 1;
+  PTM_HASH hash = texture_name.hash ^ (PTM_HASH)((uintptr_t)cluster / sizeof *cluster * 2654435761u);
+  int index = (int)(hash & (PTM_HASH)mask);
+
+  // Linear probing: the table is never more than half full, 
+  // so we always reach either the match or an empty slot.
+  for (;;) {
+    ptm_mesh* mesh = slots[index];
+
+    if (mesh == NULL) {
+      return &slots[index];
+    }
+    if (mesh->texture_name.hash == texture_name.hash && mesh->texture_name.data == texture_name.data && mesh->cluster == cluster) {
+      return &slots[index];
+    }
+
+    index = (index + 1) & mask;
+  }
+}
+
+static void ptm__interleave_meshes(ptm_entity* entity, const ptm_load_options* options, void* arena) {
+  int stride = ptm_get_vertex_layout(options->vertex_format, options->vertex_stride).stride;
+
+  for (ptm_mesh* mesh = entity->meshes; mesh != NULL; mesh = mesh->next) {
+    mesh->vertices = PTM_APUSH(arena, mesh->vertex_count * stride);
+    mesh->vertex_format = options->vertex_format;
+    mesh->vertex_stride = stride;
+    ptm_write_vertices(mesh, options->vertex_format, stride, mesh->vertices);
+  }
+}
+
+// === VERTICES ===
+
+static unsigned short ptm__float_to_half(float value) {
+  // Rounded to nearest even, like a hardware conversion would
+  unsigned int bits;
+  ptm__copy_memory(&bits, &value, sizeof bits);
+  unsigned int sign = (bits >> 16) & 0x8000;
+  unsigned int magnitude = bits & 0x7fffffff;
+
+  // Infinity and NaN (which stays a NaN), then what rounds past 65504
+  if (magnitude >= 0x7f800000) {
+    return (unsigned short)(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+  }
+  if (magnitude >= 0x477ff000) {
+    return (unsigned short)(sign | 0x7c00);
+  }
+
+  // Under 2^-14 it's a subnormal half: the mantissa is shifted down 
+  // (with its implicit bit), and under 2^-25 it rounds to zero
+  if (magnitude < 0x38800000) {
+    if (magnitude < 0x33000000) {
+      return (unsigned short)sign;
+    }
+
+    int shift = 126 - (int)(magnitude >> 23);
+    unsigned int mantissa = (magnitude & 0x7fffff) | 0x800000;
+    unsigned int half = mantissa >> shift;
+    unsigned int remainder = mantissa & ((1u << shift) - 1);
+    unsigned int halfway = 1u << (shift - 1);
+    half += remainder > halfway || (remainder == halfway && (half & 1));
+    return (unsigned short)(sign | half);
+  }
+
+  // Rebias the exponent from 127 to 15: rounding carries into it
+  unsigned int half = (magnitude - 0x38000000) >> 13;
+  unsigned int remainder = magnitude & 0x1fff;
+  half += remainder > 0x1000 || (remainder == 0x1000 && (half & 1));
+  return (unsigned short)(sign | half);
+}
+
+static int ptm__to_snorm(PTM_REAL value, int max) {
+  value = value < -1 ? -1 : value > 1 ? 1 : value;
+  return (int)(value * (PTM_REAL)max + (value < 0 ? (PTM_REAL)-0.5 : (PTM_REAL)0.5));
+}
+
+static void ptm__encode_octahedral(const PTM_REAL* direction, PTM_REAL* encoded) {
+  // Project onto the octahedron |x| + |y| + |z| = 1, then fold its 
+  // lower half over the upper one's corners
+  PTM_REAL x = direction[0];
+  PTM_REAL y = direction[1];
+  PTM_REAL z = direction[2];
+  PTM_REAL absolute_x = x < 0 ? -x : x;
+  PTM_REAL absolute_y = y < 0 ? -y : y;
+  PTM_REAL sum = absolute_x + absolute_y + (z < 0 ? -z : z);
+
+  if (sum <= 0) {
+    encoded[0] = encoded[1] = 0;
+    return;
+  }
+
+  x /= sum;
+  y /= sum;
+
+  if (z < 0) {
+    absolute_x = x < 0 ? -x : x;
+    absolute_y = y < 0 ? -y : y;
+    encoded[0] = (1 - absolute_y) * (x < 0 ? -1 : 1);
+    encoded[1] = (1 - absolute_x) * (y < 0 ? -1 : 1);
+  }
+  else {
+    encoded[0] = x;
+    encoded[1] = y;
+  }
+}
+
+// === FLATTENING ===
+
+static ptm_flat_map* ptm__flatten_map(ptm_map* map) {
+  ptm_flat_map* flat = (ptm_flat_map*)PTM_APUSH(map->arena, sizeof *flat);
+  ptm__zero_memory(flat, sizeof *flat);
+
+  // Count everything first, so each array is a single exact push
+  int face_count = 0;
+  int brush_count = 0;
+  int entity_count = 1;
+
+  for (ptm_brush* brush = map->world.brushes; brush != NULL; brush = brush->next) {
+    face_count += brush->face_count;
+  }
+  brush_count += map->world.brush_count;
+
+  for (ptm_entity_class* c = map->entity_classes; c != NULL; c = c->next) {
+    for (ptm_entity* entity = c->entities; entity != NULL; entity = entity->next) {
+      for (ptm_brush* brush = entity->brushes; brush != NULL; brush = brush->next) {
+        face_count += brush->face_count;
+      }
+      brush_count += entity->brush_count;
+    }
+    entity_count += c->entity_count;
+  }
+
+  int real_size = (int)sizeof(PTM_REAL);
+  flat->plane_normals = (PTM_REAL*)PTM_APUSH(map->arena, face_count * 3 * real_size);
+  flat->plane_cs = (PTM_REAL*)PTM_APUSH(map->arena, face_count * real_size);
+  flat->texture_names = (ptm_string*)PTM_APUSH(map->arena, face_count * (int)sizeof(ptm_string));
+  flat->texture_uvs = (PTM_REAL*)PTM_APUSH(map->arena, face_count * 6 * real_size);
+  flat->texture_offsets = (PTM_REAL*)PTM_APUSH(map->arena, face_count * 2 * real_size);
+  flat->texture_scales = (PTM_REAL*)PTM_APUSH(map->arena, face_count * 2 * real_size);
+  flat->brush_faces = (ptm_range*)PTM_APUSH(map->arena, brush_count * (int)sizeof(ptm_range));
+  flat->entities = (ptm_entity**)PTM_APUSH(map->arena, entity_count * (int)sizeof(ptm_entity*));
+  flat->entity_brushes = (ptm_range*)PTM_APUSH(map->arena, entity_count * (int)sizeof(ptm_range));
+  flat->class_entities = (ptm_range*)PTM_APUSH(map->arena, map->entity_class_count * (int)sizeof(ptm_range));
+
+  // The counts double as write cursors while filling
+  ptm__flatten_entity(flat, &map->world);
+
+  for (ptm_entity_class* c = map->entity_classes; c != NULL; c = c->next) {
+    ptm_range* range = &flat->class_entities[flat->class_count++];
+    range->first = flat->entity_count;
+    range->count = c->entity_count;
+
+    for (ptm_entity* entity = c->entities; entity != NULL; entity = entity->next) {
+      ptm__flatten_entity(flat, entity);
+    }
+  }
+
+  PTM_ASSERT(flat->face_count == face_count);
+  PTM_ASSERT(flat->brush_count == brush_count);
+  PTM_ASSERT(flat->entity_count == entity_count);
+  return flat;
+}
+
+static void ptm__flatten_entity(ptm_flat_map* flat, ptm_entity* entity) {
+  flat->entities[flat->entity_count] = entity;
+  ptm_range* brushes = &flat->entity_brushes[flat->entity_count++];
+  brushes->first = flat->brush_count;
+  brushes->count = entity->brush_count;
+
+  for (ptm_brush* brush = entity->brushes; brush != NULL; brush = brush->next) {
+    ptm_range* faces = &flat->brush_faces[flat->brush_count++];
+    faces->first = flat->face_count;
+    faces->count = brush->face_count;
+
+    for (ptm_brush_face* face = brush->faces; face != NULL; face = face->next) {
+      int i = flat->face_count++;
+      ptm__copy_memory(&flat->plane_normals[i * 3], face->plane_normal, 3 * (int)sizeof(PTM_REAL));
+      flat->plane_cs[i] = face->plane_c;
+      flat->texture_names[i] = face->texture_name;
+      ptm__copy_memory(&flat->texture_uvs[i * 6], face->texture_uv, 6 * (int)sizeof(PTM_REAL));
+      ptm__copy_memory(&flat->texture_offsets[i * 2], face->texture_offset, 2 * (int)sizeof(PTM_REAL));
+      ptm__copy_memory(&flat->texture_scales[i * 2], face->texture_scale, 2 * (int)sizeof(PTM_REAL));
+    }
+  }
+}
+
+// === COLLISION ===
+
+static ptm_collision* ptm__create_collision(ptm_entity* world, ptm_brush_polygons* brushes, void* arena) {
+  // Every world brush that clipped into a closed hull is solid. Its 
+  // planes are the faces it has polygons for, so planes that never cut
+  // it are left out, and its corners are the polygons' welded vertices.
+  ptm_collision* collision = (ptm_collision*)PTM_APUSH(arena, sizeof *collision);
+  ptm__zero_memory(collision, sizeof *collision);
+  int brush_count = 0;
+  int plane_count = 0;
+  int corner_count = 0;
+
+  for (int i = 0; i < world->brush_count; i++) {
+    if (brushes[i].polygon_count < 4) {
+      continue;
+    }
+
+    brush_count++;
+    plane_count += brushes[i].polygon_count;
+
+    for (int j = 0; j < brushes[i].polygon_count; j++) {
+      corner_count += brushes[i].polygons[j].vertex_count;
+    }
+  }
+
+  if (brush_count == 0) {
+    return collision;
+  }
+
+  // Corners are shared by several polygons: they're gathered here 
+  // first, and only copied into the map once there's one of each
+  int real_size = (int)sizeof(PTM_REAL);
+  int scratch_size = corner_count * 3 * real_size + brush_count * (6 * real_size + 3 * (int)sizeof(int) + 2 * (int)sizeof(ptm_collision_node));
+  void* scratch = PTM_ACREATE(scratch_size);
+  PTM_REAL* corners = (PTM_REAL*)PTM_APUSH(scratch, corner_count * 3 * real_size);
+  PTM_REAL* bounds = (PTM_REAL*)PTM_APUSH(scratch, brush_count * 6 * real_size);
+  int* brush_indices = (int*)PTM_APUSH(scratch, brush_count * (int)sizeof(int));
+  int* first_corners = (int*)PTM_APUSH(scratch, (brush_count + 1) * (int)sizeof(int));
+  int vertex_count = 0;
+  int brush = 0;
+
+  for (int i = 0; i < world->brush_count; i++) {
+    if (brushes[i].polygon_count < 4) {
+      continue;
+    }
+
+    int first = vertex_count;
+    PTM_REAL* brush_min = &bounds[brush * 6];
+    PTM_REAL* brush_max = &bounds[brush * 6 + 3];
+    brush_indices[brush] = i;
+    first_corners[brush++] = first;
+
+    for (int j = 0; j < brushes[i].polygon_count; j++) {
+      ptm_polygon* polygon = &brushes[i].polygons[j];
+
+      for (int k = 0; k < polygon->vertex_count; k++) {
+        const PTM_REAL* position = &polygon->positions[k * 3];
+        int is_new = 1;
+
+        // Welding already made shared corners exactly the same
+        for (int l = first; l < vertex_count && is_new; l++) {
+          is_new = !ptm__compare_memory(&corners[l * 3], position, 3 * real_size);
+        }
+
+        if (!is_new) {
+          continue;
+        }
+
+        for (int axis = 0; axis < 3; axis++) {
+          if (vertex_count == first || position[axis] < brush_min[axis]) brush_min[axis] = position[axis];
+          if (vertex_count == first || position[axis] > brush_max[axis]) brush_max[axis] = position[axis];
+        }
+
+        ptm__copy_memory(&corners[vertex_count * 3], position, 3 * real_size);
+        vertex_count++;
+      }
+    }
+  }
+
+  first_corners[brush_count] = vertex_count;
+
+  // Build the hierarchy over the brushes, which sorts them into leaves
+  ptm_collision_build build;
+  build.nodes = (ptm_collision_node*)PTM_APUSH(scratch, brush_count * 2 * (int)sizeof(ptm_collision_node));
+  build.node_count = 0;
+  build.order = (int*)PTM_APUSH(scratch, brush_count * (int)sizeof(int));
+  build.bounds = bounds;
+
+  for (int i = 0; i < brush_count; i++) {
+    build.order[i] = i;
+  }
+
+  ptm__build_collision_node(&build, 0, brush_count);
+
+  // Then write everything out in leaf order, each array in one push
+  collision->planes = (PTM_REAL*)PTM_APUSH(arena, plane_count * 4 * real_size);
+  collision->vertices = (PTM_REAL*)PTM_APUSH(arena, vertex_count * 3 * real_size);
+  collision->brush_planes = (ptm_range*)PTM_APUSH(arena, brush_count * (int)sizeof(ptm_range));
+  collision->brush_vertices = (ptm_range*)PTM_APUSH(arena, brush_count * (int)sizeof(ptm_range));
+  collision->brush_bounds = (PTM_REAL*)PTM_APUSH(arena, brush_count * 6 * real_size);
+  collision->brush_indices = (int*)PTM_APUSH(arena, brush_count * (int)sizeof(int));
+  collision->nodes = (ptm_collision_node*)PTM_APUSH(arena, build.node_count * (int)sizeof(ptm_collision_node));
+  collision->node_count = build.node_count;
+  collision->brush_count = brush_count;
+  ptm__copy_memory(collision->nodes, build.nodes, build.node_count * (int)sizeof(ptm_collision_node));
+
+  for (int i = 0; i < brush_count; i++) {
+    int source = build.order[i];
+    ptm_brush_polygons* polygons = &brushes[brush_indices[source]];
+    int first = first_corners[source];
+    int count = first_corners[source + 1] - first;
+
+    ptm_range* planes = &collision->brush_planes[i];
+    planes->first = collision->plane_count;
+    planes->count = polygons->polygon_count;
+
+    for (int j = 0; j < polygons->polygon_count; j++) {
+      PTM_REAL* plane = &collision->planes[collision->plane_count++ * 4];
+      ptm__copy_memory(plane, polygons->polygons[j].face->plane_normal, 3 * real_size);
+      plane[3] = polygons->polygons[j].face->plane_c;
+    }
+
+    ptm_range* vertices = &collision->brush_vertices[i];
+    vertices->first = collision->vertex_count;
+    vertices->count = count;
+    ptm__copy_memory(&collision->vertices[collision->vertex_count * 3], &corners[first * 3], count * 3 * real_size);
+    collision->vertex_count += count;
+
+    ptm__copy_memory(&collision->brush_bounds[i * 6], &bounds[source * 6], 6 * real_size);
+    collision->brush_indices[i] = brush_indices[source];
+  }
+
+  PTM_ASSERT(collision->plane_count == plane_count);
+  PTM_ASSERT(collision->vertex_count == vertex_count);
+  PTM_AFREE(scratch);
+  return collision;
+}
+
+static void ptm__build_collision_node(ptm_collision_build* build, int first, int count) {
+  // Top-down, splitting each node's brushes in half along the axis 
+  // their centers are spread the most on. Halving keeps the tree
+  // balanced (so shallow), and the split is fast to find.
+  int index = build->node_count++;
+  ptm_collision_node* node = &build->nodes[index];
+  PTM_REAL center_min[3];
+  PTM_REAL center_max[3];
+
+  for (int i = 0; i < count; i++) {
+    const PTM_REAL* bounds = &build->bounds[build->order[first + i] * 6];
+
+    for (int axis = 0; axis < 3; axis++) {
+      PTM_REAL center = bounds[axis] + bounds[axis + 3];
+
+      if (i == 0 || bounds[axis] < node->bounds_min[axis]) node->bounds_min[axis] = bounds[axis];
+      if (i == 0 || bounds[axis + 3] > node->bounds_max[axis]) node->bounds_max[axis] = bounds[axis + 3];
+      if (i == 0 || center < center_min[axis]) center_min[axis] = center;
+      if (i == 0 || center > center_max[axis]) center_max[axis] = center;
+    }
+  }
+
+  if (count <= PTM__COLLISION_LEAF_SIZE) {
+    node->first = first;
+    node->count = count;
+    return;
+  }
+
+  int axis = 0;
+
+  for (int i = 1; i < 3; i++) {
+    if (center_max[i] - center_min[i] > center_max[axis] - center_min[axis]) {
+      axis = i;
+    }
+  }
+
+  int half = count / 2;
+  ptm__select_brushes(build->order + first, count, half, build->bounds, axis);
+  node->count = 0;
+
+  ptm__build_collision_node(build, first, half);
+  build->nodes[index].first = build->node_count;
+  ptm__build_collision_node(build, first + half, count - half);
+}
+
+static void ptm__select_brushes(int* order, int count, int k, const PTM_REAL* bounds, int axis) {
+  // Quickselect: partially sort the brushes by center, so the k-th is 
+  // in place with the ones before it no further along the axis
+  #define PTM__CENTER(brush) (bounds[(brush) * 6 + axis] + bounds[(brush) * 6 + 3 + axis])
+  int left = 0;
+  int right = count - 1;
+
+  while (left < right) {
+    PTM_REAL pivot = PTM__CENTER(order[left + (right - left) / 2]);
+    int i = left;
+    int j = right;
+
+    while (i <= j) {
+      while (PTM__CENTER(order[i]) < pivot) i++;
+      while (PTM__CENTER(order[j]) > pivot) j--;
+
+      if (i <= j) {
+        int swap = order[i];
+        order[i++] = order[j];
+        order[j--] = swap;
+      }
+    }
+
+    if (k <= j) right = j;
+    else if (k >= i) left = i;
+    else break;
+  }
+
+  #undef PTM__CENTER
+}
+
+static int ptm__is_segment_in_bounds(const PTM_REAL* bounds_min, const PTM_REAL* bounds_max, const PTM_REAL* start, const PTM_REAL* direction, PTM_REAL max_fraction) {
+  // Slabs: the part of the segment between each pair of box sides 
+  // has to overlap on every axis
+  PTM_REAL enter = 0;
+  PTM_REAL exit = max_fraction;
+
+  for (int axis = 0; axis < 3; axis++) {
+    if (direction[axis] == 0) {
+      if (start[axis] < bounds_min[axis] || start[axis] > bounds_max[axis]) {
+        return 0;
+      }
+
+      continue;
+    }
+
+    PTM_REAL inverse = 1 / direction[axis];
+    PTM_REAL t0 = (bounds_min[axis] - start[axis]) * inverse;
+    PTM_REAL t1 = (bounds_max[axis] - start[axis]) * inverse;
+
+    if (t0 > t1) {
+      PTM_REAL swap = t0;
+      t0 = t1;
+      t1 = swap;
+    }
+
+    if (t0 > enter) enter = t0;
+    if (t1 < exit) exit = t1;
+
+    if (enter > exit) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void ptm__trace_brush(const ptm_collision* collision, int brush, const PTM_REAL* start, const PTM_REAL* end, ptm_trace* trace) {
+  // Clip the segment by each plane: it enters the brush at the last 
+  // plane it crosses going in, and leaves at the first going out
+  ptm_range planes = collision->brush_planes[brush];
+  PTM_REAL enter = 0;
+  PTM_REAL exit = 1;
+  const PTM_REAL* hit_plane = NULL;
+
+  for (int i = 0; i < planes.count; i++) {
+    const PTM_REAL* plane = &collision->planes[(planes.first + i) * 4];
+    PTM_REAL d0 = ptm__dot_vec3(plane, start) - plane[3];
+    PTM_REAL d1 = ptm__dot_vec3(plane, end) - plane[3];
+
+    if (d0 > 0 && d1 > 0) {
+      return;
+    }
+    if (d0 <= 0 && d1 <= 0) {
+      continue;
+    }
+
+    PTM_REAL t = d0 / (d0 - d1);
+
+    if (d0 > 0) {
+      if (t >= enter) {
+        enter = t;
+        hit_plane = plane;
+      }
+    }
+    else if (t < exit) {
+      exit = t;
+    }
+
+    if (enter > exit) {
+      return;
+    }
+  }
+
+  if (hit_plane == NULL) {
+    // Behind every plane at the start: the ray starts inside it
+    if (!trace->is_start_solid) {
+      ptm__zero_memory(trace, sizeof *trace);
+      trace->brush = brush;
+      trace->is_start_solid = 1;
+    }
+  }
+  else if (enter < trace->fraction && !trace->is_start_solid) {
+    trace->fraction = enter;
+    ptm__copy_memory(trace->normal, hit_plane, 3 * (int)sizeof(PTM_REAL));
+    trace->brush = brush;
+  }
+}
+
+static int ptm__is_point_in_brush(const ptm_collision* collision, int brush, const PTM_REAL* point) {
+  ptm_range planes = collision->brush_planes[brush];
+
+  for (int i = 0; i < planes.count; i++) {
+    const PTM_REAL* plane = &collision->planes[(planes.first + i) * 4];
+
+    if (ptm__dot_vec3(plane, point) > plane[3]) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int ptm__is_box_in_brush(const ptm_collision* collision, int brush, const PTM_REAL* min, const PTM_REAL* max) {
+  const PTM_REAL* bounds = &collision->brush_bounds[brush * 6];
+
+  if (!ptm__is_box_overlapping(bounds, bounds + 3, min, max)) {
+    return 0;
+  }
+
+  // The box is clear of a plane if even its corner furthest behind it
+  // is in front of it
+  ptm_range planes = collision->brush_planes[brush];
+
+  for (int i = 0; i < planes.count; i++) {
+    const PTM_REAL* plane = &collision->planes[(planes.first + i) * 4];
+    PTM_REAL corner[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+      corner[axis] = plane[axis] > 0 ? min[axis] : max[axis];
+    }
+
+    if (ptm__dot_vec3(plane, corner) > plane[3]) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int ptm__is_box_overlapping(const PTM_REAL* a_min, const PTM_REAL* a_max, const PTM_REAL* b_min, const PTM_REAL* b_max) {
+  return a_min[0] <= b_max[0] && a_max[0] >= b_min[0]
+      && a_min[1] <= b_max[1] && a_max[1] >= b_min[1]
+      && a_min[2] <= b_max[2] && a_max[2] >= b_min[2];
+}
+
+// === BINARY ===
+
+static void ptm__write_binary_map(ptm_binary_writer* writer, const ptm_map* map, int* entity_offsets) {
+  // The header is written last, once everything's been placed
+  int header_size = ptm__get_binary_header_size();
+  ptm__write_binary(writer, NULL, header_size);
+  int map_offset = ptm__write_binary(writer, map, sizeof *map);
+  PTM_ASSERT(map_offset == header_size);
+  ptm__write_binary_pointer(writer, map_offset + (int)offsetof(ptm_map, arena), 0);
+  ptm__write_binary_pointer(writer, map_offset + (int)offsetof(ptm_map, reload_cache), 0);
+  ptm__write_binary_pointer(writer, map_offset + (int)offsetof(ptm_map, deferred_meshes), 0);
+
+  // Every string's characters go first, so the rest can point at them
+  const ptm_string_pool* pool = &map->strings;
+
+  for (int i = 0; i < pool->slot_count; i++) {
+    if (pool->slots[i].data != NULL) {
+      writer->string_offsets[i] = ptm__write_binary(writer, pool->slots[i].data, pool->slots[i].length + 1);
+    }
+  }
+
+  int slots_field = map_offset + (int)offsetof(ptm_map, strings) + (int)offsetof(ptm_string_pool, slots);
+  int slots = ptm__write_binary_array(writer, slots_field, pool->slots, pool->slot_count * (int)sizeof(ptm_string));
+
+  for (int i = 0; i < pool->slot_count; i++) {
+    ptm__write_binary_string(writer, slots + i * (int)sizeof(ptm_string), pool->slots[i]);
+  }
+
+  // Lists become arrays, in list order, each element pointing at the next
+  int entity_count = 0;
+  entity_offsets[entity_count] = map_offset + (int)offsetof(ptm_map, world);
+  ptm__write_binary_entity(writer, entity_offsets[entity_count++], &map->world);
+
+  int classes_field = map_offset + (int)offsetof(ptm_map, entity_classes);
+  int classes = ptm__write_binary_array(writer, classes_field, NULL, map->entity_class_count * (int)sizeof(ptm_entity_class));
+  int class_index = 0;
+
+  for (ptm_entity_class* c = map->entity_classes; c != NULL; c = c->next) {
+    int class_offset = classes + class_index++ * (int)sizeof(ptm_entity_class);
+    ptm__write_binary_at(writer, class_offset, c, sizeof *c);
+    ptm__write_binary_pointer(writer, class_offset + (int)offsetof(ptm_entity_class, next), c->next != NULL ? class_offset + (int)sizeof *c : 0);
+    ptm__write_binary_string(writer, class_offset + (int)offsetof(ptm_entity_class, name), c->name);
+
+    int entities_field = class_offset + (int)offsetof(ptm_entity_class, entities);
+    int entities = ptm__write_binary_array(writer, entities_field, NULL, c->entity_count * (int)sizeof(ptm_entity));
+    int array_field = class_offset + (int)offsetof(ptm_entity_class, entity_array);
+    int array = ptm__write_binary_array(writer, array_field, NULL, c->entity_count * (int)sizeof(ptm_entity*));
+    int entity_index = 0;
+
+    for (ptm_entity* entity = c->entities; entity != NULL; entity = entity->next) {
+      int entity_offset = entities + entity_index * (int)sizeof(ptm_entity);
+      ptm__write_binary_pointer(writer, array + entity_index++ * (int)sizeof(ptm_entity*), entity_offset);
+      ptm__write_binary_at(writer, entity_offset, entity, sizeof *entity);
+      ptm__write_binary_pointer(writer, entity_offset + (int)offsetof(ptm_entity, next), entity->next != NULL ? entity_offset + (int)sizeof *entity : 0);
+      ptm__write_binary_entity(writer, entity_offset, entity);
+      entity_offsets[entity_count++] = entity_offset;
+    }
+
+    PTM_ASSERT(entity_index == c->entity_count);
+  }
+
+  PTM_ASSERT(class_index == map->entity_class_count);
+  ptm__write_binary_flat(writer, map_offset + (int)offsetof(ptm_map, flat), map->flat, entity_offsets);
+  ptm__write_binary_collision(writer, map_offset + (int)offsetof(ptm_map, collision), map->collision);
+}
+
+static void ptm__write_binary_entity(ptm_binary_writer* writer, int offset, const ptm_entity* entity) {
+  // The entity itself was already copied to offset, with its next pointer
+  ptm__write_binary_string(writer, offset + (int)offsetof(ptm_entity, class_name), entity->class_name);
+
+  int properties_field = offset + (int)offsetof(ptm_entity, properties);
+  int properties = ptm__write_binary_array(writer, properties_field, NULL, entity->property_count * (int)sizeof(ptm_property));
+  int index = 0;
+
+  for (ptm_property* property = entity->properties; property != NULL; property = property->next) {
+    int property_offset = properties + index++ * (int)sizeof(ptm_property);
+    ptm__write_binary_at(writer, property_offset, property, sizeof *property);
+    ptm__write_binary_pointer(writer, property_offset + (int)offsetof(ptm_property, next), property->next != NULL ? property_offset + (int)sizeof *property : 0);
+    ptm__write_binary_string(writer, property_offset + (int)offsetof(ptm_property, key), property->key);
+    ptm__write_binary_string(writer, property_offset + (int)offsetof(ptm_property, value), property->value);
+  }
+
+  PTM_ASSERT(index == entity->property_count);
+
+  // Every slot in use points into the properties just written
+  int slots_field = offset + (int)offsetof(ptm_entity, property_slots);
+  int slots = ptm__write_binary_array(writer, slots_field, NULL, entity->property_slot_count * (int)sizeof(ptm_property*));
+  index = 0;
+
+  for (ptm_property* property = entity->properties; property != NULL; property = property->next) {
+    ptm_property** slot = ptm__find_property_slot(entity->property_slots, entity->property_slot_count, property->key);
+
+    if (*slot == property) {
+      int slot_offset = slots + (int)(slot - entity->property_slots) * (int)sizeof(ptm_property*);
+      ptm__write_binary_pointer(writer, slot_offset, properties + index * (int)sizeof(ptm_property));
+    }
+
+    index++;
+  }
+
+  int brushes_field = offset + (int)offsetof(ptm_entity, brushes);
+  int brushes = ptm__write_binary_array(writer, brushes_field, NULL, entity->brush_count * (int)sizeof(ptm_brush));
+  index = 0;
+
+  for (ptm_brush* brush = entity->brushes; brush != NULL; brush = brush->next) {
+    int brush_offset = brushes + index++ * (int)sizeof(ptm_brush);
+    ptm__write_binary_at(writer, brush_offset, brush, sizeof *brush);
+    ptm__write_binary_pointer(writer, brush_offset + (int)offsetof(ptm_brush, next), brush->next != NULL ? brush_offset + (int)sizeof *brush : 0);
+
+    int faces_field = brush_offset + (int)offsetof(ptm_brush, faces);
+    int faces = ptm__write_binary_array(writer, faces_field, NULL, brush->face_count * (int)sizeof(ptm_brush_face));
+    int face_index = 0;
+
+    for (ptm_brush_face* face = brush->faces; face != NULL; face = face->next) {
+      int face_offset = faces + face_index++ * (int)sizeof(ptm_brush_face);
+      ptm__write_binary_at(writer, face_offset, face, sizeof *face);
+      ptm__write_binary_pointer(writer, face_offset + (int)offsetof(ptm_brush_face, next), face->next != NULL ? face_offset + (int)sizeof *face : 0);
+      ptm__write_binary_string(writer, face_offset + (int)offsetof(ptm_brush_face, texture_name), face->texture_name);
+    }
+
+    PTM_ASSERT(face_index == brush->face_count);
+  }
+
+  PTM_ASSERT(index == entity->brush_count);
+
+  // Clusters come before the meshes, which point back at them
+  int clusters_field = offset + (int)offsetof(ptm_entity, clusters);
+  int clusters = ptm__write_binary_array(writer, clusters_field, entity->clusters, entity->cluster_count * (int)sizeof(ptm_cluster));
+
+  int meshes_field = offset + (int)offsetof(ptm_entity, meshes);
+  int meshes = ptm__write_binary_array(writer, meshes_field, NULL, entity->mesh_count * (int)sizeof(ptm_mesh));
+  index = 0;
+
+  for (ptm_mesh* mesh = entity->meshes; mesh != NULL; mesh = mesh->next) {
+    int mesh_offset = meshes + index++ * (int)sizeof(ptm_mesh);
+    int vertex_count = mesh->vertex_count;
+    ptm__write_binary_at(writer, mesh_offset, mesh, sizeof *mesh);
+    ptm__write_binary_pointer(writer, mesh_offset + (int)offsetof(ptm_mesh, next), mesh->next != NULL ? mesh_offset + (int)sizeof *mesh : 0);
+    ptm__write_binary_array(writer, mesh_offset + (int)offsetof(ptm_mesh, vertex_positions), mesh->vertex_positions, vertex_count * 3 * (int)sizeof(PTM_REAL));
+    ptm__write_binary_array(writer, mesh_offset + (int)offsetof(ptm_mesh, vertex_texcoords), mesh->vertex_texcoords, vertex_count * 2 * (int)sizeof(PTM_REAL));
+    ptm__write_binary_array(writer, mesh_offset + (int)offsetof(ptm_mesh, vertex_normals), mesh->vertex_normals, vertex_count * 3 * (int)sizeof(PTM_REAL));
+    ptm__write_binary_array(writer, mesh_offset + (int)offsetof(ptm_mesh, vertex_tangents), mesh->vertex_tangents, vertex_count * 4 * (int)sizeof(PTM_REAL));
+    ptm__write_binary_array(writer, mesh_offset + (int)offsetof(ptm_mesh, vertices), mesh->vertices, mesh->vertices != NULL ? vertex_count * mesh->vertex_stride : 0);
+    ptm__write_binary_array(writer, mesh_offset + (int)offsetof(ptm_mesh, indices), mesh->indices, mesh->index_count * (int)sizeof(PTM_INDEX));
+    ptm__write_binary_string(writer, mesh_offset + (int)offsetof(ptm_mesh, texture_name), mesh->texture_name);
+
+    int cluster_offset = 0;
+
+    if (mesh->cluster != NULL) {
+      cluster_offset = clusters + (int)(mesh->cluster - entity->clusters) * (int)sizeof(ptm_cluster);
+
+      if (mesh->cluster->meshes == mesh) {
+        ptm__write_binary_pointer(writer, cluster_offset + (int)offsetof(ptm_cluster, meshes), mesh_offset);
+      }
+    }
+
+    ptm__write_binary_pointer(writer, mesh_offset + (int)offsetof(ptm_mesh, cluster), cluster_offset);
+  }
+
+  PTM_ASSERT(index == entity->mesh_count);
+}
+
+static void ptm__write_binary_flat(ptm_binary_writer* writer, int field, const ptm_flat_map* flat, const int* entity_offsets) {
+  if (flat == NULL) {
+    ptm__write_binary_pointer(writer, field, 0);
+    return;
+  }
+
+  int offset = ptm__write_binary_array(writer, field, flat, sizeof *flat);
+  int real_size = (int)sizeof(PTM_REAL);
+  int face_count = flat->face_count;
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_flat_map, plane_normals), flat->plane_normals, face_count * 3 * real_size);
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_flat_map, plane_cs), flat->plane_cs, face_count * real_size);
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_flat_map, texture_uvs), flat->texture_uvs, face_count * 6 * real_size);
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_flat_map, texture_offsets), flat->texture_offsets, face_count * 2 * real_size);
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_flat_map, texture_scales), flat->texture_scales, face_count * 2 * real_size);
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_flat_map, brush_faces), flat->brush_faces, flat->brush_count * (int)sizeof(ptm_range));
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_flat_map, entity_brushes), flat->entity_brushes, flat->entity_count * (int)sizeof(ptm_range));
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_flat_map, class_entities), flat->class_entities, flat->class_count * (int)sizeof(ptm_range));
+
+  int texture_names_field = offset + (int)offsetof(ptm_flat_map, texture_names);
+  int texture_names = ptm__write_binary_array(writer, texture_names_field, flat->texture_names, face_count * (int)sizeof(ptm_string));
+
+  for (int i = 0; i < face_count; i++) {
+    ptm__write_binary_string(writer, texture_names + i * (int)sizeof(ptm_string), flat->texture_names[i]);
+  }
+
+  // Flat entities are in the same order the entities were written in
+  int entities_field = offset + (int)offsetof(ptm_flat_map, entities);
+  int entities = ptm__write_binary_array(writer, entities_field, NULL, flat->entity_count * (int)sizeof(ptm_entity*));
+
+  for (int i = 0; i < flat->entity_count; i++) {
+    ptm__write_binary_pointer(writer, entities + i * (int)sizeof(ptm_entity*), entity_offsets[i]);
+  }
+}
+
+static void ptm__write_binary_collision(ptm_binary_writer* writer, int field, const ptm_collision* collision) {
+  if (collision == NULL) {
+    ptm__write_binary_pointer(writer, field, 0);
+    return;
+  }
+
+  int offset = ptm__write_binary_array(writer, field, collision, sizeof *collision);
+  int real_size = (int)sizeof(PTM_REAL);
+  int brush_count = collision->brush_count;
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_collision, planes), collision->planes, collision->plane_count * 4 * real_size);
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_collision, vertices), collision->vertices, collision->vertex_count * 3 * real_size);
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_collision, brush_planes), collision->brush_planes, brush_count * (int)sizeof(ptm_range));
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_collision, brush_vertices), collision->brush_vertices, brush_count * (int)sizeof(ptm_range));
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_collision, brush_bounds), collision->brush_bounds, brush_count * 6 * real_size);
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_collision, brush_indices), collision->brush_indices, brush_count * (int)sizeof(int));
+  ptm__write_binary_array(writer, offset + (int)offsetof(ptm_collision, nodes), collision->nodes, collision->node_count * (int)sizeof(ptm_collision_node));
+}
+
+static int ptm__write_binary_array(ptm_binary_writer* writer, int field, const void* source, int bytes) {
+  // Empty arrays are NULL, like the loader leaves them
+  int offset = bytes > 0 ? ptm__write_binary(writer, source, bytes) : 0;
+  ptm__write_binary_pointer(writer, field, offset);
+  return offset;
+}
+
+static int ptm__write_binary(ptm_binary_writer* writer, const void* source, int bytes) {
+  // Aligned the same way the arena aligns pushes
+  int alignment = bytes & -bytes;
+
+  if (alignment == 0 || alignment > PTM_ARENA_ALIGNMENT) {
+    alignment = PTM_ARENA_ALIGNMENT;
+  }
+
+  int offset = (writer->size + alignment - 1) & ~(alignment - 1);
+
+  if (writer->data != NULL) {
+    ptm__zero_memory(writer->data + writer->size, offset - writer->size);
+
+    if (source != NULL) ptm__copy_memory(writer->data + offset, source, bytes);
+    else ptm__zero_memory(writer->data + offset, bytes);
+  }
+
+  writer->size = offset + bytes;
+  return offset;
+}
+
+static void ptm__write_binary_at(ptm_binary_writer* writer, int offset, const void* source, int bytes) {
+  if (writer->data != NULL) {
+    ptm__copy_memory(writer->data + offset, source, bytes);
+  }
+}
+
+static void ptm__write_binary_pointer(ptm_binary_writer* writer, int field, int target) {
+  // Every field gets written: the copied structs still hold the old pointers
+  if (writer->data != NULL) {
+    *(char**)(writer->data + field) = (char*)(uintptr_t)target;
+  }
+
+  if (target != 0) {
+    if (writer->data != NULL) {
+      writer->relocations[writer->relocation_count] = field;
+    }
+
+    writer->relocation_count++;
+  }
+}
+
+static void ptm__write_binary_string(ptm_binary_writer* writer, int field, ptm_string string) {
+  int target = 0;
+
+  if (string.data != NULL) {
+    ptm_string* slot = ptm__find_string_slot(writer->strings, string.data, string.length, string.hash);
+    PTM_ASSERT(slot->data == string.data);
+    target = writer->string_offsets[slot - writer->strings->slots];
+  }
+
+  ptm__write_binary_pointer(writer, field + (int)offsetof(ptm_string, data), target);
+}
+
+static int ptm__get_binary_layout(void) {
+  return (int)sizeof(PTM_REAL) | (int)sizeof(PTM_INDEX) << 8 | (int)sizeof(PTM_HASH) << 16 | (int)sizeof(void*) << 24;
+}
+
+static int ptm__get_binary_header_size(void) {
+  // Padded so the map right after it is aligned for anything
+  int header_size = (int)sizeof(ptm_binary_header);
+  return (header_size + PTM_ARENA_ALIGNMENT - 1) & ~(PTM_ARENA_ALIGNMENT - 1);
+}
+
+static ptm_map* ptm__relocate_binary(char* binary, int binary_size, unsigned long long source_hash) {
+  ptm_binary_header* header = (ptm_binary_header*)binary;
+
+  // Anything off means a stale (or broken) cache, never a crash
+  if (binary_size < ptm__get_binary_header_size()) return NULL;
+  if (!ptm__compare_memory(header->magic, "PTMB", 4)) return NULL;
+  if (header->version != PTM__BINARY_VERSION) return NULL;
+  if (header->layout != ptm__get_binary_layout()) return NULL;
+  if (header->size != binary_size) return NULL;
+  if (header->source_hash != source_hash) return NULL;
+  if (header->map_offset != ptm__get_binary_header_size()) return NULL;
+  if (header->relocation_offset < header->map_offset || header->relocation_count < 0) return NULL;
+  if ((long long)header->relocation_count * (int)sizeof(int) > binary_size - header->relocation_offset) return NULL;
+
+  const int* relocations = (const int*)(binary + header->relocation_offset);
+  int pointer_end = header->relocation_offset - (int)sizeof(char*);
+
+  for (int i = 0; i < header->relocation_count; i++) {
+    int field = relocations[i];
+
+    if (field < header->map_offset || field > pointer_end || field % (int)sizeof(char*) != 0) {
+      return NULL;
+    }
+
+    char** pointer = (char**)(binary + field);
+    uintptr_t target = (uintptr_t)*pointer;
+
+    if (target >= (uintptr_t)header->relocation_offset) {
+      return NULL;
+    }
+
+    *pointer = binary + target;
+  }
+
+  return (ptm_map*)(binary + header->map_offset);
 }
 
 #endif // PT_MAP_IMPLEMENTATION
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#ifndef PT_MAP_BENCH_MAPS
+#define PT_MAP_BENCH_MAPS "maps"
+#endif
+
+// Phase timings come from pt_map's profiling hooks. Zones are only
+// timed on profiled runs, so the plain runs don't pay for the timers.
+static double now_seconds(void);
+static void begin_zone(const char* zone);
+static void end_zone(const char* zone);
+
+#define PTM_PROFILE_BEGIN(zone) begin_zone(zone)
+#define PTM_PROFILE_END(zone) end_zone(zone)
+
+// pt_clip's zones are entered for every plane, too often for these 
+// timers: leave them out instead of getting pt_map's
+#define PTC_PROFILE_BEGIN(zone)
+#define PTC_PROFILE_END(zone)
+#define PT_MAP_IMPLEMENTATION
+#include "pt_map.h"
+
+typedef struct zone_timer {
+  const char* zone;
+  double start;
+  double total;
+} zone_timer;
+
+static zone_timer zones[] = { {"parse", 0.0, 0.0}, {"intern", 0.0, 0.0}, {"mesh", 0.0, 0.0} };
+static int is_profiling = 0;
+
+#if defined(_WIN32)
+static DWORD profiling_thread;
+#else
+static pthread_t profiling_thread;
+#endif
+
+typedef struct bench_result {
+  double mean;
+  double p99;
+  double parse;
+  double intern;
+  double mesh;
+  ptm_arena_stats arena_stats;
+} bench_result;
+
+static double now_seconds(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+#endif
+}
+
+static zone_timer* find_zone(const char* zone) {
+  for (int i = 0; i < (int)(sizeof zones / sizeof *zones); i++) {
+    if (strcmp(zones[i].zone, zone) == 0) {
+      return &zones[i];
+    }
+  }
+  return NULL;
+}
+
+// Threaded parses enter "intern" from every load thread, but the timers
+// aren't shared safely: only the thread that started the profiled runs
+// is timed, so with threads intern is that thread's share of it.
+static int is_profiling_thread(void) {
+#if defined(_WIN32)
+  return GetCurrentThreadId() == profiling_thread;
+#else
+  return pthread_equal(pthread_self(), profiling_thread);
+#endif
+}
+
+static void begin_zone(const char* zone) {
+  if (is_profiling && is_profiling_thread()) {
+    zone_timer* timer = find_zone(zone);
+
+    if (timer != NULL) {
+      timer->start = now_seconds();
+    }
+  }
+}
+
+static void end_zone(const char* zone) {
+  if (is_profiling && is_profiling_thread()) {
+    zone_timer* timer = find_zone(zone);
+
+    if (timer != NULL) {
+      timer->total += now_seconds() - timer->start;
+    }
+  }
+}
+
+static int compare_doubles(const void* opaque_first, const void* opaque_second) {
+  double first = *(const double*)opaque_first;
+  double second = *(const double*)opaque_second;
+  return (first > second) - (first < second);
+}
+
+static char* read_file(const char* file_path, int* length) {
+  FILE* file = fopen(file_path, "rb");
+
+  if (file == NULL) {
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  *length = (int)ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char* source = malloc(*length > 0 ? *length : 1);
+  *length = (int)fread(source, 1, *length, file);
+  fclose(file);
+  return source;
+}
+
+// A grid of cubes in the world, with a light entity for every 16 of
+// them: roughly the mix of brushes and point entities of a real level.
+static char* create_synthetic_map(int brush_count, int* length) {
+  static const char* face_format = "( %d %d %d ) ( %d %d %d ) ( %d %d %d ) synthetic/texture_%d [ %s 0 ] [ %s 0 ] 0 1 1\n";
+  int capacity = 256 + brush_count * 700;
+  char* source = malloc(capacity);
+  int size = 0;
+  int side = 1;
+
+  while (side * side < brush_count) {
+    side++;
+  }
+
+  size += sprintf(source + size, "// Game: Generic\n// Format: Valve\n// entity 0\n{\n\"mapversion\" \"220\"\n\"classname\" \"worldspawn\"\n");
+
+  for (int i = 0; i < brush_count; i++) {
+    int x0 = (i % side) * 128 - side * 64;
+    int y0 = (i / side) * 128 - side * 64;
+    int z0 = (i % 7) * 16;
+    int x1 = x0 + 64 + (i % 3) * 16;
+    int y1 = y0 + 64 + (i % 5) * 8;
+    int z1 = z0 + 64;
+    int texture = i % 32;
+
+    size += sprintf(source + size, "// brush %d\n{\n", i);
+    size += sprintf(source + size, face_format, x0, y0, z0, x0, y0 + 1, z0, x0, y0, z0 + 1, texture, "0 -1 0", "0 0 -1");
+    size += sprintf(source + size, face_format, x0, y0, z0, x0, y0, z0 + 1, x0 + 1, y0, z0, texture, "1 0 0", "0 0 -1");
+    size += sprintf(source + size, face_format, x0, y0, z0, x0 + 1, y0, z0, x0, y0 + 1, z0, texture, "-1 0 0", "0 -1 0");
+    size += sprintf(source + size, face_format, x1, y1, z1, x1, y1 + 1, z1, x1 + 1, y1, z1, texture, "1 0 0", "0 -1 0");
+    size += sprintf(source + size, face_format, x1, y1, z1, x1 + 1, y1, z1, x1, y1, z1 + 1, texture, "-1 0 0", "0 0 -1");
+    size += sprintf(source + size, face_format, x1, y1, z1, x1, y1, z1 + 1, x1, y1 + 1, z1, texture, "0 1 0", "0 0 -1");
+    size += sprintf(source + size, "}\n");
+  }
+
+  size += sprintf(source + size, "}\n");
+
+  for (int i = 0; i < brush_count; i += 16) {
+    int x = (i % side) * 128 - side * 64 + 32;
+    int y = (i / side) * 128 - side * 64 + 32;
+    size += sprintf(source + size, "// entity %d\n{\n\"classname\" \"light\"\n\"origin\" \"%d %d 96\"\n\"light\" \"%d\"\n}\n", i / 16 + 1, x, y, 200 + i % 100);
+  }
+
+  *length = size;
+  return source;
+}
+
+static bench_result run_bench(const char* source, int length, int iterations, const ptm_load_options* options) {
+  bench_result result = {0};
+  double* times = malloc(iterations * sizeof *times);
+  double total = 0.0;
+
+  // The first load warms up the caches and the allocator
+  ptm_free(ptm_load_source_ex(source, length, options));
+
+  for (int i = 0; i < iterations; i++) {
+    double start = now_seconds();
+    ptm_map* map = ptm_load_source_ex(source, length, options);
+    times[i] = now_seconds() - start;
+    total += times[i];
+
+    if (i == 0) {
+      result.arena_stats = map->arena_stats;
+    }
+
+    ptm_free(map);
+  }
+
+  qsort(times, iterations, sizeof *times, compare_doubles);
+  result.mean = total / iterations;
+  result.p99 = times[(iterations * 99 + 99) / 100 - 1];
+
+  // Profiled runs are separate, since timing every string adds up
+  for (int i = 0; i < (int)(sizeof zones / sizeof *zones); i++) {
+    zones[i].total = 0.0;
+  }
+
+#if defined(_WIN32)
+  profiling_thread = GetCurrentThreadId();
+#else
+  profiling_thread = pthread_self();
+#endif
+  is_profiling = 1;
+
+  for (int i = 0; i < iterations; i++) {
+    ptm_free(ptm_load_source_ex(source, length, options));
+  }
+
+  is_profiling = 0;
+  result.parse = (find_zone("parse")->total - find_zone("intern")->total) / iterations;
+  result.intern = find_zone("intern")->total / iterations;
+  result.mesh = find_zone("mesh")->total / iterations;
+
+  free(times);
+  return result;
+}
+
+// Two brushes with opposite slanted faces, the second one gap units
+// further out: hidden face culling may only drop the first one's face
+// when they touch (a gap of 0).
+static int count_slanted_gap_indices(double gap, int cull_hidden_faces) {
+  static const char* format =
+    "{\n\"classname\" \"worldspawn\"\n\"mapversion\" \"220\"\n"
+    "{\n"
+    "( 0 0 0 ) ( 0 1 0 ) ( 0 0 1 ) test [ 0 -1 0 0 ] [ 0 0 -1 0 ] 0 1 1\n"
+    "( 0 0 0 ) ( 0 0 1 ) ( 1 0 0 ) test [ 1 0 0 0 ] [ 0 0 -1 0 ] 0 1 1\n"
+    "( 0 0 0 ) ( 1 0 0 ) ( 0 1 0 ) test [ -1 0 0 0 ] [ 0 -1 0 0 ] 0 1 1\n"
+    "( 0 64 0 ) ( 1 64 0 ) ( 0 64 1 ) test [ -1 0 0 0 ] [ 0 0 -1 0 ] 0 1 1\n"
+    "( 90 0 0 ) ( 89 0 1 ) ( 90 1 0 ) test [ 0 1 0 0 ] [ 0 0 -1 0 ] 0 1 1\n"
+    "}\n"
+    "{\n"
+    "( 100 0 0 ) ( 100 0 1 ) ( 100 1 0 ) test [ 0 1 0 0 ] [ 0 0 -1 0 ] 0 1 1\n"
+    "( 0 0 100 ) ( 0 1 100 ) ( 1 0 100 ) test [ 1 0 0 0 ] [ 0 -1 0 0 ] 0 1 1\n"
+    "( 0 0 0 ) ( 0 0 1 ) ( 1 0 0 ) test [ 1 0 0 0 ] [ 0 0 -1 0 ] 0 1 1\n"
+    "( 0 64 0 ) ( 1 64 0 ) ( 0 64 1 ) test [ -1 0 0 0 ] [ 0 0 -1 0 ] 0 1 1\n"
+    "( %g 0 0 ) ( %g 1 0 ) ( %g 0 1 ) test [ 0 1 0 0 ] [ 0 0 -1 0 ] 0 1 1\n"
+    "}\n"
+    "}\n";
+  char source[1024];
+  int length = snprintf(source, sizeof source, format, 90 + gap, 90 + gap, 89 + gap);
+  ptm_load_options options = {0};
+  options.cull_hidden_faces = cull_hidden_faces;
+  ptm_map* map = ptm_load_source_ex(source, length, &options);
+  int index_count = 0;
+
+  for (ptm_mesh* mesh = map->world.meshes; mesh != NULL; mesh = mesh->next) {
+    index_count += mesh->index_count;
+  }
+
+  ptm_free(map);
+  return index_count;
+}
+
+static int check_culling(void) {
+  // Touching faces lose the covered one (a quad, so 6 indices)
+  static const double gaps[] = { 0.0, 0.5, 1.2 };
+  int failure_count = 0;
+
+  for (int i = 0; i < (int)(sizeof gaps / sizeof *gaps); i++) {
+    int expected = count_slanted_gap_indices(gaps[i], 0) - (i == 0 ? 6 : 0);
+    int culled = count_slanted_gap_indices(gaps[i], 1);
+
+    if (culled != expected) {
+      printf("culling with a slanted gap of %g: %i indices, expected %i\n", gaps[i], culled, expected);
+      failure_count++;
+    }
+  }
+
+  return failure_count;
+}
+
+static void print_result(const char* name, int length, bench_result* result) {
+  double megabytes = (double)length / (1024.0 * 1024.0);
+
+  printf("%-26s %9.2f %8.1f %8.3f %8.3f %9.3f %8.3f %8.3f %10i %10i %10i\n", name,
+    megabytes, megabytes / result->mean, result->mean * 1e3, result->p99 * 1e3,
+    result->parse * 1e3, result->intern * 1e3, result->mesh * 1e3,
+    result->arena_stats.bytes_used, result->arena_stats.bytes_reserved, result->arena_stats.high_water_mark);
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+    printf("USAGE: %s [iterations] [thread count] [synthetic brush count] [map files...]\n", argv[0]);
+    return 1;
+  }
+
+  int iterations = argc >= 2 ? atoi(argv[1]) : 20;
+  int synthetic_brush_count = argc >= 4 ? atoi(argv[3]) : 10000;
+  ptm_load_options options = {0};
+  options.thread_count = argc >= 3 ? atoi(argv[2]) : 1;
+
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  const char* default_maps[] = {
+    PT_MAP_BENCH_MAPS "/simple.map",
+    PT_MAP_BENCH_MAPS "/complex_entity.map",
+    PT_MAP_BENCH_MAPS "/complex_brush.map",
+  };
+
+  const char** map_files = argc >= 5 ? (const char**)argv + 4 : default_maps;
+  int map_file_count = argc >= 5 ? argc - 4 : (int)(sizeof default_maps / sizeof *default_maps);
+
+  if (check_culling() > 0) {
+    return 1;
+  }
+
+  printf("%i iterations, %i threads\n\n", iterations, options.thread_count);
+  printf("%-26s %9s %8s %8s %8s %9s %8s %8s %10s %10s %10s\n", "map", "MB", "MB/s",
+    "mean ms", "p99 ms", "parse ms", "intern", "mesh", "used", "reserved", "peak");
+
+  for (int i = 0; i < map_file_count; i++) {
+    int length = 0;
+    char* source = read_file(map_files[i], &length);
+
+    if (source == NULL) {
+      printf("%-26s could not be read\n", map_files[i]);
+      continue;
+    }
+
+    const char* name = strrchr(map_files[i], '/');
+    bench_result result = run_bench(source, length, iterations, &options);
+    print_result(name != NULL ? name + 1 : map_files[i], length, &result);
+    free(source);
+  }
+
+  if (synthetic_brush_count > 0) {
+    int length = 0;
+    char* source = create_synthetic_map(synthetic_brush_count, &length);
+    char name[64];
+    snprintf(name, sizeof name, "synthetic (%i brushes)", synthetic_brush_count);
+
+    bench_result result = run_bench(source, length, iterations, &options);
+    print_result(name, length, &result);
+    free(source);
+  }
+
+  return 0;
+}
@@ -1,3 +1,4 @@
+#define PTM_LOAD_STATS
 #define PT_MAP_IMPLEMENTATION
 #include "pt_map.h"
 #include <stdio.h>
@@ -11,18 +12,26 @@ static int compare_entity_classes(const void* opaque_first, const void* opaque_s
 
 int main(int argc, char** argv) {
   if (argc < 2) {
-    printf("USAGE: %s <map file>\n", argv[0]);
+    printf("USAGE: %s <map file> [thread count]\n", argv[0]);
     return 1;
   }
 
   const char* map_file_name = argv[1];
-  ptm_map* map = ptm_load(map_file_name);
+  ptm_load_options options = {0};
+  options.thread_count = argc >= 3 ? atoi(argv[2]) : 1;
+  options.collision = 1;
+  ptm_map* map = ptm_load_mapped_ex(map_file_name, &options);
+
+  if (map == NULL) {
+    printf("Couldn't load %s\n", map_file_name);
+    return 1;
+  }
 
   int total_brush_count = 0;
   int total_entity_count = 0;
 
   // print world info
-  printf("worldspawn: %i brushes\n\n", map->world.brush_count);
+  printf("worldspawn: %i brushes, %i meshes\n\n", map->world.brush_count, map->world.mesh_count);
   total_brush_count += map->world.brush_count;
 
   // create sorted array of entity classes
@@ -64,6 +73,17 @@ int main(int argc, char** argv) {
   }
 
   printf("\n%s: %i brushes, %i classes, %i entities\n", map_file_name, total_brush_count, map->entity_class_count, total_entity_count);
+  printf("arena: %i bytes used, %i reserved, %i peak\n", map->arena_stats.bytes_used, map->arena_stats.bytes_reserved, map->arena_stats.high_water_mark);
+
+  ptm_load_stats* stats = &map->load_stats;
+  printf("parse: %lld bytes, %lld numbers, %i strings looked up (%i already interned)\n", stats->bytes_scanned, stats->numbers_parsed, stats->string_lookups, stats->string_hits);
+  printf("clip: %i brushes, %i planes clipped, %i skipped, %i vertices, %i edges and %i faces created\n", stats->brushes_clipped, stats->planes_clipped, stats->planes_skipped, stats->vertices_created, stats->edges_created, stats->faces_created);
+
+  if (map->collision != NULL) {
+    ptm_collision* collision = map->collision;
+    printf("collision: %i brushes, %i planes, %i vertices, %i nodes\n", collision->brush_count, collision->plane_count, collision->vertex_count, collision->node_count);
+  }
+
   free(list);
   ptm_free(map);
   return 0;